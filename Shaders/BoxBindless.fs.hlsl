@@ -0,0 +1,56 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRICompatibility.hlsli"
+
+struct OutputVS
+{
+    float4 position : SV_Position;
+    float2 texCoords : TEXCOORD0;
+};
+
+#ifndef NRI_DXBC
+
+struct BindlessConstants
+{
+    uint transformIndex;
+    uint textureIndex0;
+    uint textureIndex1;
+    uint textureIndex2;
+    uint materialIndex;
+};
+
+NRI_ROOT_CONSTANTS( BindlessConstants, g_BindlessConstants, 0, 0 );
+
+NRI_RESOURCE( cbuffer, GlobalConstants, b, 1, 0 )
+{
+    float4 globalConstants;
+};
+
+NRI_RESOURCE( cbuffer, ViewConstants, b, 2, 0 )
+{
+    float4x4 projView;
+    float4 viewConstants;
+};
+
+NRI_RESOURCE( StructuredBuffer<float4>, materials, t, 0, 0 );
+NRI_RESOURCE( SamplerState, sampler0, s, 0, 1 );
+NRI_RESOURCE( Texture2D, textures[], t, 0, 2 );
+
+float4 main( in OutputVS input ) : SV_Target
+{
+    const float4 constants = globalConstants + viewConstants + materials[ g_BindlessConstants.materialIndex ];
+    const float4 sample0 = textures[ g_BindlessConstants.textureIndex0 ].Sample( sampler0, input.texCoords );
+    const float4 sample1 = textures[ g_BindlessConstants.textureIndex1 ].Sample( sampler0, input.texCoords );
+    const float4 sample2 = textures[ g_BindlessConstants.textureIndex2 ].Sample( sampler0, input.texCoords );
+
+    return sample0 + constants + sample1 * 0.001 + sample2 * 0.001;
+}
+
+#else
+
+float4 main( in OutputVS input ) : SV_Target
+{
+    return 0;
+}
+
+#endif
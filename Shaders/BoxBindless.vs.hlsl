@@ -0,0 +1,52 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRICompatibility.hlsli"
+
+struct InputVS
+{
+    float3 position : POSITION;
+    float2 texCoords : TEXCOORD0;
+};
+
+struct OutputVS
+{
+    float4 position : SV_Position;
+    float2 texCoords : TEXCOORD0;
+};
+
+struct BindlessConstants
+{
+    uint transformIndex;
+    uint textureIndex0;
+    uint textureIndex1;
+    uint textureIndex2;
+    uint materialIndex;
+};
+
+NRI_ROOT_CONSTANTS( BindlessConstants, g_BindlessConstants, 0, 0 );
+
+NRI_RESOURCE( cbuffer, GlobalConstants, b, 1, 0 )
+{
+    float4 globalConstants;
+};
+
+NRI_RESOURCE( cbuffer, ViewConstants, b, 2, 0 )
+{
+    float4x4 projView;
+    float4 viewConstants;
+};
+
+NRI_RESOURCE( StructuredBuffer<float4>, materials, t, 0, 0 );
+NRI_RESOURCE( StructuredBuffer<float4x4>, transforms, t, 1, 0 );
+
+OutputVS main( in InputVS input )
+{
+    const float4 constants = globalConstants + viewConstants + materials[ g_BindlessConstants.materialIndex ];
+    const float4x4 transform = transforms[ g_BindlessConstants.transformIndex ];
+
+    OutputVS output;
+    output.position = mul( projView, mul( transform, float4( input.position, 1 ) + constants ) );
+    output.texCoords = input.texCoords;
+
+    return output;
+}
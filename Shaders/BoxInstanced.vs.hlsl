@@ -0,0 +1,52 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRICompatibility.hlsli"
+
+struct InputVS
+{
+    float3 position : POSITION;
+    float2 texCoords : TEXCOORD0;
+};
+
+struct OutputVS
+{
+    float4 position : SV_Position;
+    float2 texCoords : TEXCOORD0;
+};
+
+struct InstanceConstants
+{
+    uint baseTransform;
+};
+
+NRI_ROOT_CONSTANTS( InstanceConstants, g_InstanceConstants, 0, 0 );
+
+NRI_RESOURCE( cbuffer, GlobalConstants, b, 1, 0 )
+{
+    float4 globalConstants;
+};
+
+NRI_RESOURCE( cbuffer, ViewConstants, b, 2, 0 )
+{
+    float4x4 projView;
+    float4 viewConstants;
+};
+
+NRI_RESOURCE( cbuffer, MaterialConstants, b, 3, 0 )
+{
+    float4 materialConstants;
+};
+
+NRI_RESOURCE( StructuredBuffer<float4x4>, transforms, t, 3, 0 );
+
+OutputVS main( in InputVS input, uint instanceID : SV_InstanceID )
+{
+    const float4 constants = globalConstants + viewConstants + materialConstants;
+    const float4x4 transform = transforms[ g_InstanceConstants.baseTransform + instanceID ];
+
+    OutputVS output;
+    output.position = mul( projView, mul( transform, float4( input.position, 1 ) + constants ) );
+    output.texCoords = input.texCoords;
+
+    return output;
+}
@@ -0,0 +1,146 @@
+// © 2021 NVIDIA Corporation
+
+#include "SceneDrawGeneration.hlsli"
+
+groupshared uint s_GroupRejectedNum;
+
+// Meshes are drawn without instance transforms, so bounds are in scene space
+bool IsVisible(MeshData mesh, bool testOcclusion)
+{
+    float4 center = mul(Constants.SceneToClip, float4(mesh.boundsCenter.xyz, 1.0));
+    float4 axisX = mul(Constants.SceneToClip, float4(mesh.boundsExtents.x, 0.0, 0.0, 0.0));
+    float4 axisY = mul(Constants.SceneToClip, float4(0.0, mesh.boundsExtents.y, 0.0, 0.0));
+    float4 axisZ = mul(Constants.SceneToClip, float4(0.0, 0.0, mesh.boundsExtents.z, 0.0));
+
+    // Culled if all corners are outside of the same plane (depth is in [0; w] for both regular and reversed Z)
+    uint outsideMask = 0x3F;
+
+    float2 ndcMin = 1e30;
+    float2 ndcMax = -1e30;
+    float nearestZ = 0.0;
+    bool isClipped = false;
+
+    [unroll]
+    for (uint i = 0; i < 8; i++)
+    {
+        float4 p = center;
+        p += (i & 1) ? axisX : -axisX;
+        p += (i & 2) ? axisY : -axisY;
+        p += (i & 4) ? axisZ : -axisZ;
+
+        uint mask = 0;
+        mask |= p.x < -p.w ? 0x01 : 0;
+        mask |= p.x > p.w ? 0x02 : 0;
+        mask |= p.y < -p.w ? 0x04 : 0;
+        mask |= p.y > p.w ? 0x08 : 0;
+        mask |= p.z < 0.0 ? 0x10 : 0;
+        mask |= p.z > p.w ? 0x20 : 0;
+
+        outsideMask &= mask;
+
+        if (p.w > 0.0)
+        {
+            float3 ndc = p.xyz / p.w;
+            ndcMin = min(ndcMin, ndc.xy);
+            ndcMax = max(ndcMax, ndc.xy);
+            nearestZ = max(nearestZ, ndc.z);
+        }
+        else
+            isClipped = true;
+    }
+
+    if (outsideMask != 0)
+        return false;
+
+    // Bounds crossing the camera plane can't be projected
+    if (!testOcclusion || isClipped)
+        return true;
+
+    // Screen rectangle (Y is flipped)
+    float2 uvMin = saturate(float2(ndcMin.x, -ndcMax.y) * 0.5 + 0.5);
+    float2 uvMax = saturate(float2(ndcMax.x, -ndcMin.y) * 0.5 + 0.5);
+
+    // The rectangle covers at most 2x2 texels in this mip
+    uint2 pyramidSize = uint2(Constants.DepthPyramidWidth, Constants.DepthPyramidHeight);
+    float2 rectSize = (uvMax - uvMin) * float2(pyramidSize);
+    uint mip = (uint)ceil(log2(max(max(rectSize.x, rectSize.y), 1.0)));
+    mip = min(mip, firstbithigh(max(pyramidSize.x, pyramidSize.y)));
+
+    uint2 mipSize = max(pyramidSize >> mip, 1);
+    uint2 texelMin = min(uint2(uvMin * float2(mipSize)), mipSize - 1);
+    uint2 texelMax = min(uint2(uvMax * float2(mipSize)), mipSize - 1);
+
+    float farthestZ = DepthPyramid.Load(int3(texelMin, mip));
+    farthestZ = min(farthestZ, DepthPyramid.Load(int3(texelMax.x, texelMin.y, mip)));
+    farthestZ = min(farthestZ, DepthPyramid.Load(int3(texelMin.x, texelMax.y, mip)));
+    farthestZ = min(farthestZ, DepthPyramid.Load(int3(texelMax, mip)));
+
+    // Reversed Z: occluded if the nearest point is behind everything drawn in the early phase
+    return nearestZ >= farthestZ;
+}
+
+// Early phase takes instances visible in the previous frame. Late phase tests all instances against the depth pyramid
+// built from the early phase, updates visibility and takes only newly visible instances. Taken instances are counted per mesh
+[numthreads(CTA_SIZE, 1, 1)]
+void main(uint threadId : SV_DispatchThreadId, uint groupThreadId : SV_GroupThreadId)
+{
+    if (groupThreadId == 0)
+        s_GroupRejectedNum = 0;
+
+    GroupMemoryBarrierWithGroupSync();
+
+    uint instanceIndex = threadId;
+    if (instanceIndex < Constants.InstanceCount)
+    {
+        uint meshIndex = Instances[instanceIndex].meshIndex;
+        MeshData mesh = Meshes[meshIndex];
+
+        bool wasVisible = Constants.EnableOcclusionCulling == 0 || Visibility[instanceIndex] != 0;
+        bool isVisible = false;
+        bool isDrawn = false;
+        bool isRejected = false;
+
+        if (Constants.Phase == 0)
+        {
+            isVisible = wasVisible && (Constants.EnableCulling == 0 || IsVisible(mesh, false));
+            isDrawn = isVisible;
+
+            // Instances not visible in the previous frame are deferred to the late phase, not culled
+            isRejected = wasVisible && !isVisible;
+        }
+        else
+        {
+            isVisible = IsVisible(mesh, true);
+            isDrawn = isVisible && !wasVisible;
+            isRejected = !isVisible;
+
+            Visibility[instanceIndex] = isVisible ? 1 : 0;
+        }
+
+        uint slot = NOT_DRAWN;
+        if (isDrawn)
+            InterlockedAdd(MeshBuckets[meshIndex * 2], 1, slot);
+
+        InstanceSlots[instanceIndex] = slot;
+
+        if (isRejected)
+            InterlockedAdd(s_GroupRejectedNum, 1);
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    // One global atomic per group
+    if (groupThreadId == 0)
+    {
+        InterlockedAdd(DrawCount[RUNNING_REJECTED_NUM], s_GroupRejectedNum);
+
+        uint groupNum = (Constants.InstanceCount + CTA_SIZE - 1) / CTA_SIZE;
+        if (IsLastFinishedGroup(groupNum))
+        {
+            uint rejectedNum = 0;
+            InterlockedExchange(DrawCount[RUNNING_REJECTED_NUM], 0, rejectedNum);
+
+            DrawCount[REJECTED_NUM_EARLY + Constants.Phase] = rejectedNum;
+        }
+    }
+}
@@ -0,0 +1,32 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRICompatibility.hlsli"
+#include "SceneViewerBindlessStructs.h"
+
+NRI_ROOT_CONSTANTS(DepthPyramidConstants, Constants, 0, 0);
+NRI_RESOURCE(Texture2D<float>, Src, t, 0, 0);
+NRI_RESOURCE(RWTexture2D<float>, Dst, u, 0, 0);
+
+// One mip per dispatch. Mip 0 has power of 2 dimensions, so a texel can cover up to 3x3 depth pixels.
+// Reversed Z: each texel keeps the farthest (smallest) depth of its footprint
+[numthreads(8, 8, 1)]
+void main(uint2 pixelPos : SV_DispatchThreadId)
+{
+    uint2 srcSize = uint2(Constants.SrcWidth, Constants.SrcHeight);
+    uint2 dstSize = uint2(Constants.DstWidth, Constants.DstHeight);
+
+    if (any(pixelPos >= dstSize))
+        return;
+
+    uint2 begin = pixelPos * srcSize / dstSize;
+    uint2 end = min(((pixelPos + 1) * srcSize + dstSize - 1) / dstSize, srcSize);
+
+    float depth = 1.0;
+    for (uint y = begin.y; y < end.y; y++)
+    {
+        for (uint x = begin.x; x < end.x; x++)
+            depth = min(depth, Src[uint2(x, y)]);
+    }
+
+    Dst[pixelPos] = depth;
+}
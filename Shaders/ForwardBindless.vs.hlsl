@@ -7,6 +7,9 @@
 
 NRI_ENABLE_DRAW_PARAMETERS;
 
+// Maps "base instance + instance ID" of a draw to a scene instance
+NRI_RESOURCE(Buffer<uint>, DrawInstances, t, 3, 0);
+
 struct Input
 {
     float3 Position : POSITION;
@@ -37,7 +40,7 @@ Attributes main( in Input input, NRI_DECLARE_DRAW_PARAMETERS )
     output.Normal = float4( N, input.TexCoord.x );
     output.View = float4( V, input.TexCoord.y );
     output.Tangent = T;
-    output.DrawParameters = NRI_INSTANCE_ID_OFFSET;
+    output.DrawParameters = DrawInstances[NRI_INSTANCE_ID_OFFSET + NRI_INSTANCE_ID];
 #endif
 
     return output;
@@ -1,44 +1,97 @@
-#define NRI_ENABLE_DRAW_PARAMETERS_EMULATION
-
-#include "NRICompatibility.hlsli"
-#include "SceneViewerBindlessStructs.h"
+// © 2021 NVIDIA Corporation
 
-NRI_ROOT_CONSTANTS(CullingConstants, Constants, 0, 0);
-NRI_RESOURCE(StructuredBuffer<MaterialData>, Materials, t, 0, 0);
-NRI_RESOURCE(StructuredBuffer<MeshData>, Meshes, t, 1, 0);
-NRI_RESOURCE(StructuredBuffer<InstanceData>, Instances, t, 2, 0);
-NRI_RESOURCE(RWBuffer<uint>, DrawCount, u, 0, 0);
-NRI_RESOURCE(RWBuffer<uint>, Commands, u, 1, 0);
+#define NRI_ENABLE_DRAW_PARAMETERS_EMULATION
 
-groupshared uint s_DrawCount;
+#include "SceneDrawGeneration.hlsli"
 
-#define CTA_SIZE 256
+groupshared uint s_InstanceNumScan[CTA_SIZE];
+groupshared uint s_GroupDrawNum;
+groupshared uint s_GroupDrawBase;
+groupshared uint s_GroupInstanceBase;
 
+// A draw per mesh with taken instances. Buckets are placed by a prefix sum of instance counts within the group,
+// one global atomic per group reserves commands and instances
 [numthreads(CTA_SIZE, 1, 1)]
-void main(uint threadId : SV_DispatchThreadId)
+void main(uint threadId : SV_DispatchThreadId, uint groupThreadId : SV_GroupThreadId)
 {
-    if (threadId == 0)
-        s_DrawCount = 0;
+    if (groupThreadId == 0)
+        s_GroupDrawNum = 0;
+
+    uint meshIndex = threadId;
+    uint instanceNum = 0;
+
+    if (meshIndex < Constants.MeshCount)
+    {
+        instanceNum = MeshBuckets[meshIndex * 2];
+        MeshBuckets[meshIndex * 2] = 0; // for the next phase
+    }
+
+    // Inclusive scan
+    s_InstanceNumScan[groupThreadId] = instanceNum;
 
     GroupMemoryBarrierWithGroupSync();
 
-    for (uint instanceIndex = threadId; instanceIndex < Constants.DrawCount; instanceIndex += CTA_SIZE)
+    [unroll]
+    for (uint offset = 1; offset < CTA_SIZE; offset <<= 1)
     {
-        uint drawIndex = 0;
-        InterlockedAdd(s_DrawCount, 1, drawIndex);
-
-        uint meshIndex = Instances[instanceIndex].meshIndex;
-        NRI_FILL_DRAW_INDEXED_DESC(Commands, drawIndex,
-            Meshes[meshIndex].idxCount,
-            1, // TODO: batch draw instances with same mesh into one draw call
-            Meshes[meshIndex].idxOffset,
-            Meshes[meshIndex].vtxOffset,
-            instanceIndex
-        );
+        uint value = groupThreadId >= offset ? s_InstanceNumScan[groupThreadId - offset] : 0;
+
+        GroupMemoryBarrierWithGroupSync();
+
+        s_InstanceNumScan[groupThreadId] += value;
+
+        GroupMemoryBarrierWithGroupSync();
     }
 
+    uint localDrawIndex = 0;
+    if (instanceNum != 0)
+        InterlockedAdd(s_GroupDrawNum, 1, localDrawIndex);
+
     GroupMemoryBarrierWithGroupSync();
 
-    if (threadId == 0)
-        DrawCount[0] = s_DrawCount;
-}
\ No newline at end of file
+    if (groupThreadId == 0)
+    {
+        uint groupDrawBase = 0;
+        InterlockedAdd(DrawCount[RUNNING_DRAW_NUM], s_GroupDrawNum, groupDrawBase);
+
+        uint groupInstanceBase = 0;
+        InterlockedAdd(DrawCount[RUNNING_INSTANCE_NUM], s_InstanceNumScan[CTA_SIZE - 1], groupInstanceBase);
+
+        s_GroupDrawBase = groupDrawBase;
+        s_GroupInstanceBase = groupInstanceBase;
+    }
+
+    GroupMemoryBarrierWithGroupSync();
+
+    // Each phase has its own range of commands and instances (the first instance range maps instances to themselves)
+    if (instanceNum != 0)
+    {
+        MeshData mesh = Meshes[meshIndex];
+        uint firstInstance = s_GroupInstanceBase + s_InstanceNumScan[groupThreadId] - instanceNum;
+
+        MeshBuckets[meshIndex * 2 + 1] = firstInstance;
+
+        NRI_FILL_DRAW_INDEXED_DESC(Commands, Constants.Phase * Constants.MeshCount + s_GroupDrawBase + localDrawIndex,
+            mesh.idxCount,
+            instanceNum,
+            mesh.idxOffset,
+            mesh.vtxOffset,
+            (Constants.Phase + 1) * Constants.InstanceCount + firstInstance
+        );
+    }
+
+    if (groupThreadId == 0)
+    {
+        uint groupNum = (Constants.MeshCount + CTA_SIZE - 1) / CTA_SIZE;
+        if (IsLastFinishedGroup(groupNum))
+        {
+            uint drawNum = 0;
+            uint drawnInstanceNum = 0;
+            InterlockedExchange(DrawCount[RUNNING_DRAW_NUM], 0, drawNum);
+            InterlockedExchange(DrawCount[RUNNING_INSTANCE_NUM], 0, drawnInstanceNum);
+
+            DrawCount[DRAW_COUNT_EARLY + Constants.Phase] = drawNum;
+            DrawCount[INSTANCE_NUM_EARLY + Constants.Phase] = drawnInstanceNum;
+        }
+    }
+}
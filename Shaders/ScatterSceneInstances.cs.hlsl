@@ -0,0 +1,21 @@
+// © 2021 NVIDIA Corporation
+
+#include "SceneDrawGeneration.hlsli"
+
+// Taken instances are written into the buckets of their meshes, the vertex shader reads them via "NRI_INSTANCE_ID_OFFSET + NRI_INSTANCE_ID"
+[numthreads(CTA_SIZE, 1, 1)]
+void main(uint threadId : SV_DispatchThreadId)
+{
+    uint instanceIndex = threadId;
+    if (instanceIndex >= Constants.InstanceCount)
+        return;
+
+    uint slot = InstanceSlots[instanceIndex];
+    if (slot == NOT_DRAWN)
+        return;
+
+    uint meshIndex = Instances[instanceIndex].meshIndex;
+    uint firstInstance = MeshBuckets[meshIndex * 2 + 1];
+
+    DrawInstances[(Constants.Phase + 1) * Constants.InstanceCount + firstInstance + slot] = instanceIndex;
+}
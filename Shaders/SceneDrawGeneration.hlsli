@@ -0,0 +1,37 @@
+// © 2021 NVIDIA Corporation
+
+#include "NRICompatibility.hlsli"
+#include "SceneViewerBindlessStructs.h"
+
+// Draw generation runs in 3 passes per phase: instance culling, draw generation (a draw per mesh), instance scattering
+NRI_ROOT_CONSTANTS(CullingConstants, Constants, 0, 0);
+NRI_RESOURCE(StructuredBuffer<MaterialData>, Materials, t, 0, 0);
+NRI_RESOURCE(StructuredBuffer<MeshData>, Meshes, t, 1, 0);
+NRI_RESOURCE(StructuredBuffer<InstanceData>, Instances, t, 2, 0);
+NRI_RESOURCE(Texture2D<float>, DepthPyramid, t, 3, 0);
+NRI_RESOURCE(RWBuffer<uint>, DrawCount, u, 0, 0);
+NRI_RESOURCE(RWBuffer<uint>, Commands, u, 1, 0);
+NRI_RESOURCE(RWBuffer<uint>, Visibility, u, 2, 0);
+NRI_RESOURCE(RWBuffer<uint>, MeshBuckets, u, 3, 0); // per mesh: drawn instance count, first drawn instance
+NRI_RESOURCE(RWBuffer<uint>, InstanceSlots, u, 4, 0); // per instance: index in the bucket of its mesh
+NRI_RESOURCE(RWBuffer<uint>, DrawInstances, u, 5, 0); // drawn instances grouped by mesh, a range per phase
+
+#define CTA_SIZE 256
+#define NOT_DRAWN 0xFFFFFFFF
+
+// Counters are listed in "SceneViewerBindlessStructs.h". Running counters are reset by the last finished group,
+// published ones are valid until the next dispatch of the same phase. Called by one thread per group after all writes
+bool IsLastFinishedGroup(uint groupNum)
+{
+    DeviceMemoryBarrier();
+
+    uint finishedGroupNum = 0;
+    InterlockedAdd(DrawCount[FINISHED_GROUP_NUM], 1, finishedGroupNum);
+
+    if (finishedGroupNum != groupNum - 1)
+        return false;
+
+    InterlockedExchange(DrawCount[FINISHED_GROUP_NUM], 0, finishedGroupNum);
+
+    return true;
+}
@@ -1,11 +1,36 @@
 
+// Draw generation counters, the first "DRAW_STAT_NUM" ones are published by the last finished group of a dispatch
+#define DRAW_COUNT_EARLY 0
+#define DRAW_COUNT_LATE 1
+#define INSTANCE_NUM_EARLY 2 // drawn instances
+#define INSTANCE_NUM_LATE 3
+#define REJECTED_NUM_EARLY 4
+#define REJECTED_NUM_LATE 5
+#define DRAW_STAT_NUM 6
+#define RUNNING_DRAW_NUM 6 // reset by the last finished group
+#define RUNNING_INSTANCE_NUM 7
+#define RUNNING_REJECTED_NUM 8
+#define FINISHED_GROUP_NUM 9
+#define DRAW_COUNTER_NUM 10
+
 struct CullingConstants
 {
-	float4 Frustum;
-	uint32_t DrawCount;
+	float4x4 SceneToClip; // a single float4 can't describe a reversed-Z frustum, bounds are tested in clip space
+	uint32_t InstanceCount;
+	uint32_t MeshCount;
 	uint32_t EnableCulling;
-	uint32_t ScreenWidth;
-	uint32_t ScreenHeight;
+	uint32_t EnableOcclusionCulling;
+	uint32_t Phase; // 0 - early (visible in the previous frame), 1 - late (tested against the depth pyramid of the early phase)
+	uint32_t DepthPyramidWidth;
+	uint32_t DepthPyramidHeight;
+};
+
+struct DepthPyramidConstants
+{
+	uint32_t SrcWidth;
+	uint32_t SrcHeight;
+	uint32_t DstWidth;
+	uint32_t DstHeight;
 };
 
 struct MaterialData
@@ -24,6 +49,8 @@ struct MeshData
     uint32_t vtxCount;
     uint32_t idxOffset;
     uint32_t idxCount;
+    float4 boundsCenter; // scene space
+    float4 boundsExtents;
 };
 
 struct InstanceData
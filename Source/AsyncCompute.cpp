@@ -2,6 +2,8 @@
 
 #include "NRIFramework.h"
 
+#include "Common/GpuProfiler.h"
+
 #include <array>
 
 constexpr uint32_t VERTEX_NUM = 1000000 * 3;
@@ -53,6 +55,7 @@ private:
     nri::DescriptorSet* m_DescriptorSet = nullptr;
     nri::Descriptor* m_Descriptor = nullptr;
 
+    GpuProfiler m_GpuProfiler;
     std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
     std::vector<BackBuffer> m_SwapChainBuffers;
     std::vector<nri::Memory*> m_MemoryAllocations;
@@ -86,6 +89,7 @@ Sample::~Sample() {
     NRI.DestroyFence(*m_ComputeFence);
     NRI.DestroyFence(*m_FrameFence);
     NRI.DestroySwapChain(*m_SwapChain);
+    m_GpuProfiler.Destroy(NRI);
     NRI.DestroyStreamer(*m_Streamer);
 
     for (size_t i = 0; i < m_MemoryAllocations.size(); i++)
@@ -152,6 +156,9 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     NRI_ABORT_ON_FAILURE(NRI.CreateFence(*m_Device, 0, m_ComputeFence));
     NRI_ABORT_ON_FAILURE(NRI.CreateFence(*m_Device, 0, m_FrameFence));
 
+    // GPU profiler
+    NRI_ABORT_ON_FALSE(m_GpuProfiler.Initialize(NRI, *m_Device, BUFFERED_FRAME_MAX_NUM));
+
     // Swap chain
     nri::Format swapChainFormat;
     {
@@ -366,6 +373,9 @@ void Sample::PrepareFrame(uint32_t) {
     }
     ImGui::End();
 
+    m_GpuProfiler.Update(NRI, *m_FrameFence);
+    m_GpuProfiler.RenderUI();
+
     EndUI(NRI, *m_Streamer);
     NRI.CopyStreamerUpdateRequests(*m_Streamer);
 
@@ -409,6 +419,8 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     nri::BarrierGroupDesc barrierGroupDesc = {};
     barrierGroupDesc.textures = textureBarrierDescs;
 
+    m_GpuProfiler.BeginFrame(frameIndex);
+
     // Fill command buffer #0 (graphics or compute)
     nri::CommandBuffer& commandBuffer0 = m_IsAsyncMode ? *frame.commandBufferCompute : *frame.commandBufferGraphics[0];
     NRI.BeginCommandBuffer(commandBuffer0, m_DescriptorPool);
@@ -429,7 +441,10 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     nri::CommandBuffer& commandBuffer1 = *frame.commandBufferGraphics[1];
     NRI.BeginCommandBuffer(commandBuffer1, nullptr);
     {
-        helper::Annotation annotation(NRI, commandBuffer1, "Graphics");
+        // Only the GRAPHICS queue is profiled: the Compute task may run on the COMPUTE queue and overlap with it
+        m_GpuProfiler.CmdResetQueries(NRI, commandBuffer1);
+
+        GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer1, "Graphics");
 
         barrierGroupDesc.textureNum = 1;
         NRI.CmdBarrier(commandBuffer1, barrierGroupDesc);
@@ -467,7 +482,7 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     nri::CommandBuffer& commandBuffer2 = *frame.commandBufferGraphics[2];
     NRI.BeginCommandBuffer(commandBuffer2, nullptr);
     {
-        helper::Annotation annotation(NRI, commandBuffer2, "Composition");
+        GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer2, "Composition");
 
         // Resource transitions
         textureBarrierDescs[0].before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT, nri::StageBits::COLOR_ATTACHMENT};
@@ -500,6 +515,7 @@ void Sample::RenderFrame(uint32_t frameIndex) {
         barrierGroupDesc.textureNum = 2;
         NRI.CmdBarrier(commandBuffer2, barrierGroupDesc);
     }
+    m_GpuProfiler.CmdEndFrame(NRI, commandBuffer2);
     NRI.EndCommandBuffer(commandBuffer2);
 
     nri::CommandBuffer* commandBufferArray[3] = {&commandBuffer0, &commandBuffer1, &commandBuffer2};
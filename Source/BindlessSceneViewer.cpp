@@ -3,8 +3,15 @@
 #include "NRICompatibility.hlsli"
 #include "NRIFramework.h"
 
+#include "Common/ConstantBufferRing.h"
+#include "Common/GpuProfiler.h"
+#include "Common/JobScheduler.h"
+#include "Common/QueryReadbackRing.h"
+#include "Common/SceneCache.h"
+
 #include "../Shaders/SceneViewerBindlessStructs.h"
 
+#include <algorithm>
 #include <array>
 
 constexpr uint32_t GLOBAL_DESCRIPTOR_SET = 0;
@@ -12,14 +19,28 @@ constexpr uint32_t MATERIAL_DESCRIPTOR_SET = 1;
 constexpr float CLEAR_DEPTH = 0.0f;
 constexpr uint32_t TEXTURES_PER_MATERIAL = 4;
 constexpr uint32_t BUFFER_COUNT = 3;
+constexpr uint32_t DRAW_GENERATION_GROUP_SIZE = 256;
+constexpr uint32_t DEPTH_PYRAMID_GROUP_SIZE = 8;
 
-enum SceneBuffers {
-    // HOST_UPLOAD
-    CONSTANT_BUFFER,
+static_assert(CLEAR_DEPTH == 0.0f, "Occlusion culling expects reversed Z");
+
+enum DrawMode : int32_t {
+    CPU_DRAWS,
+    CPU_INDIRECT,
+    GPU_DRAW_GENERATION,
+
+    DRAW_MODE_NUM
+};
+
+constexpr const char* DRAW_MODE_NAMES[] = {
+    "CPU draws",
+    "CPU indirect (multithreaded)",
+    "GPU draw generation",
+};
 
-    // READBACK
-    READBACK_BUFFER,
+constexpr const char* SCENE_SCOPE_NAME = "Scene"; // GPU time of a draw mode
 
+enum SceneBuffers {
     // DEVICE
     INDEX_BUFFER,
     VERTEX_BUFFER,
@@ -28,6 +49,10 @@ enum SceneBuffers {
     INSTANCE_BUFFER,
     INDIRECT_BUFFER,
     INDIRECT_COUNT_BUFFER,
+    VISIBILITY_BUFFER,
+    MESH_BUCKET_BUFFER,
+    INSTANCE_SLOT_BUFFER,
+    DRAW_INSTANCE_BUFFER,
 
     MAX_NUM
 };
@@ -41,7 +66,6 @@ struct NRIInterface
 struct Frame {
     nri::CommandAllocator* commandAllocator;
     nri::CommandBuffer* commandBuffer;
-    uint32_t globalConstantBufferViewOffsets;
 };
 
 class Sample : public SampleBase {
@@ -59,6 +83,11 @@ public:
     void PrepareFrame(uint32_t frameIndex) override;
     void RenderFrame(uint32_t frameIndex) override;
 
+    void GenerateDrawCalls(nri::CommandBuffer& commandBuffer, uint32_t phase);
+    void GenerateDrawCallsOnCpu(uint32_t bufferedFrameIndex);
+    void BuildDepthPyramid(nri::CommandBuffer& commandBuffer);
+    void RenderScene(nri::CommandBuffer& commandBuffer, const nri::AttachmentsDesc& attachmentsDesc, uint32_t globalConstantBufferOffset, uint32_t bufferedFrameIndex, uint32_t phase);
+
 private:
     NRIInterface NRI = {};
     nri::Device* m_Device = nullptr;
@@ -69,25 +98,50 @@ private:
     nri::DescriptorPool* m_DescriptorPool = nullptr;
     nri::PipelineLayout* m_PipelineLayout = nullptr;
     nri::PipelineLayout* m_ComputePipelineLayout = nullptr;
+    nri::PipelineLayout* m_DepthPyramidPipelineLayout = nullptr;
+    nri::Texture* m_DepthTexture = nullptr;
+    nri::Texture* m_DepthPyramid = nullptr;
     nri::Descriptor* m_DepthAttachment = nullptr;
     nri::Descriptor* m_IndirectBufferCountShaderStorage = nullptr;
     nri::Descriptor* m_IndirectBufferShaderStorage = nullptr;
-    nri::QueryPool* m_QueryPool = nullptr;
     nri::Pipeline* m_Pipeline = nullptr;
     nri::Pipeline* m_ComputePipeline = nullptr;
+    nri::Pipeline* m_InstanceCullingPipeline = nullptr;
+    nri::Pipeline* m_InstanceScatterPipeline = nullptr;
+    nri::Pipeline* m_DepthPyramidPipeline = nullptr;
+    nri::Buffer* m_DrawStatsReadback = nullptr; // a slot of "DRAW_STAT_NUM" counters per frame, "BUFFERED_FRAME_MAX_NUM + 1" slots
+    nri::Buffer* m_CpuIndirectRing = nullptr; // a region of draw arguments per buffered frame, persistently mapped
+    uint8_t* m_CpuIndirectArguments = nullptr;
 
     std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
     std::vector<BackBuffer> m_SwapChainBuffers;
     std::vector<nri::DescriptorSet*> m_DescriptorSets;
+    std::vector<nri::DescriptorSet*> m_DepthPyramidDescriptorSets; // a set per mip
     std::vector<nri::Texture*> m_Textures;
     std::vector<nri::Buffer*> m_Buffers;
     std::vector<nri::Memory*> m_MemoryAllocations;
     std::vector<nri::Descriptor*> m_Descriptors;
-
-    bool m_UseGPUDrawGeneration = true;
+    QueryReadbackRing m_PipelineStatistics;
+    GpuProfiler m_GpuProfiler;
+    ConstantBufferRing m_Constants;
+    JobScheduler m_JobScheduler;
+
+    std::array<uint32_t, BUFFERED_FRAME_MAX_NUM + 1> m_DrawStatsFrames = {};
+    std::array<uint32_t, DRAW_STAT_NUM> m_DrawStats = {};
+    std::array<double, DRAW_MODE_NUM> m_DrawModeCpuTimes = {}; // ms, smoothed
+    std::array<double, DRAW_MODE_NUM> m_DrawModeGpuTimes = {};
+    uint32_t m_DrawModeFrame = 0; // the first frame rendered with the current mode
+    uint32_t m_DrawStatsFrame = uint32_t(-1);
+    uint32_t m_DepthPyramidWidth = 0;
+    uint32_t m_DepthPyramidHeight = 0;
+    uint32_t m_DepthPyramidMipNum = 0;
+    int32_t m_DrawMode = GPU_DRAW_GENERATION;
+    bool m_UseGPUCulling = true;
+    bool m_UseGPUOcclusionCulling = true;
     nri::Format m_DepthFormat = nri::Format::UNKNOWN;
 
     utils::Scene m_Scene;
+    SceneCache m_SceneCache;
 };
 
 Sample::~Sample() {
@@ -113,15 +167,26 @@ Sample::~Sample() {
     for (size_t i = 0; i < m_Buffers.size(); i++)
         NRI.DestroyBuffer(*m_Buffers[i]);
 
+    NRI.DestroyBuffer(*m_DrawStatsReadback);
+
+    NRI.UnmapBuffer(*m_CpuIndirectRing);
+    NRI.DestroyBuffer(*m_CpuIndirectRing);
+
     for (size_t i = 0; i < m_MemoryAllocations.size(); i++)
         NRI.FreeMemory(*m_MemoryAllocations[i]);
 
     NRI.DestroyPipeline(*m_Pipeline);
     NRI.DestroyPipeline(*m_ComputePipeline);
+    NRI.DestroyPipeline(*m_InstanceCullingPipeline);
+    NRI.DestroyPipeline(*m_InstanceScatterPipeline);
+    NRI.DestroyPipeline(*m_DepthPyramidPipeline);
 
-    NRI.DestroyQueryPool(*m_QueryPool);
+    m_PipelineStatistics.Destroy(NRI);
+    m_GpuProfiler.Destroy(NRI);
+    m_Constants.Destroy(NRI);
     NRI.DestroyPipelineLayout(*m_PipelineLayout);
     NRI.DestroyPipelineLayout(*m_ComputePipelineLayout);
+    NRI.DestroyPipelineLayout(*m_DepthPyramidPipelineLayout);
     NRI.DestroyDescriptorPool(*m_DescriptorPool);
     NRI.DestroyFence(*m_FrameFence);
     NRI.DestroySwapChain(*m_SwapChain);
@@ -204,16 +269,18 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     {
         {
             nri::DescriptorRangeDesc globalDescriptorRange[3] = {};
-            globalDescriptorRange[0] = {0, 1, nri::DescriptorType::CONSTANT_BUFFER, nri::StageBits::ALL};
-            globalDescriptorRange[1] = {0, 1, nri::DescriptorType::SAMPLER, nri::StageBits::FRAGMENT_SHADER};
-            globalDescriptorRange[2] = {0, BUFFER_COUNT, nri::DescriptorType::STRUCTURED_BUFFER, nri::StageBits::ALL};
+            globalDescriptorRange[0] = {0, 1, nri::DescriptorType::SAMPLER, nri::StageBits::FRAGMENT_SHADER};
+            globalDescriptorRange[1] = {0, BUFFER_COUNT, nri::DescriptorType::STRUCTURED_BUFFER, nri::StageBits::ALL};
+            globalDescriptorRange[2] = {BUFFER_COUNT, 1, nri::DescriptorType::BUFFER, nri::StageBits::VERTEX_SHADER};
+
+            nri::DynamicConstantBufferDesc dynamicConstantBufferDesc = {0, nri::StageBits::ALL};
 
             // Bindless descriptors
             nri::DescriptorRangeDesc textureDescriptorRange[1] = {};
             textureDescriptorRange[0] = {0, 512, nri::DescriptorType::TEXTURE, nri::StageBits::FRAGMENT_SHADER, nri::DescriptorRangeBits::VARIABLE_SIZED_ARRAY | nri::DescriptorRangeBits::PARTIALLY_BOUND};
 
             nri::DescriptorSetDesc descriptorSetDescs[] = {
-                {0, globalDescriptorRange, helper::GetCountOf(globalDescriptorRange)},
+                {0, globalDescriptorRange, helper::GetCountOf(globalDescriptorRange), &dynamicConstantBufferDesc, 1},
                 {1, textureDescriptorRange, helper::GetCountOf(textureDescriptorRange), nullptr, 0},
             };
 
@@ -227,9 +294,10 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         }
 
         {
-            nri::DescriptorRangeDesc descriptorRange[2] = {};
-            descriptorRange[0] = {0, 2, nri::DescriptorType::STORAGE_BUFFER, nri::StageBits::COMPUTE_SHADER};
+            nri::DescriptorRangeDesc descriptorRange[3] = {};
+            descriptorRange[0] = {0, 6, nri::DescriptorType::STORAGE_BUFFER, nri::StageBits::COMPUTE_SHADER};
             descriptorRange[1] = {0, BUFFER_COUNT, nri::DescriptorType::STRUCTURED_BUFFER, nri::StageBits::COMPUTE_SHADER};
+            descriptorRange[2] = {BUFFER_COUNT, 1, nri::DescriptorType::TEXTURE, nri::StageBits::COMPUTE_SHADER};
 
             nri::DescriptorSetDesc descriptorSetDescs[] = {
                 {0, descriptorRange, helper::GetCountOf(descriptorRange)},
@@ -250,6 +318,30 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
             NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, m_ComputePipelineLayout));
         }
 
+        {
+            nri::DescriptorRangeDesc descriptorRange[2] = {};
+            descriptorRange[0] = {0, 1, nri::DescriptorType::TEXTURE, nri::StageBits::COMPUTE_SHADER};
+            descriptorRange[1] = {0, 1, nri::DescriptorType::STORAGE_TEXTURE, nri::StageBits::COMPUTE_SHADER};
+
+            nri::DescriptorSetDesc descriptorSetDescs[] = {
+                {0, descriptorRange, helper::GetCountOf(descriptorRange)},
+            };
+
+            nri::RootConstantDesc rootConstantDesc = {};
+            rootConstantDesc.registerIndex = 0;
+            rootConstantDesc.shaderStages = nri::StageBits::COMPUTE_SHADER;
+            rootConstantDesc.size = sizeof(DepthPyramidConstants);
+
+            nri::PipelineLayoutDesc pipelineLayoutDesc = {};
+            pipelineLayoutDesc.rootConstantNum = 1;
+            pipelineLayoutDesc.rootConstants = &rootConstantDesc;
+            pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(descriptorSetDescs);
+            pipelineLayoutDesc.descriptorSets = descriptorSetDescs;
+            pipelineLayoutDesc.shaderStages = nri::StageBits::COMPUTE_SHADER;
+
+            NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, m_DepthPyramidPipelineLayout));
+        }
+
         nri::VertexStreamDesc vertexStreamDesc = {};
         vertexStreamDesc.bindingSlot = 0;
         vertexStreamDesc.stride = sizeof(utils::Vertex);
@@ -328,11 +420,23 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         computePipelineDesc.pipelineLayout = m_ComputePipelineLayout;
         computePipelineDesc.shader = utils::LoadShader(deviceDesc.graphicsAPI, "GenerateSceneDrawCalls.cs", shaderCodeStorage);
         NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, computePipelineDesc, m_ComputePipeline));
+
+        computePipelineDesc.shader = utils::LoadShader(deviceDesc.graphicsAPI, "CullSceneInstances.cs", shaderCodeStorage);
+        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, computePipelineDesc, m_InstanceCullingPipeline));
+
+        computePipelineDesc.shader = utils::LoadShader(deviceDesc.graphicsAPI, "ScatterSceneInstances.cs", shaderCodeStorage);
+        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, computePipelineDesc, m_InstanceScatterPipeline));
+
+        computePipelineDesc.pipelineLayout = m_DepthPyramidPipelineLayout;
+        computePipelineDesc.shader = utils::LoadShader(deviceDesc.graphicsAPI, "DepthPyramid.cs", shaderCodeStorage);
+        NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, computePipelineDesc, m_DepthPyramidPipeline));
     }
 
-    // Scene
+    // Scene (the main thread helps the workers)
+    m_JobScheduler.Initialize(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+
     std::string sceneFile = utils::GetFullPath(m_SceneFile, utils::DataFolder::SCENES);
-    NRI_ABORT_ON_FALSE(utils::LoadScene(sceneFile, m_Scene, false));
+    NRI_ABORT_ON_FALSE(m_SceneCache.Load(sceneFile, m_Scene, m_JobScheduler));
 
     // Camera
     m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, false);
@@ -340,62 +444,60 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     const uint32_t textureNum = (uint32_t)m_Scene.textures.size();
     const uint32_t materialNum = (uint32_t)m_Scene.materials.size();
 
-    // Textures
-    for (const utils::Texture* textureData : m_Scene.textures) {
-        nri::TextureDesc textureDesc = {};
-        textureDesc.type = nri::TextureType::TEXTURE_2D;
-        textureDesc.usage = nri::TextureUsageBits::SHADER_RESOURCE;
-        textureDesc.format = textureData->GetFormat();
-        textureDesc.width =  textureData->GetWidth();
-        textureDesc.height = textureData->GetHeight();
-        textureDesc.mipNum = textureData->GetMipNum();
-        textureDesc.layerNum = textureData->GetArraySize();
-
-        nri::Texture* texture;
-        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, texture));
-        m_Textures.push_back(texture);
-    }
+    // Textures (decoding goes on in the background, finished textures get uploaded in batches)
+    NRI_ABORT_ON_FALSE(m_SceneCache.UploadTextures(NRI, NRI, *m_Device, *m_GraphicsQueue, m_Textures, m_MemoryAllocations));
 
-    // Depth attachment
-    nri::Texture* depthTexture;
+    // Depth attachment (also the source of the depth pyramid)
     {
         nri::TextureDesc textureDesc = {};
         textureDesc.type = nri::TextureType::TEXTURE_2D;
-        textureDesc.usage = nri::TextureUsageBits::DEPTH_STENCIL_ATTACHMENT;
+        textureDesc.usage = nri::TextureUsageBits::DEPTH_STENCIL_ATTACHMENT | nri::TextureUsageBits::SHADER_RESOURCE;
         textureDesc.format = m_DepthFormat;
         textureDesc.width =  (uint16_t)GetWindowResolution().x;
         textureDesc.height = (uint16_t)GetWindowResolution().y;
         textureDesc.mipNum = 1;
 
-        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, depthTexture));
-        m_Textures.push_back(depthTexture);
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, m_DepthTexture));
+        m_Textures.push_back(m_DepthTexture);
     }
 
-    const uint32_t constantBufferSize = helper::Align((uint32_t)sizeof(GlobalConstants), deviceDesc.constantBufferOffsetAlignment);
+    // Depth pyramid (power of 2 dimensions, down to 1x1)
+    {
+        m_DepthPyramidWidth = 1;
+        while (m_DepthPyramidWidth * 2 <= GetWindowResolution().x)
+            m_DepthPyramidWidth *= 2;
 
-    { // Buffers
-        // CONSTANT_BUFFER
-        nri::BufferDesc bufferDesc = {};
-        bufferDesc.size = constantBufferSize * BUFFERED_FRAME_MAX_NUM;
-        bufferDesc.usage = nri::BufferUsageBits::CONSTANT_BUFFER;
-        nri::Buffer* buffer;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
-        m_Buffers.push_back(buffer);
+        m_DepthPyramidHeight = 1;
+        while (m_DepthPyramidHeight * 2 <= GetWindowResolution().y)
+            m_DepthPyramidHeight *= 2;
 
-        // READBACK_BUFFER
-        bufferDesc.size = sizeof(nri::PipelineStatisticsDesc) * BUFFERED_FRAME_MAX_NUM;
-        bufferDesc.usage = nri::BufferUsageBits::NONE;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
-        m_Buffers.push_back(buffer);
+        m_DepthPyramidMipNum = 1;
+        while ((std::max(m_DepthPyramidWidth, m_DepthPyramidHeight) >> m_DepthPyramidMipNum) != 0)
+            m_DepthPyramidMipNum++;
 
+        nri::TextureDesc textureDesc = {};
+        textureDesc.type = nri::TextureType::TEXTURE_2D;
+        textureDesc.usage = nri::TextureUsageBits::SHADER_RESOURCE | nri::TextureUsageBits::SHADER_RESOURCE_STORAGE;
+        textureDesc.format = nri::Format::R32_SFLOAT;
+        textureDesc.width = (uint16_t)m_DepthPyramidWidth;
+        textureDesc.height = (uint16_t)m_DepthPyramidHeight;
+        textureDesc.mipNum = (nri::Mip_t)m_DepthPyramidMipNum;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, m_DepthPyramid));
+        m_Textures.push_back(m_DepthPyramid);
+    }
+
+    { // Buffers
         // INDEX_BUFFER
-        bufferDesc.size = helper::GetByteSizeOf(m_Scene.indices);
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = m_SceneCache.GetIndexDataSize();
         bufferDesc.usage = nri::BufferUsageBits::INDEX_BUFFER;
+        nri::Buffer* buffer;
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
 
         // VERTEX_BUFFER
-        bufferDesc.size = helper::GetByteSizeOf(m_Scene.vertices);
+        bufferDesc.size = m_SceneCache.GetVertexDataSize();
         bufferDesc.usage = nri::BufferUsageBits::VERTEX_BUFFER;
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
@@ -421,54 +523,104 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
 
-        // INDIRECT_BUFFER
-        bufferDesc.size = m_Scene.instances.size() * GetDrawIndexedCommandSize();
+        // INDIRECT_BUFFER (a draw per mesh, early and late phases)
+        bufferDesc.size = 2 * m_Scene.meshes.size() * GetDrawIndexedCommandSize();
         bufferDesc.structureStride = 0;
         bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::ARGUMENT_BUFFER;
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
 
         // INDIRECT_COUNT_BUFFER
-        bufferDesc.size = sizeof(uint32_t);
+        bufferDesc.size = DRAW_COUNTER_NUM * sizeof(uint32_t);
         bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::ARGUMENT_BUFFER;
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
+
+        // VISIBILITY_BUFFER
+        bufferDesc.size = m_Scene.instances.size() * sizeof(uint32_t);
+        bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
+        m_Buffers.push_back(buffer);
+
+        // MESH_BUCKET_BUFFER
+        bufferDesc.size = m_Scene.meshes.size() * 2 * sizeof(uint32_t);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
+        m_Buffers.push_back(buffer);
+
+        // INSTANCE_SLOT_BUFFER
+        bufferDesc.size = m_Scene.instances.size() * sizeof(uint32_t);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
+        m_Buffers.push_back(buffer);
+
+        // DRAW_INSTANCE_BUFFER (identity, early and late phases)
+        bufferDesc.size = 3 * m_Scene.instances.size() * sizeof(uint32_t);
+        bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
+        m_Buffers.push_back(buffer);
     }
 
     { // Memory
         nri::ResourceGroupDesc resourceGroupDesc = {};
-        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
-        resourceGroupDesc.bufferNum = 1;
-        resourceGroupDesc.buffers = &m_Buffers[CONSTANT_BUFFER];
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+        resourceGroupDesc.bufferNum = (uint32_t)SceneBuffers::MAX_NUM;
+        resourceGroupDesc.buffers = &m_Buffers[INDEX_BUFFER];
+        resourceGroupDesc.textureNum = (uint32_t)m_Textures.size() - textureNum;
+        resourceGroupDesc.textures = m_Textures.data() + textureNum;
 
         size_t baseAllocation = m_MemoryAllocations.size();
-        m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
+        uint32_t allocationNum = NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc);
+        m_MemoryAllocations.resize(baseAllocation + allocationNum, nullptr);
         NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+    }
+
+    { // Draw stats readback
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = m_DrawStatsFrames.size() * DRAW_STAT_NUM * sizeof(uint32_t);
+        bufferDesc.usage = nri::BufferUsageBits::NONE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_DrawStatsReadback));
 
+        nri::ResourceGroupDesc resourceGroupDesc = {};
         resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
         resourceGroupDesc.bufferNum = 1;
-        resourceGroupDesc.buffers = &m_Buffers[READBACK_BUFFER];
+        resourceGroupDesc.buffers = &m_DrawStatsReadback;
 
-        baseAllocation = m_MemoryAllocations.size();
-        m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
-        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+        m_MemoryAllocations.push_back(nullptr);
+        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, &m_MemoryAllocations.back()));
 
-        resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
-        resourceGroupDesc.bufferNum = (uint32_t)SceneBuffers::MAX_NUM - 2;
-        resourceGroupDesc.buffers = &m_Buffers[INDEX_BUFFER];
-        resourceGroupDesc.textureNum = (uint32_t)m_Textures.size();
-        resourceGroupDesc.textures = m_Textures.data();
+        m_DrawStatsFrames.fill(uint32_t(-1));
+    }
 
-        baseAllocation = m_MemoryAllocations.size();
-        uint32_t allocationNum = NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc);
-        m_MemoryAllocations.resize(baseAllocation + allocationNum, nullptr);
-        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+    { // CPU indirect arguments
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = BUFFERED_FRAME_MAX_NUM * m_Scene.instances.size() * GetDrawIndexedCommandSize();
+        bufferDesc.usage = nri::BufferUsageBits::ARGUMENT_BUFFER;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_CpuIndirectRing));
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_CpuIndirectRing;
+
+        m_MemoryAllocations.push_back(nullptr);
+        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, &m_MemoryAllocations.back()));
+
+        // D3D11 is not supported, so the buffer can stay mapped
+        m_CpuIndirectArguments = (uint8_t*)NRI.MapBuffer(*m_CpuIndirectRing, 0, nri::WHOLE_SIZE);
+        NRI_ABORT_ON_FALSE(m_CpuIndirectArguments);
     }
 
+    // Constants (persistently mapped)
+    NRI_ABORT_ON_FALSE(m_Constants.Initialize(NRI, *m_Device, sizeof(GlobalConstants), BUFFERED_FRAME_MAX_NUM, sizeof(GlobalConstants)));
+
     // Create descriptors
     nri::Descriptor* anisotropicSampler = nullptr;
-    nri::Descriptor* constantBufferViews[BUFFERED_FRAME_MAX_NUM] = {};
     nri::Descriptor* resourceViews[BUFFER_COUNT] = {};
+    nri::Descriptor* storageDescriptors[6] = {}; // see "SceneDrawGeneration.hlsli"
+    nri::Descriptor* drawInstanceShaderResource = nullptr;
+    nri::Descriptor* depthShaderResource = nullptr;
+    nri::Descriptor* depthPyramidShaderResource = nullptr;
+    std::vector<nri::Descriptor*> depthPyramidMipShaderResources;
+    std::vector<nri::Descriptor*> depthPyramidMipStorages;
     {
         // Material textures
         m_Descriptors.resize(textureNum);
@@ -512,38 +664,78 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         // Indirect buffer
         bufferViewDesc.viewType = nri::BufferViewType::SHADER_RESOURCE_STORAGE;
         bufferViewDesc.buffer = m_Buffers[INDIRECT_BUFFER];
-        bufferViewDesc.size = m_Scene.instances.size() * GetDrawIndexedCommandSize();
+        bufferViewDesc.size = 2 * m_Scene.meshes.size() * GetDrawIndexedCommandSize();
         bufferViewDesc.format = nri::Format::R32_UINT;
         NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, m_IndirectBufferShaderStorage));
         m_Descriptors.push_back(m_IndirectBufferShaderStorage);
+        storageDescriptors[1] = m_IndirectBufferShaderStorage;
 
         // Indirect draw count buffer
         bufferViewDesc.viewType = nri::BufferViewType::SHADER_RESOURCE_STORAGE;
         bufferViewDesc.buffer = m_Buffers[INDIRECT_COUNT_BUFFER];
-        bufferViewDesc.size = sizeof(uint32_t);
+        bufferViewDesc.size = DRAW_COUNTER_NUM * sizeof(uint32_t);
         bufferViewDesc.format = nri::Format::R32_UINT;
         NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, m_IndirectBufferCountShaderStorage));
         m_Descriptors.push_back(m_IndirectBufferCountShaderStorage);
+        storageDescriptors[0] = m_IndirectBufferCountShaderStorage;
+
+        // Visibility buffer
+        bufferViewDesc.buffer = m_Buffers[VISIBILITY_BUFFER];
+        bufferViewDesc.size = m_Scene.instances.size() * sizeof(uint32_t);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, storageDescriptors[2]));
+        m_Descriptors.push_back(storageDescriptors[2]);
+
+        // Mesh bucket buffer
+        bufferViewDesc.buffer = m_Buffers[MESH_BUCKET_BUFFER];
+        bufferViewDesc.size = m_Scene.meshes.size() * 2 * sizeof(uint32_t);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, storageDescriptors[3]));
+        m_Descriptors.push_back(storageDescriptors[3]);
+
+        // Instance slot buffer
+        bufferViewDesc.buffer = m_Buffers[INSTANCE_SLOT_BUFFER];
+        bufferViewDesc.size = m_Scene.instances.size() * sizeof(uint32_t);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, storageDescriptors[4]));
+        m_Descriptors.push_back(storageDescriptors[4]);
+
+        // Draw instance buffer (written by draw generation, read by the vertex shader)
+        bufferViewDesc.buffer = m_Buffers[DRAW_INSTANCE_BUFFER];
+        bufferViewDesc.size = 3 * m_Scene.instances.size() * sizeof(uint32_t);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, storageDescriptors[5]));
+        m_Descriptors.push_back(storageDescriptors[5]);
 
-        bufferViewDesc.format = nri::Format::UNKNOWN;
-
-        // Constant buffer
-        for (uint32_t i = 0; i < BUFFERED_FRAME_MAX_NUM; i++) {
-            m_Frames[i].globalConstantBufferViewOffsets = i * constantBufferSize;
-            bufferViewDesc.buffer = m_Buffers[CONSTANT_BUFFER];
-            bufferViewDesc.viewType = nri::BufferViewType::CONSTANT;
-            bufferViewDesc.offset = i * constantBufferSize;
-            bufferViewDesc.size = constantBufferSize;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, constantBufferViews[i]));
-            m_Descriptors.push_back(constantBufferViews[i]);
-        }
+        bufferViewDesc.viewType = nri::BufferViewType::SHADER_RESOURCE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, drawInstanceShaderResource));
+        m_Descriptors.push_back(drawInstanceShaderResource);
 
         // Depth buffer
-        nri::Texture2DViewDesc texture2DViewDesc = {depthTexture, nri::Texture2DViewType::DEPTH_STENCIL_ATTACHMENT, m_DepthFormat};
+        nri::Texture2DViewDesc texture2DViewDesc = {m_DepthTexture, nri::Texture2DViewType::DEPTH_STENCIL_ATTACHMENT, m_DepthFormat};
 
         NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texture2DViewDesc, m_DepthAttachment));
         m_Descriptors.push_back(m_DepthAttachment);
 
+        texture2DViewDesc = {m_DepthTexture, nri::Texture2DViewType::SHADER_RESOURCE_2D, m_DepthFormat};
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texture2DViewDesc, depthShaderResource));
+        m_Descriptors.push_back(depthShaderResource);
+
+        // Depth pyramid: all mips for culling, a source and a destination per mip for building
+        texture2DViewDesc = {m_DepthPyramid, nri::Texture2DViewType::SHADER_RESOURCE_2D, nri::Format::R32_SFLOAT};
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texture2DViewDesc, depthPyramidShaderResource));
+        m_Descriptors.push_back(depthPyramidShaderResource);
+
+        depthPyramidMipShaderResources.resize(m_DepthPyramidMipNum);
+        depthPyramidMipStorages.resize(m_DepthPyramidMipNum);
+        for (uint32_t i = 0; i < m_DepthPyramidMipNum; i++) {
+            texture2DViewDesc = {m_DepthPyramid, nri::Texture2DViewType::SHADER_RESOURCE_2D, nri::Format::R32_SFLOAT};
+            texture2DViewDesc.mipOffset = (nri::Mip_t)i;
+            texture2DViewDesc.mipNum = 1;
+            NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texture2DViewDesc, depthPyramidMipShaderResources[i]));
+            m_Descriptors.push_back(depthPyramidMipShaderResources[i]);
+
+            texture2DViewDesc.viewType = nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D;
+            NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texture2DViewDesc, depthPyramidMipStorages[i]));
+            m_Descriptors.push_back(depthPyramidMipStorages[i]);
+        }
+
         // Swap chain
         for (uint32_t i = 0; i < swapChainTextureNum; i++) {
             nri::Texture2DViewDesc textureViewDesc = {swapChainTextures[i], nri::Texture2DViewType::COLOR_ATTACHMENT, swapChainFormat};
@@ -560,60 +752,73 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
     { // Descriptor pool
         nri::DescriptorPoolDesc descriptorPoolDesc = {};
-        descriptorPoolDesc.descriptorSetMaxNum = materialNum + BUFFERED_FRAME_MAX_NUM + 2;
-        descriptorPoolDesc.textureMaxNum = materialNum * TEXTURES_PER_MATERIAL;
-        descriptorPoolDesc.samplerMaxNum = BUFFERED_FRAME_MAX_NUM;
+        descriptorPoolDesc.descriptorSetMaxNum = materialNum + 3 + m_DepthPyramidMipNum;
+        descriptorPoolDesc.textureMaxNum = materialNum * TEXTURES_PER_MATERIAL + 1 + m_DepthPyramidMipNum;
+        descriptorPoolDesc.storageTextureMaxNum = m_DepthPyramidMipNum;
+        descriptorPoolDesc.samplerMaxNum = 1;
         descriptorPoolDesc.storageStructuredBufferMaxNum = 1 * 2 * TEST;
         descriptorPoolDesc.storageBufferMaxNum = 1 * 2 * TEST;
         descriptorPoolDesc.bufferMaxNum = 3 * 2 * TEST;
         descriptorPoolDesc.structuredBufferMaxNum = 4 * 2 * TEST;
-        descriptorPoolDesc.constantBufferMaxNum = BUFFERED_FRAME_MAX_NUM;
+        descriptorPoolDesc.dynamicConstantBufferMaxNum = 1;
 
         NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, descriptorPoolDesc, m_DescriptorPool));
     }
 
     { // Descriptor sets
-        m_DescriptorSets.resize(BUFFERED_FRAME_MAX_NUM + 2);
-
-        // Global
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, GLOBAL_DESCRIPTOR_SET,
-            &m_DescriptorSets[0], BUFFERED_FRAME_MAX_NUM, 0));
-
-        for (uint32_t i = 0; i < BUFFERED_FRAME_MAX_NUM; i++) {
-            nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDescs[3] = {};
-            descriptorRangeUpdateDescs[0].descriptorNum = 1;
-            descriptorRangeUpdateDescs[0].descriptors = &constantBufferViews[i];
-            descriptorRangeUpdateDescs[1].descriptorNum = 1;
-            descriptorRangeUpdateDescs[1].descriptors = &anisotropicSampler;
-            descriptorRangeUpdateDescs[2].descriptorNum = BUFFER_COUNT;
-            descriptorRangeUpdateDescs[2].descriptors = resourceViews;
-
-            NRI.UpdateDescriptorRanges(*m_DescriptorSets[i], 0, helper::GetCountOf(descriptorRangeUpdateDescs), descriptorRangeUpdateDescs);
-        }
+        m_DescriptorSets.resize(3);
+
+        // Global (a dynamic offset selects the constants of the frame)
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, GLOBAL_DESCRIPTOR_SET, &m_DescriptorSets[0], 1, 0));
+
+        nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDescs[3] = {};
+        descriptorRangeUpdateDescs[0].descriptorNum = 1;
+        descriptorRangeUpdateDescs[0].descriptors = &anisotropicSampler;
+        descriptorRangeUpdateDescs[1].descriptorNum = BUFFER_COUNT;
+        descriptorRangeUpdateDescs[1].descriptors = resourceViews;
+        descriptorRangeUpdateDescs[2].descriptorNum = 1;
+        descriptorRangeUpdateDescs[2].descriptors = &drawInstanceShaderResource;
+        NRI.UpdateDescriptorRanges(*m_DescriptorSets[0], 0, helper::GetCountOf(descriptorRangeUpdateDescs), descriptorRangeUpdateDescs);
+
+        nri::Descriptor* constantBufferView = m_Constants.GetView();
+        NRI.UpdateDynamicConstantBuffers(*m_DescriptorSets[0], 0, 1, &constantBufferView);
 
         // Material
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, MATERIAL_DESCRIPTOR_SET, &m_DescriptorSets[BUFFERED_FRAME_MAX_NUM], 1, textureNum));
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, MATERIAL_DESCRIPTOR_SET, &m_DescriptorSets[1], 1, textureNum));
 
         nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc = {};
         descriptorRangeUpdateDesc.descriptorNum = textureNum;
         descriptorRangeUpdateDesc.descriptors = m_Descriptors.data();
-        NRI.UpdateDescriptorRanges(*m_DescriptorSets[BUFFERED_FRAME_MAX_NUM], 0, 1, &descriptorRangeUpdateDesc);
+        NRI.UpdateDescriptorRanges(*m_DescriptorSets[1], 0, 1, &descriptorRangeUpdateDesc);
 
         // Culling
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_ComputePipelineLayout, 0, &m_DescriptorSets[BUFFERED_FRAME_MAX_NUM + 1], 1, 0));
-
-        nri::Descriptor* storageDescriptors[2] = {m_IndirectBufferCountShaderStorage, m_IndirectBufferShaderStorage};
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_ComputePipelineLayout, 0, &m_DescriptorSets[2], 1, 0));
 
-        nri::DescriptorRangeUpdateDesc rangeUpdateDescs[2] = {};
-        rangeUpdateDescs[0].descriptorNum = helper::GetCountOf(rangeUpdateDescs);
+        nri::DescriptorRangeUpdateDesc rangeUpdateDescs[3] = {};
+        rangeUpdateDescs[0].descriptorNum = helper::GetCountOf(storageDescriptors);
         rangeUpdateDescs[0].descriptors = storageDescriptors;
         rangeUpdateDescs[1].descriptorNum = BUFFER_COUNT;
         rangeUpdateDescs[1].descriptors = resourceViews;
-        NRI.UpdateDescriptorRanges(*m_DescriptorSets[BUFFERED_FRAME_MAX_NUM + 1], 0, 2, rangeUpdateDescs);
+        rangeUpdateDescs[2].descriptorNum = 1;
+        rangeUpdateDescs[2].descriptors = &depthPyramidShaderResource;
+        NRI.UpdateDescriptorRanges(*m_DescriptorSets[2], 0, helper::GetCountOf(rangeUpdateDescs), rangeUpdateDescs);
+
+        // Depth pyramid (mip 0 is downsampled from the depth buffer, others from the previous mip)
+        m_DepthPyramidDescriptorSets.resize(m_DepthPyramidMipNum);
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_DepthPyramidPipelineLayout, 0, m_DepthPyramidDescriptorSets.data(), m_DepthPyramidMipNum, 0));
+
+        for (uint32_t i = 0; i < m_DepthPyramidMipNum; i++) {
+            nri::DescriptorRangeUpdateDesc depthPyramidRangeUpdateDescs[2] = {};
+            depthPyramidRangeUpdateDescs[0].descriptorNum = 1;
+            depthPyramidRangeUpdateDescs[0].descriptors = i == 0 ? &depthShaderResource : &depthPyramidMipShaderResources[i - 1];
+            depthPyramidRangeUpdateDescs[1].descriptorNum = 1;
+            depthPyramidRangeUpdateDescs[1].descriptors = &depthPyramidMipStorages[i];
+            NRI.UpdateDescriptorRanges(*m_DepthPyramidDescriptorSets[i], 0, helper::GetCountOf(depthPyramidRangeUpdateDescs), depthPyramidRangeUpdateDescs);
+        }
     }
 
-    { // Upload data
-        std::vector<nri::TextureUploadDesc> textureData(1 + textureNum);
+    { // Upload data (scene textures are already uploaded)
+        nri::TextureUploadDesc textureData[2] = {};
         std::vector<MaterialData> materialData(m_Scene.materials.size());
         std::vector<InstanceData> instanceData(m_Scene.instances.size());
         std::vector<MeshData> meshData(m_Scene.meshes.size());
@@ -648,60 +853,58 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
             data.idxOffset = mesh.indexOffset;
             data.vtxCount = mesh.vertexNum;
             data.vtxOffset = mesh.vertexOffset;
-        }
 
-        uint32_t subresourceNum = 0;
-        for (uint32_t i = 0; i < textureNum; i++) {
-            const utils::Texture& texture = *m_Scene.textures[i];
-            subresourceNum += texture.GetArraySize() * texture.GetMipNum();
+            const float3 center = mesh.aabb.GetCenter();
+            const float3 extents = (mesh.aabb.vMax - mesh.aabb.vMin) * 0.5f;
+            data.boundsCenter = float4(center.x, center.y, center.z, 0.0f);
+            data.boundsExtents = float4(extents.x, extents.y, extents.z, 0.0f);
         }
 
-        std::vector<nri::TextureSubresourceUploadDesc> subresources(subresourceNum);
-        ;
-        nri::TextureSubresourceUploadDesc* subresourceBegin = subresources.data();
-
-        textureData[0] = {};
         textureData[0].subresources = nullptr;
-        textureData[0].texture = depthTexture;
+        textureData[0].texture = m_DepthTexture;
         textureData[0].after = {nri::AccessBits::DEPTH_STENCIL_ATTACHMENT_WRITE, nri::Layout::DEPTH_STENCIL_ATTACHMENT};
 
-        for (uint32_t i = 0; i < textureNum; i++) {
-            const utils::Texture& texture = *m_Scene.textures[i];
+        textureData[1].subresources = nullptr;
+        textureData[1].texture = m_DepthPyramid;
+        textureData[1].after = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE};
 
-            for (uint32_t slice = 0; slice < texture.GetArraySize(); slice++) {
-                for (uint32_t mip = 0; mip < texture.GetMipNum(); mip++)
-                    texture.GetSubresource(subresourceBegin[slice * texture.GetMipNum() + mip], mip, slice);
-            }
+        // Draw generation expects zeroed counters, it resets them itself afterwards
+        const uint32_t drawCounters[DRAW_COUNTER_NUM] = {};
 
-            const uint32_t j = i + 1;
-            textureData[j] = {};
-            textureData[j].subresources = subresourceBegin;
-            textureData[j].texture = m_Textures[i];
-            textureData[j].after = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE};
+        // Everything is visible in the first frame
+        const std::vector<uint32_t> visibility(m_Scene.instances.size(), 1);
 
-            subresourceBegin += texture.GetArraySize() * texture.GetMipNum();
-        }
+        // Draw generation expects empty buckets, it empties them itself afterwards
+        const std::vector<uint32_t> meshBuckets(m_Scene.meshes.size() * 2, 0);
+
+        // The first range of draw instances maps instances to themselves (CPU draws)
+        std::vector<uint32_t> drawInstances(m_Scene.instances.size());
+        for (uint32_t i = 0; i < (uint32_t)drawInstances.size(); i++)
+            drawInstances[i] = i;
 
         nri::BufferUploadDesc bufferData[] = {
             {nullptr, 0, m_Buffers[INDIRECT_BUFFER], 0, {nri::AccessBits::ARGUMENT_BUFFER, nri::StageBits::INDIRECT}},
+            {drawCounters, sizeof(drawCounters), m_Buffers[INDIRECT_COUNT_BUFFER], 0, {nri::AccessBits::ARGUMENT_BUFFER | nri::AccessBits::COPY_SOURCE, nri::StageBits::INDIRECT | nri::StageBits::COPY}},
+            {visibility.data(), visibility.size() * sizeof(uint32_t), m_Buffers[VISIBILITY_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER}},
+            {meshBuckets.data(), meshBuckets.size() * sizeof(uint32_t), m_Buffers[MESH_BUCKET_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER}},
+            {nullptr, 0, m_Buffers[INSTANCE_SLOT_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER}},
+            {drawInstances.data(), drawInstances.size() * sizeof(uint32_t), m_Buffers[DRAW_INSTANCE_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE, nri::StageBits::VERTEX_SHADER}},
             {meshData.data(), meshData.size() * sizeof(MeshData), m_Buffers[MESH_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE, nri::StageBits::FRAGMENT_SHADER | nri::StageBits::COMPUTE_SHADER}},
             {materialData.data(), materialData.size() * sizeof(MaterialData), m_Buffers[MATERIAL_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE, nri::StageBits::FRAGMENT_SHADER | nri::StageBits::COMPUTE_SHADER}},
             {instanceData.data(), instanceData.size() * sizeof(InstanceData), m_Buffers[INSTANCE_BUFFER], 0, {nri::AccessBits::SHADER_RESOURCE, nri::StageBits::FRAGMENT_SHADER | nri::StageBits::COMPUTE_SHADER}},
-            {m_Scene.vertices.data(), helper::GetByteSizeOf(m_Scene.vertices), m_Buffers[VERTEX_BUFFER], 0, {nri::AccessBits::VERTEX_BUFFER}},
-            {m_Scene.indices.data(), helper::GetByteSizeOf(m_Scene.indices), m_Buffers[INDEX_BUFFER], 0, {nri::AccessBits::INDEX_BUFFER}},
+            {m_SceneCache.GetVertexData(), m_SceneCache.GetVertexDataSize(), m_Buffers[VERTEX_BUFFER], 0, {nri::AccessBits::VERTEX_BUFFER}},
+            {m_SceneCache.GetIndexData(), m_SceneCache.GetIndexDataSize(), m_Buffers[INDEX_BUFFER], 0, {nri::AccessBits::INDEX_BUFFER}},
         };
 
-        NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, textureData.data(), (uint32_t)textureData.size(), bufferData, helper::GetCountOf(bufferData)));
+        NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, textureData, helper::GetCountOf(textureData), bufferData, helper::GetCountOf(bufferData)));
     }
 
-    { // Pipeline statistics
-        nri::QueryPoolDesc queryPoolDesc = {};
-        queryPoolDesc.queryType = nri::QueryType::PIPELINE_STATISTICS;
-        queryPoolDesc.capacity = 1;
-
-        NRI_ABORT_ON_FAILURE(NRI.CreateQueryPool(*m_Device, queryPoolDesc, m_QueryPool));
-    }
+    // Pipeline statistics
+    // One query per raster phase, compute dispatches in between are not included
+    NRI_ABORT_ON_FALSE(m_PipelineStatistics.Initialize(NRI, *m_Device, nri::QueryType::PIPELINE_STATISTICS, 2, BUFFERED_FRAME_MAX_NUM));
+    NRI_ABORT_ON_FALSE(m_GpuProfiler.Initialize(NRI, *m_Device, BUFFERED_FRAME_MAX_NUM));
 
+    m_SceneCache.Release();
     m_Scene.UnloadGeometryData();
     m_Scene.UnloadTextureData();
 
@@ -711,9 +914,23 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 void Sample::PrepareFrame(uint32_t frameIndex) {
     BeginUI();
 
-    // TODO: delay is not implemented
-    nri::PipelineStatisticsDesc* pipelineStats = (nri::PipelineStatisticsDesc*)NRI.MapBuffer(*m_Buffers[READBACK_BUFFER], 0, sizeof(nri::PipelineStatisticsDesc));
+    // Results of the latest finished frame, no waiting
+    m_PipelineStatistics.Update(NRI, *m_FrameFence);
     {
+        // Sum of raster phases
+        nri::PipelineStatisticsDesc phaseStatsSum = {};
+        const nri::PipelineStatisticsDesc* phaseStats = m_PipelineStatistics.GetResults<nri::PipelineStatisticsDesc>();
+        for (uint32_t i = 0; i < m_PipelineStatistics.GetResultNum(); i++) {
+            phaseStatsSum.inputVertexNum += phaseStats[i].inputVertexNum;
+            phaseStatsSum.inputPrimitiveNum += phaseStats[i].inputPrimitiveNum;
+            phaseStatsSum.vertexShaderInvocationNum += phaseStats[i].vertexShaderInvocationNum;
+            phaseStatsSum.rasterizerInPrimitiveNum += phaseStats[i].rasterizerInPrimitiveNum;
+            phaseStatsSum.rasterizerOutPrimitiveNum += phaseStats[i].rasterizerOutPrimitiveNum;
+            phaseStatsSum.fragmentShaderInvocationNum += phaseStats[i].fragmentShaderInvocationNum;
+        }
+
+        const nri::PipelineStatisticsDesc* pipelineStats = &phaseStatsSum;
+
         ImGui::SetNextWindowPos(ImVec2(30, 30), ImGuiCond_Once);
         ImGui::SetNextWindowSize(ImVec2(0, 0));
         ImGui::Begin("Stats");
@@ -724,11 +941,65 @@ void Sample::PrepareFrame(uint32_t frameIndex) {
             ImGui::Text("Rasterizer input primitives  : %llu", pipelineStats->rasterizerInPrimitiveNum);
             ImGui::Text("Rasterizer output primitives : %llu", pipelineStats->rasterizerOutPrimitiveNum);
             ImGui::Text("Fragment shader invocations  : %llu", pipelineStats->fragmentShaderInvocationNum);
-            ImGui::Checkbox("GPU draw call generation", &m_UseGPUDrawGeneration);
+
+            if (ImGui::Combo("Draw mode", &m_DrawMode, DRAW_MODE_NAMES, (int32_t)helper::GetCountOf(DRAW_MODE_NAMES)))
+                m_DrawModeFrame = frameIndex;
+
+            ImGui::Text("Draw mode                    : CPU / GPU time");
+            for (uint32_t i = 0; i < DRAW_MODE_NUM; i++)
+                ImGui::Text("  %-27s: %6.3f / %6.3f ms", DRAW_MODE_NAMES[i], m_DrawModeCpuTimes[i], m_DrawModeGpuTimes[i]);
+
+            if (m_DrawMode == GPU_DRAW_GENERATION) {
+                ImGui::Checkbox("GPU frustum culling", &m_UseGPUCulling);
+
+                if (m_UseGPUCulling) {
+                    ImGui::Checkbox("GPU occlusion culling", &m_UseGPUOcclusionCulling);
+
+                    if (m_UseGPUOcclusionCulling) {
+                        ImGui::Text("Early draws (inst, rejected) : %u (%u, %u)", m_DrawStats[DRAW_COUNT_EARLY], m_DrawStats[INSTANCE_NUM_EARLY], m_DrawStats[REJECTED_NUM_EARLY]);
+                        ImGui::Text("Late draws (inst, rejected)  : %u (%u, %u)", m_DrawStats[DRAW_COUNT_LATE], m_DrawStats[INSTANCE_NUM_LATE], m_DrawStats[REJECTED_NUM_LATE]);
+                    }
+                }
+
+                // Identical meshes are batched into one draw
+                const bool hasLatePhase = m_UseGPUCulling && m_UseGPUOcclusionCulling;
+                const uint32_t drawNum = m_DrawStats[DRAW_COUNT_EARLY] + (hasLatePhase ? m_DrawStats[DRAW_COUNT_LATE] : 0);
+                const uint32_t instanceNum = m_DrawStats[INSTANCE_NUM_EARLY] + (hasLatePhase ? m_DrawStats[INSTANCE_NUM_LATE] : 0);
+                ImGui::Text("Visible draws (instances)    : %u (%u) / %u", drawNum, instanceNum, (uint32_t)m_Scene.instances.size());
+            }
         }
         ImGui::End();
     }
-    NRI.UnmapBuffer(*m_Buffers[READBACK_BUFFER]);
+
+    { // Draw stats of the latest finished frame, no waiting
+        const uint64_t finishedFrameNum = NRI.GetFenceValue(*m_FrameFence);
+        const uint32_t finishedFrameIndex = (uint32_t)(finishedFrameNum - 1);
+        const uint32_t slot = finishedFrameIndex % (uint32_t)m_DrawStatsFrames.size();
+        constexpr uint32_t slotSize = DRAW_STAT_NUM * sizeof(uint32_t);
+
+        if (finishedFrameNum && finishedFrameIndex != m_DrawStatsFrame && m_DrawStatsFrames[slot] == finishedFrameIndex) {
+            const uint32_t* drawStats = (uint32_t*)NRI.MapBuffer(*m_DrawStatsReadback, slot * slotSize, slotSize);
+            if (drawStats) {
+                std::copy(drawStats, drawStats + DRAW_STAT_NUM, m_DrawStats.begin());
+                m_DrawStatsFrame = finishedFrameIndex;
+                NRI.UnmapBuffer(*m_DrawStatsReadback);
+            }
+        }
+    }
+
+    m_GpuProfiler.Update(NRI, *m_FrameFence);
+    m_GpuProfiler.RenderUI();
+
+    // GPU time of the current draw mode, once results of frames rendered with the previous mode are gone
+    if (frameIndex > m_DrawModeFrame + BUFFERED_FRAME_MAX_NUM + 1) {
+        for (const GpuProfiler::Node& node : m_GpuProfiler.GetNodes()) {
+            if (node.name == SCENE_SCOPE_NAME) {
+                double& gpuTime = m_DrawModeGpuTimes[m_DrawMode];
+                gpuTime = gpuTime == 0.0 ? node.time : gpuTime * 0.95 + node.time * 0.05;
+                break;
+            }
+        }
+    }
 
     EndUI(NRI, *m_Streamer);
     NRI.CopyStreamerUpdateRequests(*m_Streamer);
@@ -746,137 +1017,119 @@ void Sample::PrepareFrame(uint32_t frameIndex) {
 void Sample::RenderFrame(uint32_t frameIndex) {
     const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
     const Frame& frame = m_Frames[bufferedFrameIndex];
-    const uint32_t windowWidth = GetWindowResolution().x;
-    const uint32_t windowHeight = GetWindowResolution().y;
 
     if (frameIndex >= BUFFERED_FRAME_MAX_NUM) {
         NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
         NRI.ResetCommandAllocator(*frame.commandAllocator);
     }
 
+    // Two-phase occlusion culling: draw what was visible in the previous frame, build the depth pyramid,
+    // then test all instances against it and draw newly visible ones
+    const bool useGpuDrawGeneration = m_DrawMode == GPU_DRAW_GENERATION;
+    const bool useOcclusionCulling = useGpuDrawGeneration && m_UseGPUCulling && m_UseGPUOcclusionCulling;
+    const uint32_t rasterPhaseNum = useOcclusionCulling ? 2 : 1;
+
+    m_PipelineStatistics.SetFrameQueryNum(frameIndex, rasterPhaseNum);
+    m_GpuProfiler.BeginFrame(frameIndex);
+
     const uint32_t currentTextureIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
     BackBuffer& currentBackBuffer = m_SwapChainBuffers[currentTextureIndex];
 
     // Update constants
-    const uint64_t rangeOffset = m_Frames[bufferedFrameIndex].globalConstantBufferViewOffsets;
-    auto constants = (GlobalConstants*)NRI.MapBuffer(*m_Buffers[CONSTANT_BUFFER], rangeOffset, sizeof(GlobalConstants));
-    if (constants) {
-        constants->gWorldToClip = m_Camera.state.mWorldToClip * m_Scene.mSceneToWorld;
-        constants->gCameraPos = m_Camera.state.position;
-
-        NRI.UnmapBuffer(*m_Buffers[CONSTANT_BUFFER]);
+    uint32_t globalConstantBufferOffset = 0;
+    m_Constants.BeginFrame(NRI, frameIndex);
+    {
+        GlobalConstants* constants = m_Constants.Allocate<GlobalConstants>(globalConstantBufferOffset);
+        if (constants) {
+            constants->gWorldToClip = m_Camera.state.mWorldToClip * m_Scene.mSceneToWorld;
+            constants->gCameraPos = m_Camera.state.position;
+        }
     }
+    m_Constants.EndFrame(NRI);
 
     // Record
     nri::CommandBuffer& commandBuffer = *frame.commandBuffer;
     NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
     {
-        helper::Annotation annotation(NRI, commandBuffer, "Scene");
-
-        nri::AttachmentsDesc attachmentsDesc = {};
-        attachmentsDesc.colorNum = 1;
-        attachmentsDesc.colors = &currentBackBuffer.colorAttachment;
-        attachmentsDesc.depthStencil = m_DepthAttachment;
-
-        nri::TextureBarrierDesc textureBarrierDescs = {};
-        textureBarrierDescs.texture = currentBackBuffer.texture;
-        textureBarrierDescs.after = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
-        textureBarrierDescs.layerNum = 1;
-        textureBarrierDescs.mipNum = 1;
-
-        nri::BarrierGroupDesc computeBarrierGroupDesc = {};
-        nri::BufferBarrierDesc bufferBarrierDesc = {};
-        bufferBarrierDesc.buffer = m_Buffers[INDIRECT_BUFFER];
-        bufferBarrierDesc.before = {nri::AccessBits::ARGUMENT_BUFFER, nri::StageBits::INDIRECT};
-        bufferBarrierDesc.after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
-        computeBarrierGroupDesc.bufferNum = 1;
-        computeBarrierGroupDesc.buffers = &bufferBarrierDesc;
-
-        nri::BarrierGroupDesc barrierGroupDesc = {};
-        barrierGroupDesc.textureNum = 1;
-        barrierGroupDesc.textures = &textureBarrierDescs;
-        if (m_UseGPUDrawGeneration) {
-            barrierGroupDesc.bufferNum = 1;
-            barrierGroupDesc.buffers = &bufferBarrierDesc;
-        }
+        m_GpuProfiler.CmdResetQueries(NRI, commandBuffer);
 
-        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+        {
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, SCENE_SCOPE_NAME);
 
-        if (m_UseGPUDrawGeneration) {
-            NRI.CmdSetPipelineLayout(commandBuffer, *m_ComputePipelineLayout);
-            NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DescriptorSets[BUFFERED_FRAME_MAX_NUM + 1], nullptr);
+            nri::AttachmentsDesc attachmentsDesc = {};
+            attachmentsDesc.colorNum = 1;
+            attachmentsDesc.colors = &currentBackBuffer.colorAttachment;
+            attachmentsDesc.depthStencil = m_DepthAttachment;
 
-            // Culling
-            CullingConstants cullingConstants = {};
-            cullingConstants.DrawCount = (uint32_t)m_Scene.instances.size();
-            NRI.CmdSetRootConstants(commandBuffer, 0, &cullingConstants, sizeof(cullingConstants));
+            nri::TextureBarrierDesc textureBarrierDescs = {};
+            textureBarrierDescs.texture = currentBackBuffer.texture;
+            textureBarrierDescs.after = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
+            textureBarrierDescs.layerNum = 1;
+            textureBarrierDescs.mipNum = 1;
 
-            NRI.CmdSetPipeline(commandBuffer, *m_ComputePipeline);
-            NRI.CmdDispatch(commandBuffer, {1, 1, 1});
+            nri::BarrierGroupDesc barrierGroupDesc = {};
+            barrierGroupDesc.textureNum = 1;
+            barrierGroupDesc.textures = &textureBarrierDescs;
 
-            // Transition from UAV to indirect argument
-            bufferBarrierDesc.after = {nri::AccessBits::ARGUMENT_BUFFER, nri::StageBits::INDIRECT};
-            bufferBarrierDesc.before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
-            NRI.CmdBarrier(commandBuffer, computeBarrierGroupDesc);
-        }
+            NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
 
-        NRI.CmdResetQueries(commandBuffer, *m_QueryPool, 0, 1);
-        NRI.CmdBeginQuery(commandBuffer, *m_QueryPool, 0);
-        {
-            NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-            {
-                nri::ClearDesc clearDescs[2] = {};
-                clearDescs[0].planes = nri::PlaneBits::COLOR;
-                clearDescs[0].value.color.f = {0.0f, 0.63f, 1.0f};
-                clearDescs[1].planes = nri::PlaneBits::DEPTH;
-                clearDescs[1].value.depthStencil.depth = CLEAR_DEPTH;
-
-                NRI.CmdClearAttachments(commandBuffer, clearDescs, helper::GetCountOf(clearDescs), nullptr, 0);
-
-                const nri::Viewport viewport = {0.0f, 0.0f, (float)windowWidth, (float)windowHeight, 0.0f, 1.0f};
-                NRI.CmdSetViewports(commandBuffer, &viewport, 1);
-
-                const nri::Rect scissor = {0, 0, (nri::Dim_t)windowWidth, (nri::Dim_t)windowHeight};
-                NRI.CmdSetScissors(commandBuffer, &scissor, 1);
-
-                NRI.CmdSetIndexBuffer(commandBuffer, *m_Buffers[INDEX_BUFFER], 0, sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32);
-
-                NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
-                NRI.CmdSetDescriptorSet(commandBuffer, GLOBAL_DESCRIPTOR_SET, *m_DescriptorSets[bufferedFrameIndex], nullptr);
-                NRI.CmdSetDescriptorSet(commandBuffer, MATERIAL_DESCRIPTOR_SET, *m_DescriptorSets[BUFFERED_FRAME_MAX_NUM], nullptr);
-                NRI.CmdSetPipeline(commandBuffer, *m_Pipeline);
-
-                constexpr uint64_t offset = 0;
-                NRI.CmdSetVertexBuffers(commandBuffer, 0, 1, &m_Buffers[VERTEX_BUFFER], &offset);
-
-                if (m_UseGPUDrawGeneration) {
-                    NRI.CmdDrawIndexedIndirect(commandBuffer, *m_Buffers[INDIRECT_BUFFER], 0, (uint32_t)m_Scene.instances.size(), GetDrawIndexedCommandSize(), m_Buffers[INDIRECT_COUNT_BUFFER], 0);
-                } else {
-                    for (uint32_t i = 0; i < m_Scene.instances.size(); i++) {
-                        const utils::Instance& instance = m_Scene.instances[i];
-                        const utils::Mesh& mesh = m_Scene.meshes[instance.meshInstanceIndex];
-                        NRI.CmdDrawIndexed(commandBuffer, {mesh.indexNum, 1, mesh.indexOffset, (int32_t)mesh.vertexOffset, i});
-                    }
+            // CPU time of the current draw mode: draw generation and draw recording
+            const double drawBeginTime = m_Timer.GetTimeStamp();
+
+            if (useGpuDrawGeneration)
+                GenerateDrawCalls(commandBuffer, 0);
+            else if (m_DrawMode == CPU_INDIRECT)
+                GenerateDrawCallsOnCpu(bufferedFrameIndex);
+
+            // Pipeline statistics cover raster passes only
+            m_PipelineStatistics.CmdResetQueries(NRI, commandBuffer, frameIndex, 0, rasterPhaseNum);
+
+            for (uint32_t phase = 0; phase < rasterPhaseNum; phase++) {
+                if (phase) {
+                    BuildDepthPyramid(commandBuffer);
+                    GenerateDrawCalls(commandBuffer, phase);
+                }
+
+                const uint32_t queryIndex = m_PipelineStatistics.GetQueryIndex(frameIndex, phase);
+                NRI.CmdBeginQuery(commandBuffer, m_PipelineStatistics.GetQueryPool(), queryIndex);
+                {
+                    RenderScene(commandBuffer, attachmentsDesc, globalConstantBufferOffset, bufferedFrameIndex, phase);
                 }
+                NRI.CmdEndQuery(commandBuffer, m_PipelineStatistics.GetQueryPool(), queryIndex);
             }
-            NRI.CmdEndRendering(commandBuffer);
-        }
-        NRI.CmdEndQuery(commandBuffer, *m_QueryPool, 0);
-        NRI.CmdCopyQueries(commandBuffer, *m_QueryPool, 0, 1, *m_Buffers[READBACK_BUFFER], 0);
 
-        attachmentsDesc.depthStencil = nullptr;
+            double& cpuTime = m_DrawModeCpuTimes[m_DrawMode];
+            const double drawTime = m_Timer.GetTimeStamp() - drawBeginTime;
+            cpuTime = cpuTime == 0.0 ? drawTime : cpuTime * 0.95 + drawTime * 0.05;
 
-        NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-        {
-            RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
-        }
-        NRI.CmdEndRendering(commandBuffer);
+            m_PipelineStatistics.CmdCopyQueries(NRI, commandBuffer, frameIndex, 0, rasterPhaseNum);
 
-        textureBarrierDescs.before = textureBarrierDescs.after;
-        textureBarrierDescs.after = {nri::AccessBits::UNKNOWN, nri::Layout::PRESENT};
+            if (useGpuDrawGeneration) { // Draw stats readback
+                constexpr uint32_t slotSize = DRAW_STAT_NUM * sizeof(uint32_t);
+                const uint32_t slot = frameIndex % (uint32_t)m_DrawStatsFrames.size();
+                NRI.CmdCopyBuffer(commandBuffer, *m_DrawStatsReadback, slot * slotSize, *m_Buffers[INDIRECT_COUNT_BUFFER], 0, slotSize);
+                m_DrawStatsFrames[slot] = frameIndex;
+            }
 
-        barrierGroupDesc.bufferNum = 0;
-        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+            attachmentsDesc.depthStencil = nullptr;
+
+            { // UI
+                GpuProfiler::Scope uiScope(m_GpuProfiler, NRI, commandBuffer, "UI");
+
+                NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
+                {
+                    RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
+                }
+                NRI.CmdEndRendering(commandBuffer);
+            }
+
+            textureBarrierDescs.before = textureBarrierDescs.after;
+            textureBarrierDescs.after = {nri::AccessBits::UNKNOWN, nri::Layout::PRESENT};
+
+            NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+        }
+
+        m_GpuProfiler.CmdEndFrame(NRI, commandBuffer);
     }
     NRI.EndCommandBuffer(commandBuffer);
 
@@ -904,4 +1157,226 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     }
 }
 
+void Sample::GenerateDrawCalls(nri::CommandBuffer& commandBuffer, uint32_t phase) {
+    GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, phase == 0 ? "Draw generation (early)" : "Draw generation (late)");
+
+    // Draw counters are also copied to the readback buffer, visibility is written by the late phase and read by the next early one
+    nri::BufferBarrierDesc bufferBarrierDescs[6] = {};
+    bufferBarrierDescs[0].buffer = m_Buffers[INDIRECT_BUFFER];
+    bufferBarrierDescs[0].before = {nri::AccessBits::ARGUMENT_BUFFER, nri::StageBits::INDIRECT};
+    bufferBarrierDescs[0].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[1].buffer = m_Buffers[INDIRECT_COUNT_BUFFER];
+    bufferBarrierDescs[1].before = {nri::AccessBits::ARGUMENT_BUFFER | nri::AccessBits::COPY_SOURCE, nri::StageBits::INDIRECT | nri::StageBits::COPY};
+    bufferBarrierDescs[1].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[2].buffer = m_Buffers[DRAW_INSTANCE_BUFFER];
+    bufferBarrierDescs[2].before = {nri::AccessBits::SHADER_RESOURCE, nri::StageBits::VERTEX_SHADER};
+    bufferBarrierDescs[2].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[3].buffer = m_Buffers[VISIBILITY_BUFFER];
+    bufferBarrierDescs[3].before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[3].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[4].buffer = m_Buffers[MESH_BUCKET_BUFFER];
+    bufferBarrierDescs[4].before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[4].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[5].buffer = m_Buffers[INSTANCE_SLOT_BUFFER];
+    bufferBarrierDescs[5].before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    bufferBarrierDescs[5].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+
+    nri::BarrierGroupDesc barrierGroupDesc = {};
+    barrierGroupDesc.bufferNum = helper::GetCountOf(bufferBarrierDescs);
+    barrierGroupDesc.buffers = bufferBarrierDescs;
+
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+    NRI.CmdSetPipelineLayout(commandBuffer, *m_ComputePipelineLayout);
+    NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DescriptorSets[2], nullptr);
+
+    // Culling
+    CullingConstants cullingConstants = {};
+    cullingConstants.SceneToClip = m_Camera.state.mWorldToClip * m_Scene.mSceneToWorld;
+    cullingConstants.InstanceCount = (uint32_t)m_Scene.instances.size();
+    cullingConstants.MeshCount = (uint32_t)m_Scene.meshes.size();
+    cullingConstants.EnableCulling = m_UseGPUCulling ? 1 : 0;
+    cullingConstants.EnableOcclusionCulling = (m_UseGPUCulling && m_UseGPUOcclusionCulling) ? 1 : 0;
+    cullingConstants.Phase = phase;
+    cullingConstants.DepthPyramidWidth = m_DepthPyramidWidth;
+    cullingConstants.DepthPyramidHeight = m_DepthPyramidHeight;
+    NRI.CmdSetRootConstants(commandBuffer, 0, &cullingConstants, sizeof(cullingConstants));
+
+    const uint32_t instanceGroupNum = ((uint32_t)m_Scene.instances.size() + DRAW_GENERATION_GROUP_SIZE - 1) / DRAW_GENERATION_GROUP_SIZE;
+    const uint32_t meshGroupNum = ((uint32_t)m_Scene.meshes.size() + DRAW_GENERATION_GROUP_SIZE - 1) / DRAW_GENERATION_GROUP_SIZE;
+
+    // Each pass depends on the results of the previous one
+    for (nri::BufferBarrierDesc& bufferBarrierDesc : bufferBarrierDescs)
+        bufferBarrierDesc.before = bufferBarrierDesc.after;
+
+    // Instances are culled and counted per mesh
+    NRI.CmdSetPipeline(commandBuffer, *m_InstanceCullingPipeline);
+    NRI.CmdDispatch(commandBuffer, {instanceGroupNum, 1, 1});
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+    // A draw per mesh with visible instances
+    NRI.CmdSetPipeline(commandBuffer, *m_ComputePipeline);
+    NRI.CmdDispatch(commandBuffer, {meshGroupNum, 1, 1});
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+    // Instances are written into the ranges of their draws
+    NRI.CmdSetPipeline(commandBuffer, *m_InstanceScatterPipeline);
+    NRI.CmdDispatch(commandBuffer, {instanceGroupNum, 1, 1});
+
+    // Transition from UAV to indirect argument and vertex shader input
+    bufferBarrierDescs[0].after = {nri::AccessBits::ARGUMENT_BUFFER, nri::StageBits::INDIRECT};
+    bufferBarrierDescs[1].after = {nri::AccessBits::ARGUMENT_BUFFER | nri::AccessBits::COPY_SOURCE, nri::StageBits::INDIRECT | nri::StageBits::COPY};
+    bufferBarrierDescs[2].after = {nri::AccessBits::SHADER_RESOURCE, nri::StageBits::VERTEX_SHADER};
+
+    barrierGroupDesc.bufferNum = 3;
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+}
+
+void Sample::GenerateDrawCallsOnCpu(uint32_t bufferedFrameIndex) {
+    // The region of the frame is not in use by the GPU anymore
+    const uint32_t instanceNum = (uint32_t)m_Scene.instances.size();
+    const bool isDrawParametersEmulationEnabled = NRI.GetDeviceDesc(*m_Device).isDrawParametersEmulationEnabled;
+    uint8_t* arguments = m_CpuIndirectArguments + (uint64_t)bufferedFrameIndex * instanceNum * GetDrawIndexedCommandSize();
+
+    m_JobScheduler.ParallelFor(instanceNum, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            const utils::Instance& instance = m_Scene.instances[i];
+            const utils::Mesh& mesh = m_Scene.meshes[m_Scene.meshInstances[instance.meshInstanceIndex].meshIndex];
+
+            // The first range of draw instances maps instances to themselves
+            if (isDrawParametersEmulationEnabled) {
+                nri::DrawIndexedBaseDesc& desc = ((nri::DrawIndexedBaseDesc*)arguments)[i];
+                desc.shaderEmulatedBaseVertex = (int32_t)mesh.vertexOffset;
+                desc.shaderEmulatedBaseInstance = i;
+                desc.indexNum = mesh.indexNum;
+                desc.instanceNum = 1;
+                desc.baseIndex = mesh.indexOffset;
+                desc.baseVertex = (int32_t)mesh.vertexOffset;
+                desc.baseInstance = i;
+            } else
+                ((nri::DrawIndexedDesc*)arguments)[i] = {mesh.indexNum, 1, mesh.indexOffset, (int32_t)mesh.vertexOffset, i};
+        }
+    });
+}
+
+void Sample::BuildDepthPyramid(nri::CommandBuffer& commandBuffer) {
+    GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Depth pyramid");
+
+    nri::TextureBarrierDesc textureBarrierDescs[2] = {};
+    textureBarrierDescs[0].texture = m_DepthTexture;
+    textureBarrierDescs[0].before = {nri::AccessBits::DEPTH_STENCIL_ATTACHMENT_WRITE, nri::Layout::DEPTH_STENCIL_ATTACHMENT, nri::StageBits::DEPTH_STENCIL_ATTACHMENT};
+    textureBarrierDescs[0].after = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE, nri::StageBits::COMPUTE_SHADER};
+    textureBarrierDescs[0].layerNum = 1;
+    textureBarrierDescs[0].mipNum = 1;
+    textureBarrierDescs[1].texture = m_DepthPyramid;
+    textureBarrierDescs[1].before = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE, nri::StageBits::COMPUTE_SHADER};
+    textureBarrierDescs[1].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::Layout::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+    textureBarrierDescs[1].layerNum = 1;
+    textureBarrierDescs[1].mipNum = (nri::Mip_t)m_DepthPyramidMipNum;
+
+    nri::BarrierGroupDesc barrierGroupDesc = {};
+    barrierGroupDesc.textureNum = helper::GetCountOf(textureBarrierDescs);
+    barrierGroupDesc.textures = textureBarrierDescs;
+
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+    NRI.CmdSetPipelineLayout(commandBuffer, *m_DepthPyramidPipelineLayout);
+    NRI.CmdSetPipeline(commandBuffer, *m_DepthPyramidPipeline);
+
+    DepthPyramidConstants constants = {};
+    constants.SrcWidth = GetWindowResolution().x;
+    constants.SrcHeight = GetWindowResolution().y;
+
+    for (uint32_t i = 0; i < m_DepthPyramidMipNum; i++) {
+        constants.DstWidth = std::max(m_DepthPyramidWidth >> i, 1u);
+        constants.DstHeight = std::max(m_DepthPyramidHeight >> i, 1u);
+
+        NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DepthPyramidDescriptorSets[i], nullptr);
+        NRI.CmdSetRootConstants(commandBuffer, 0, &constants, sizeof(constants));
+
+        const uint32_t groupNumX = (constants.DstWidth + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE;
+        const uint32_t groupNumY = (constants.DstHeight + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE;
+        NRI.CmdDispatch(commandBuffer, {groupNumX, groupNumY, 1});
+
+        // The mip is the source of the next one
+        nri::TextureBarrierDesc mipBarrierDesc = {};
+        mipBarrierDesc.texture = m_DepthPyramid;
+        mipBarrierDesc.before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::Layout::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+        mipBarrierDesc.after = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE, nri::StageBits::COMPUTE_SHADER};
+        mipBarrierDesc.mipOffset = (nri::Mip_t)i;
+        mipBarrierDesc.mipNum = 1;
+        mipBarrierDesc.layerNum = 1;
+
+        barrierGroupDesc.textureNum = 1;
+        barrierGroupDesc.textures = &mipBarrierDesc;
+        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+        constants.SrcWidth = constants.DstWidth;
+        constants.SrcHeight = constants.DstHeight;
+    }
+
+    // The late phase renders into the same depth buffer
+    textureBarrierDescs[0].before = textureBarrierDescs[0].after;
+    textureBarrierDescs[0].after = {nri::AccessBits::DEPTH_STENCIL_ATTACHMENT_WRITE, nri::Layout::DEPTH_STENCIL_ATTACHMENT, nri::StageBits::DEPTH_STENCIL_ATTACHMENT};
+
+    barrierGroupDesc.textureNum = 1;
+    barrierGroupDesc.textures = &textureBarrierDescs[0];
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+}
+
+void Sample::RenderScene(nri::CommandBuffer& commandBuffer, const nri::AttachmentsDesc& attachmentsDesc, uint32_t globalConstantBufferOffset, uint32_t bufferedFrameIndex, uint32_t phase) {
+    GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, phase == 0 ? "Rendering (early)" : "Rendering (late)");
+
+    const uint32_t windowWidth = GetWindowResolution().x;
+    const uint32_t windowHeight = GetWindowResolution().y;
+
+    NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
+    {
+        // The late phase adds to the early one
+        if (phase == 0) {
+            nri::ClearDesc clearDescs[2] = {};
+            clearDescs[0].planes = nri::PlaneBits::COLOR;
+            clearDescs[0].value.color.f = {0.0f, 0.63f, 1.0f};
+            clearDescs[1].planes = nri::PlaneBits::DEPTH;
+            clearDescs[1].value.depthStencil.depth = CLEAR_DEPTH;
+
+            NRI.CmdClearAttachments(commandBuffer, clearDescs, helper::GetCountOf(clearDescs), nullptr, 0);
+        }
+
+        const nri::Viewport viewport = {0.0f, 0.0f, (float)windowWidth, (float)windowHeight, 0.0f, 1.0f};
+        NRI.CmdSetViewports(commandBuffer, &viewport, 1);
+
+        const nri::Rect scissor = {0, 0, (nri::Dim_t)windowWidth, (nri::Dim_t)windowHeight};
+        NRI.CmdSetScissors(commandBuffer, &scissor, 1);
+
+        NRI.CmdSetIndexBuffer(commandBuffer, *m_Buffers[INDEX_BUFFER], 0, sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32);
+
+        NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+        NRI.CmdSetDescriptorSet(commandBuffer, GLOBAL_DESCRIPTOR_SET, *m_DescriptorSets[0], &globalConstantBufferOffset);
+        NRI.CmdSetDescriptorSet(commandBuffer, MATERIAL_DESCRIPTOR_SET, *m_DescriptorSets[1], nullptr);
+        NRI.CmdSetPipeline(commandBuffer, *m_Pipeline);
+
+        constexpr uint64_t offset = 0;
+        NRI.CmdSetVertexBuffers(commandBuffer, 0, 1, &m_Buffers[VERTEX_BUFFER], &offset);
+
+        if (m_DrawMode == GPU_DRAW_GENERATION) {
+            const uint32_t drawMaxNum = (uint32_t)m_Scene.meshes.size();
+            const uint64_t commandOffset = (uint64_t)phase * drawMaxNum * GetDrawIndexedCommandSize();
+            const uint64_t countOffset = (DRAW_COUNT_EARLY + phase) * sizeof(uint32_t);
+            NRI.CmdDrawIndexedIndirect(commandBuffer, *m_Buffers[INDIRECT_BUFFER], commandOffset, drawMaxNum, GetDrawIndexedCommandSize(), m_Buffers[INDIRECT_COUNT_BUFFER], countOffset);
+        } else if (m_DrawMode == CPU_INDIRECT) {
+            const uint32_t drawNum = (uint32_t)m_Scene.instances.size();
+            const uint64_t commandOffset = (uint64_t)bufferedFrameIndex * drawNum * GetDrawIndexedCommandSize();
+            NRI.CmdDrawIndexedIndirect(commandBuffer, *m_CpuIndirectRing, commandOffset, drawNum, GetDrawIndexedCommandSize(), nullptr, 0);
+        } else {
+            for (uint32_t i = 0; i < m_Scene.instances.size(); i++) {
+                const utils::Instance& instance = m_Scene.instances[i];
+                const utils::Mesh& mesh = m_Scene.meshes[m_Scene.meshInstances[instance.meshInstanceIndex].meshIndex];
+                NRI.CmdDrawIndexed(commandBuffer, {mesh.indexNum, 1, mesh.indexOffset, (int32_t)mesh.vertexOffset, i});
+            }
+        }
+    }
+    NRI.CmdEndRendering(commandBuffer);
+}
+
 SAMPLE_MAIN(Sample, 0);
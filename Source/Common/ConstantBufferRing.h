@@ -0,0 +1,140 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include "NRI.h"
+
+#include <stdint.h>
+
+// Linear per-frame allocator for constants. One HOST_UPLOAD buffer is split into "frameNum" regions, each frame bump-allocates
+// in its own region. Blocks are bound with a dynamic offset on top of a single constant buffer view, which covers "blockMaxSize".
+// The buffer stays mapped, except on D3D11 where a buffer can't be used by the GPU while it's mapped (the region is mapped per frame)
+class ConstantBufferRing {
+public:
+    bool Initialize(nri::CoreInterface& NRI, nri::Device& device, uint32_t frameSize, uint32_t frameNum, uint32_t blockMaxSize);
+    void Destroy(nri::CoreInterface& NRI);
+
+    // The frame region must not be in use by the GPU anymore
+    void BeginFrame(nri::CoreInterface& NRI, uint32_t frameIndex);
+    void EndFrame(nri::CoreInterface& NRI);
+
+    // Returns "nullptr" if the frame region is exhausted
+    void* Allocate(uint32_t size, uint32_t& dynamicOffset);
+
+    template <typename T>
+    inline T* Allocate(uint32_t& dynamicOffset) {
+        return (T*)Allocate((uint32_t)sizeof(T), dynamicOffset);
+    }
+
+    // For "UpdateDynamicConstantBuffers"
+    inline nri::Descriptor* GetView() const {
+        return m_View;
+    }
+
+private:
+    nri::Buffer* m_Buffer = nullptr;
+    nri::Memory* m_Memory = nullptr;
+    nri::Descriptor* m_View = nullptr;
+    uint8_t* m_MappedMemory = nullptr; // the whole buffer or the current frame region
+    uint8_t* m_MappedFrame = nullptr;
+    uint32_t m_FrameSize = 0;
+    uint32_t m_FrameNum = 0;
+    uint32_t m_BlockMaxSize = 0;
+    uint32_t m_Alignment = 1;
+    uint32_t m_FrameBegin = 0;
+    uint32_t m_Offset = 0;
+    bool m_IsPersistentlyMapped = true;
+};
+
+inline bool ConstantBufferRing::Initialize(nri::CoreInterface& NRI, nri::Device& device, uint32_t frameSize, uint32_t frameNum, uint32_t blockMaxSize) {
+    const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(device);
+
+    m_Alignment = deviceDesc.constantBufferOffsetAlignment;
+    m_BlockMaxSize = (blockMaxSize + m_Alignment - 1) / m_Alignment * m_Alignment;
+    m_FrameSize = (frameSize + m_Alignment - 1) / m_Alignment * m_Alignment;
+    m_FrameNum = frameNum;
+    m_IsPersistentlyMapped = deviceDesc.graphicsAPI != nri::GraphicsAPI::D3D11;
+
+    // The view at the last allocated offset must stay in the buffer
+    nri::BufferDesc bufferDesc = {};
+    bufferDesc.size = (uint64_t)m_FrameSize * frameNum + m_BlockMaxSize;
+    bufferDesc.usage = nri::BufferUsageBits::CONSTANT_BUFFER;
+
+    if (NRI.CreateBuffer(device, bufferDesc, m_Buffer) != nri::Result::SUCCESS)
+        return false;
+
+    nri::ResourceGroupDesc resourceGroupDesc = {};
+    resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
+    resourceGroupDesc.bufferNum = 1;
+    resourceGroupDesc.buffers = &m_Buffer;
+
+    if (NRI.AllocateAndBindMemory(device, resourceGroupDesc, &m_Memory) != nri::Result::SUCCESS)
+        return false;
+
+    nri::BufferViewDesc bufferViewDesc = {};
+    bufferViewDesc.buffer = m_Buffer;
+    bufferViewDesc.viewType = nri::BufferViewType::CONSTANT;
+    bufferViewDesc.size = m_BlockMaxSize;
+
+    if (NRI.CreateBufferView(bufferViewDesc, m_View) != nri::Result::SUCCESS)
+        return false;
+
+    if (m_IsPersistentlyMapped) {
+        m_MappedMemory = (uint8_t*)NRI.MapBuffer(*m_Buffer, 0, nri::WHOLE_SIZE);
+        if (!m_MappedMemory)
+            return false;
+    }
+
+    return true;
+}
+
+inline void ConstantBufferRing::Destroy(nri::CoreInterface& NRI) {
+    if (m_MappedMemory)
+        NRI.UnmapBuffer(*m_Buffer);
+
+    if (m_View)
+        NRI.DestroyDescriptor(*m_View);
+
+    if (m_Buffer)
+        NRI.DestroyBuffer(*m_Buffer);
+
+    if (m_Memory)
+        NRI.FreeMemory(*m_Memory);
+
+    m_MappedMemory = nullptr;
+    m_View = nullptr;
+    m_Buffer = nullptr;
+    m_Memory = nullptr;
+}
+
+inline void ConstantBufferRing::BeginFrame(nri::CoreInterface& NRI, uint32_t frameIndex) {
+    m_FrameBegin = (frameIndex % m_FrameNum) * m_FrameSize;
+    m_Offset = m_FrameBegin;
+
+    if (m_IsPersistentlyMapped)
+        m_MappedFrame = m_MappedMemory + m_FrameBegin;
+    else {
+        m_MappedMemory = (uint8_t*)NRI.MapBuffer(*m_Buffer, m_FrameBegin, m_FrameSize);
+        m_MappedFrame = m_MappedMemory;
+    }
+}
+
+inline void ConstantBufferRing::EndFrame(nri::CoreInterface& NRI) {
+    if (!m_IsPersistentlyMapped && m_MappedMemory) {
+        NRI.UnmapBuffer(*m_Buffer);
+        m_MappedMemory = nullptr;
+    }
+
+    m_MappedFrame = nullptr;
+}
+
+inline void* ConstantBufferRing::Allocate(uint32_t size, uint32_t& dynamicOffset) {
+    const uint32_t alignedSize = (size + m_Alignment - 1) / m_Alignment * m_Alignment;
+    if (!m_MappedFrame || size > m_BlockMaxSize || m_Offset + alignedSize > m_FrameBegin + m_FrameSize)
+        return nullptr;
+
+    dynamicOffset = m_Offset;
+    m_Offset += alignedSize;
+
+    return m_MappedFrame + (dynamicOffset - m_FrameBegin);
+}
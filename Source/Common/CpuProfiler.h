@@ -0,0 +1,157 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Scoped CPU zones. Each thread writes fixed-size events into its own ring buffer (single writer, no locks, no allocations).
+// A buffer is allocated once per thread on its first zone. Older events get overwritten when a ring is full
+class CpuProfiler {
+public:
+    static constexpr uint32_t EVENT_MAX_NUM = 1 << 15; // per thread, power of 2
+
+    class Zone {
+    public:
+        // "name" must be a string literal (only the pointer is stored)
+        inline Zone(const char* name) {
+            CpuProfiler& profiler = Get();
+
+            m_Name = profiler.m_IsEnabled.load(std::memory_order_relaxed) ? name : nullptr;
+            if (m_Name)
+                m_Begin = GetTimeStamp();
+        }
+
+        inline ~Zone() {
+            if (m_Name)
+                Get().AddEvent(m_Name, m_Begin, GetTimeStamp());
+        }
+
+    private:
+        const char* m_Name;
+        uint64_t m_Begin;
+    };
+
+    static inline CpuProfiler& Get() {
+        static CpuProfiler s_Profiler;
+        return s_Profiler;
+    }
+
+    static inline uint64_t GetTimeStamp() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline void SetEnabled(bool isEnabled) {
+        m_IsEnabled.store(isEnabled, std::memory_order_relaxed);
+    }
+
+    inline bool IsEnabled() const {
+        return m_IsEnabled.load(std::memory_order_relaxed);
+    }
+
+    // Shown in the trace instead of the thread index
+    void SetThreadName(const char* name);
+
+    // Events being written during the export can be torn, call it when other threads are idle (i.e. between frames)
+    bool SaveChromeTrace(const char* path);
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct ThreadBuffer {
+        std::unique_ptr<Event[]> events;
+        std::atomic_uint64_t writeIndex = {0};
+        const char* name = nullptr;
+        uint32_t threadIndex = 0;
+    };
+
+    ThreadBuffer& GetThreadBuffer();
+
+    inline void AddEvent(const char* name, uint64_t begin, uint64_t end) {
+        ThreadBuffer& buffer = GetThreadBuffer();
+
+        const uint64_t writeIndex = buffer.writeIndex.load(std::memory_order_relaxed);
+        buffer.events[writeIndex & (EVENT_MAX_NUM - 1)] = {name, begin, end};
+        buffer.writeIndex.store(writeIndex + 1, std::memory_order_release);
+    }
+
+private:
+    std::vector<std::unique_ptr<ThreadBuffer>> m_ThreadBuffers;
+    std::mutex m_Mutex;
+    std::atomic_bool m_IsEnabled = {true};
+
+    static inline thread_local ThreadBuffer* s_ThreadBuffer = nullptr;
+};
+
+inline CpuProfiler::ThreadBuffer& CpuProfiler::GetThreadBuffer() {
+    if (!s_ThreadBuffer) {
+        std::unique_ptr<ThreadBuffer> buffer = std::make_unique<ThreadBuffer>();
+        buffer->events = std::make_unique<Event[]>(EVENT_MAX_NUM);
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        buffer->threadIndex = (uint32_t)m_ThreadBuffers.size();
+        s_ThreadBuffer = buffer.get();
+        m_ThreadBuffers.push_back(std::move(buffer));
+    }
+
+    return *s_ThreadBuffer;
+}
+
+inline void CpuProfiler::SetThreadName(const char* name) {
+    GetThreadBuffer().name = name;
+}
+
+inline bool CpuProfiler::SaveChromeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // Timestamps are relative to the oldest event
+    uint64_t origin = uint64_t(-1);
+    for (const std::unique_ptr<ThreadBuffer>& buffer : m_ThreadBuffers) {
+        const uint64_t writeIndex = buffer->writeIndex.load(std::memory_order_acquire);
+        const uint64_t firstIndex = writeIndex > EVENT_MAX_NUM ? writeIndex - EVENT_MAX_NUM : 0;
+
+        for (uint64_t i = firstIndex; i < writeIndex; i++)
+            origin = std::min(origin, buffer->events[i & (EVENT_MAX_NUM - 1)].begin);
+    }
+
+    fprintf(file, "{\"traceEvents\":[");
+
+    bool isFirst = true;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : m_ThreadBuffers) {
+        if (buffer->name) {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", isFirst ? "" : ",", buffer->threadIndex, buffer->name);
+            isFirst = false;
+        }
+
+        const uint64_t writeIndex = buffer->writeIndex.load(std::memory_order_acquire);
+        const uint64_t firstIndex = writeIndex > EVENT_MAX_NUM ? writeIndex - EVENT_MAX_NUM : 0;
+
+        for (uint64_t i = firstIndex; i < writeIndex; i++) {
+            const Event& event = buffer->events[i & (EVENT_MAX_NUM - 1)];
+
+            const double ts = double(event.begin - origin) / 1000.0;
+            const double dur = double(event.end - event.begin) / 1000.0;
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", isFirst ? "" : ",", event.name, buffer->threadIndex, ts, dur);
+            isFirst = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return true;
+}
@@ -0,0 +1,225 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include "NRIFramework.h"
+
+#include "QueryReadbackRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <vector>
+
+// Timestamps at the beginning and the end of annotated scopes. Results are read back with a delay (no waiting) and
+// presented as a tree of pass durations. Scopes can be recorded from several threads, nesting is tracked per thread
+class GpuProfiler {
+public:
+    static constexpr uint32_t SCOPE_MAX_NUM = 256;
+    static constexpr uint32_t INVALID_SCOPE = uint32_t(-1);
+
+    // Replaces "helper::Annotation", the annotation is still emitted
+    class Scope {
+    public:
+        inline Scope(GpuProfiler& profiler, nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, const char* name)
+            : m_Annotation(NRI, commandBuffer, name), m_Profiler(profiler), m_NRI(NRI), m_CommandBuffer(commandBuffer) {
+            m_ParentScope = s_CurrentScope;
+            m_ScopeIndex = m_Profiler.BeginScope(m_NRI, m_CommandBuffer, name, m_ParentScope);
+
+            if (m_ScopeIndex != INVALID_SCOPE)
+                s_CurrentScope = m_ScopeIndex;
+        }
+
+        inline ~Scope() {
+            if (m_ScopeIndex != INVALID_SCOPE) {
+                m_Profiler.EndScope(m_NRI, m_CommandBuffer, m_ScopeIndex);
+                s_CurrentScope = m_ParentScope;
+            }
+        }
+
+    private:
+        helper::Annotation m_Annotation;
+        GpuProfiler& m_Profiler;
+        nri::CoreInterface& m_NRI;
+        nri::CommandBuffer& m_CommandBuffer;
+        uint32_t m_ScopeIndex;
+        uint32_t m_ParentScope;
+    };
+
+    struct Node {
+        const char* name;
+        double time; // ms
+        uint32_t depth;
+        uint32_t childNum; // including grandchildren, children follow the node
+    };
+
+    bool Initialize(nri::CoreInterface& NRI, nri::Device& device, uint32_t frameInFlightNum);
+    void Destroy(nri::CoreInterface& NRI);
+
+    // CPU side, before any scope of the frame is recorded
+    void BeginFrame(uint32_t frameIndex);
+
+    // Must be recorded outside of rendering and executed before any scope of the frame on the GPU
+    void CmdResetQueries(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer);
+
+    // Must be recorded after all scopes of the frame, in the last submitted command buffer
+    void CmdEndFrame(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer);
+
+    // Picks up results of the latest finished frame (the fence is signaled with "1 + frameIndex")
+    void Update(nri::CoreInterface& NRI, nri::Fence& frameFence);
+
+    void RenderUI();
+    bool SaveJson(const char* path) const;
+
+    inline const std::vector<Node>& GetNodes() const {
+        return m_Nodes;
+    }
+
+private:
+    struct ScopeDesc {
+        const char* name;
+        uint32_t parent;
+    };
+
+    uint32_t BeginScope(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, const char* name, uint32_t parent);
+    void EndScope(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, uint32_t scopeIndex);
+    uint32_t AddNodes(const std::vector<ScopeDesc>& scopes, const uint64_t* timestamps, uint32_t scopeNum, uint32_t parent, uint32_t depth);
+
+private:
+    QueryReadbackRing m_Timestamps;
+    std::vector<std::vector<ScopeDesc>> m_SlotScopes;
+    std::vector<Node> m_Nodes;
+    std::atomic_uint32_t m_ScopeNum = {0};
+    uint64_t m_NodesFrameIndex = 0;
+    uint64_t m_TimestampFrequency = 1;
+    uint32_t m_FrameIndex = 0;
+
+    static inline thread_local uint32_t s_CurrentScope = INVALID_SCOPE;
+};
+
+inline bool GpuProfiler::Initialize(nri::CoreInterface& NRI, nri::Device& device, uint32_t frameInFlightNum) {
+    m_TimestampFrequency = NRI.GetDeviceDesc(device).timestampFrequencyHz;
+    m_SlotScopes.resize(frameInFlightNum + 1, std::vector<ScopeDesc>(SCOPE_MAX_NUM));
+
+    // 2 timestamps per scope
+    return m_Timestamps.Initialize(NRI, device, nri::QueryType::TIMESTAMP, SCOPE_MAX_NUM * 2, frameInFlightNum);
+}
+
+inline void GpuProfiler::Destroy(nri::CoreInterface& NRI) {
+    m_Timestamps.Destroy(NRI);
+}
+
+inline void GpuProfiler::BeginFrame(uint32_t frameIndex) {
+    m_FrameIndex = frameIndex;
+    m_ScopeNum.store(0, std::memory_order_relaxed);
+}
+
+inline void GpuProfiler::CmdResetQueries(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer) {
+    m_Timestamps.CmdResetQueries(NRI, commandBuffer, m_FrameIndex, 0, SCOPE_MAX_NUM * 2);
+}
+
+inline void GpuProfiler::CmdEndFrame(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer) {
+    const uint32_t scopeNum = std::min(m_ScopeNum.load(std::memory_order_relaxed), SCOPE_MAX_NUM);
+
+    if (scopeNum)
+        m_Timestamps.CmdCopyQueries(NRI, commandBuffer, m_FrameIndex, 0, scopeNum * 2);
+
+    m_Timestamps.SetFrameQueryNum(m_FrameIndex, scopeNum * 2);
+}
+
+inline uint32_t GpuProfiler::BeginScope(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, const char* name, uint32_t parent) {
+    const uint32_t scopeIndex = m_ScopeNum.fetch_add(1, std::memory_order_relaxed);
+    if (scopeIndex >= SCOPE_MAX_NUM)
+        return INVALID_SCOPE;
+
+    std::vector<ScopeDesc>& scopes = m_SlotScopes[m_FrameIndex % m_SlotScopes.size()];
+    scopes[scopeIndex] = {name, parent};
+
+    NRI.CmdEndQuery(commandBuffer, m_Timestamps.GetQueryPool(), m_Timestamps.GetQueryIndex(m_FrameIndex, scopeIndex * 2));
+
+    return scopeIndex;
+}
+
+inline void GpuProfiler::EndScope(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, uint32_t scopeIndex) {
+    NRI.CmdEndQuery(commandBuffer, m_Timestamps.GetQueryPool(), m_Timestamps.GetQueryIndex(m_FrameIndex, scopeIndex * 2 + 1));
+}
+
+inline uint32_t GpuProfiler::AddNodes(const std::vector<ScopeDesc>& scopes, const uint64_t* timestamps, uint32_t scopeNum, uint32_t parent, uint32_t depth) {
+    // Scopes are numbered in recording order, which keeps siblings in order
+    uint32_t nodeNum = 0;
+    for (uint32_t i = 0; i < scopeNum; i++) {
+        if (scopes[i].parent != parent)
+            continue;
+
+        const uint64_t begin = timestamps[i * 2];
+        const uint64_t end = timestamps[i * 2 + 1];
+
+        const size_t nodeIndex = m_Nodes.size();
+        m_Nodes.push_back({scopes[i].name, double(end > begin ? end - begin : 0) * 1000.0 / double(m_TimestampFrequency), depth, 0});
+
+        const uint32_t childNum = AddNodes(scopes, timestamps, scopeNum, i, depth + 1);
+        m_Nodes[nodeIndex].childNum = childNum;
+
+        nodeNum += 1 + childNum;
+    }
+
+    return nodeNum;
+}
+
+inline void GpuProfiler::Update(nri::CoreInterface& NRI, nri::Fence& frameFence) {
+    if (!m_Timestamps.Update(NRI, frameFence))
+        return;
+
+    m_NodesFrameIndex = m_Timestamps.GetResultFrameIndex();
+
+    const std::vector<ScopeDesc>& scopes = m_SlotScopes[m_NodesFrameIndex % m_SlotScopes.size()];
+    const uint64_t* timestamps = m_Timestamps.GetResults<uint64_t>();
+    const uint32_t scopeNum = m_Timestamps.GetResultNum() / 2;
+
+    m_Nodes.clear();
+    AddNodes(scopes, timestamps, scopeNum, INVALID_SCOPE, 0);
+}
+
+inline void GpuProfiler::RenderUI() {
+    ImGui::SetNextWindowPos(ImVec2(30, 400), ImGuiCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(0, 0));
+    ImGui::Begin("GPU profiler");
+    {
+        for (const Node& node : m_Nodes)
+            ImGui::Text("%*s%-*s : %7.3f ms", (int32_t)node.depth * 2, "", 24 - (int32_t)node.depth * 2, node.name, node.time);
+
+        if (ImGui::Button("Save JSON"))
+            SaveJson("GpuProfile.json");
+    }
+    ImGui::End();
+}
+
+inline bool GpuProfiler::SaveJson(const char* path) const {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\n  \"frame\": %llu,\n  \"scopes\": [", (unsigned long long)m_NodesFrameIndex);
+
+    // Nodes are stored depth-first, closing brackets are emitted when going back up
+    uint32_t prevDepth = 0;
+    for (size_t i = 0; i < m_Nodes.size(); i++) {
+        const Node& node = m_Nodes[i];
+
+        for (; prevDepth > node.depth; prevDepth--)
+            fprintf(file, "]}");
+
+        const bool isFirstSibling = i == 0 || m_Nodes[i - 1].depth < node.depth;
+        fprintf(file, "%s\n%*s{\"name\": \"%s\", \"ms\": %.4f, \"children\": [", isFirstSibling ? "" : ",", 4 + (int32_t)node.depth * 2, "", node.name, node.time);
+
+        prevDepth = node.depth + 1;
+    }
+
+    for (; prevDepth > 0; prevDepth--)
+        fprintf(file, "]}");
+
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+
+    return true;
+}
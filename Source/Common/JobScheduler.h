@@ -0,0 +1,184 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+typedef std::function<void(uint32_t jobIndex)> JobFunc;
+typedef std::function<void(uint32_t begin, uint32_t end)> RangeFunc;
+
+// Counts jobs which are not finished yet, "Wait" blocks until it reaches 0. The counter can be destroyed once "Wait" returns
+struct JobCounter {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic_uint32_t pendingNum = {0};
+};
+
+struct Job {
+    const JobFunc* func;
+    JobCounter* counter;
+    uint32_t index;
+};
+
+// Workers sleep on a condition variable while there is nothing to do (no spinning)
+class JobScheduler {
+public:
+    ~JobScheduler() {
+        Shutdown();
+    }
+
+    void Initialize(uint32_t workerNum);
+    void Shutdown();
+
+    // "func" must stay alive until "Wait" returns
+    void Submit(const JobFunc& func, uint32_t baseJobIndex, uint32_t jobNum, JobCounter& counter);
+    void Wait(JobCounter& counter);
+
+    // Executes one queued job on the calling thread, returns "false" if the queue is empty
+    bool TryExecute();
+
+    // Splits "[0; itemNum)" into one contiguous slice per thread and returns when all slices are processed. The calling
+    // thread takes a share while waiting
+    void ParallelFor(uint32_t itemNum, const RangeFunc& func);
+
+    inline uint32_t GetWorkerNum() const {
+        return (uint32_t)m_Workers.size();
+    }
+
+    inline std::thread::native_handle_type GetWorkerHandle(uint32_t workerIndex) {
+        return m_Workers[workerIndex].native_handle();
+    }
+
+private:
+    void WorkerEntryPoint();
+    void Execute(const Job& job);
+    bool TryPop(Job& job);
+
+private:
+    std::vector<std::thread> m_Workers;
+    std::deque<Job> m_Jobs;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    bool m_IsStopped = false;
+};
+
+inline void JobScheduler::Initialize(uint32_t workerNum) {
+    m_IsStopped = false;
+
+    m_Workers.reserve(workerNum);
+    for (uint32_t i = 0; i < workerNum; i++)
+        m_Workers.emplace_back(&JobScheduler::WorkerEntryPoint, this);
+}
+
+inline void JobScheduler::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_IsStopped = true;
+    }
+    m_Condition.notify_all();
+
+    for (std::thread& worker : m_Workers)
+        worker.join();
+
+    m_Workers.clear();
+    m_Jobs.clear();
+}
+
+inline void JobScheduler::Submit(const JobFunc& func, uint32_t baseJobIndex, uint32_t jobNum, JobCounter& counter) {
+    if (!jobNum)
+        return;
+
+    counter.pendingNum.fetch_add(jobNum, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (uint32_t i = 0; i < jobNum; i++)
+            m_Jobs.push_back({&func, &counter, baseJobIndex + i});
+    }
+
+    if (jobNum == 1)
+        m_Condition.notify_one();
+    else
+        m_Condition.notify_all();
+}
+
+inline void JobScheduler::Wait(JobCounter& counter) {
+    // Help with the remaining jobs instead of sleeping right away
+    while (counter.pendingNum.load(std::memory_order_acquire) != 0 && TryExecute())
+        ;
+
+    std::unique_lock<std::mutex> lock(counter.mutex);
+    counter.condition.wait(lock, [&counter] { return counter.pendingNum.load(std::memory_order_acquire) == 0; });
+}
+
+inline bool JobScheduler::TryExecute() {
+    Job job = {};
+    if (!TryPop(job))
+        return false;
+
+    Execute(job);
+
+    return true;
+}
+
+inline void JobScheduler::ParallelFor(uint32_t itemNum, const RangeFunc& func) {
+    const uint32_t jobNum = 1 + GetWorkerNum();
+    const uint32_t itemsPerJob = (itemNum + jobNum - 1) / jobNum;
+
+    const JobFunc job = [&](uint32_t jobIndex) {
+        const uint32_t begin = jobIndex * itemsPerJob;
+        const uint32_t end = begin + itemsPerJob < itemNum ? begin + itemsPerJob : itemNum;
+        if (begin < end)
+            func(begin, end);
+    };
+
+    JobCounter counter;
+    Submit(job, 0, jobNum, counter);
+    Wait(counter);
+}
+
+inline void JobScheduler::WorkerEntryPoint() {
+    while (true) {
+        Job job = {};
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Condition.wait(lock, [this] { return m_IsStopped || !m_Jobs.empty(); });
+
+            if (m_Jobs.empty())
+                break;
+
+            job = m_Jobs.front();
+            m_Jobs.pop_front();
+        }
+
+        Execute(job);
+    }
+}
+
+inline void JobScheduler::Execute(const Job& job) {
+    (*job.func)(job.index);
+
+    // Decrementing under the lock keeps "Wait" from returning (and the counter from being destroyed) before the notification is done
+    JobCounter& counter = *job.counter;
+    std::lock_guard<std::mutex> lock(counter.mutex);
+    if (counter.pendingNum.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        counter.condition.notify_all();
+}
+
+inline bool JobScheduler::TryPop(Job& job) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Jobs.empty())
+        return false;
+
+    job = m_Jobs.front();
+    m_Jobs.pop_front();
+
+    return true;
+}
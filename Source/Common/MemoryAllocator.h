@@ -0,0 +1,560 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include "NRI.h"
+
+#include "Extensions/NRIRayTracing.h"
+
+#include <stdint.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#    include <intrin.h>
+#endif
+
+struct MemoryAllocation {
+    nri::Memory* memory = nullptr;
+    uint64_t offset = 0;
+    uint32_t heapIndex = uint32_t(-1); // "-1" for dedicated allocations
+    uint32_t blockIndex = uint32_t(-1);
+};
+
+struct MemoryAllocatorStats {
+    uint64_t reservedSize; // heaps and dedicated allocations
+    uint64_t usedSize;
+    uint32_t heapNum;
+    uint32_t dedicatedAllocationNum;
+    uint32_t allocationNum; // resources bound
+    float fragmentation;    // [0; 1], the free memory part which is not in the largest free block of its heap
+};
+
+// TLSF sub-allocator. Heaps are allocated per memory type (buffers and textures never share a heap, which keeps
+// them apart for "bufferImageGranularity"), resources get offsets in them in O(1). The first heap of a kind is sized
+// from the request which needs it, next ones double up to "heapSize". Resources which must be dedicated or don't fit
+// well into a heap get their own allocation. A heap is released as soon as it becomes empty (e.g. upload heaps)
+class MemoryAllocator {
+public:
+    static constexpr uint64_t DEFAULT_HEAP_SIZE = 16 * 1024 * 1024;
+
+    void Initialize(nri::Device& device, uint64_t heapSize = DEFAULT_HEAP_SIZE);
+    void Destroy(nri::CoreInterface& NRI);
+
+    bool Allocate(nri::CoreInterface& NRI, const nri::MemoryDesc& memoryDesc, bool isTexture, MemoryAllocation& allocation);
+    void Free(nri::CoreInterface& NRI, MemoryAllocation& allocation); // after the resource is destroyed
+
+    bool AllocateAndBindBuffer(nri::CoreInterface& NRI, nri::Buffer& buffer, nri::MemoryLocation memoryLocation, MemoryAllocation& allocation);
+    bool AllocateAndBindTexture(nri::CoreInterface& NRI, nri::Texture& texture, nri::MemoryLocation memoryLocation, MemoryAllocation& allocation);
+    bool AllocateAndBindAccelerationStructure(nri::CoreInterface& NRI, nri::RayTracingInterface& rayTracing, nri::AccelerationStructure& accelerationStructure, MemoryAllocation& allocation);
+
+    MemoryAllocatorStats GetStats() const;
+
+private:
+    static constexpr uint32_t INVALID_INDEX = uint32_t(-1);
+    static constexpr uint32_t GRANULARITY_LOG2 = 8;
+    static constexpr uint64_t GRANULARITY = 1ull << GRANULARITY_LOG2;
+    static constexpr uint32_t SL_LOG2 = 4;
+    static constexpr uint32_t SL_NUM = 1 << SL_LOG2;
+    static constexpr uint32_t FL_SHIFT = SL_LOG2 + GRANULARITY_LOG2;
+    static constexpr uint64_t SMALL_BLOCK_SIZE = 1ull << FL_SHIFT;
+    static constexpr uint32_t FL_NUM = 32 - FL_SHIFT + 1; // heaps up to 2 Gb
+    static constexpr uint64_t HEAP_MAX_SIZE = 1ull << 31;
+    static constexpr uint64_t HEAP_MIN_SIZE = 256 * 1024;
+    static constexpr uint64_t HEAP_SIZE_PER_REQUEST = 4; // room for a few more resources of the same size
+
+    struct Block {
+        uint64_t offset;
+        uint64_t size;
+        uint32_t prevPhysical;
+        uint32_t nextPhysical;
+        uint32_t prevFree;
+        uint32_t nextFree;
+        bool isFree;
+    };
+
+    struct Heap {
+        std::vector<Block> blocks;
+        std::vector<uint32_t> unusedBlocks;
+        nri::Memory* memory; // "nullptr" if released, the slot is reused
+        nri::MemoryType type;
+        uint64_t size;
+        uint64_t freeSize;
+        uint32_t allocationNum;
+        uint32_t flBitmap;
+        uint32_t slBitmaps[FL_NUM];
+        uint32_t freeHeads[FL_NUM][SL_NUM];
+        bool isTexture;
+    };
+
+    static inline uint32_t FindLsb(uint32_t x) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return index;
+#else
+        return (uint32_t)__builtin_ctz(x);
+#endif
+    }
+
+    static inline uint32_t FindMsb(uint64_t x) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, x);
+        return index;
+#else
+        return 63 - (uint32_t)__builtin_clzll(x);
+#endif
+    }
+
+    static inline uint64_t AlignUp(uint64_t x, uint64_t alignment) {
+        return (x + alignment - 1) & ~(alignment - 1);
+    }
+
+    static inline uint64_t NextPow2(uint64_t x) {
+        return x > 1 ? 1ull << (FindMsb(x - 1) + 1) : 1;
+    }
+
+    static void Mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+    static uint32_t NewBlock(Heap& heap);
+    static void InsertFreeBlock(Heap& heap, uint32_t blockIndex);
+    static void RemoveFreeBlock(Heap& heap, uint32_t blockIndex);
+    static bool HeapAllocate(Heap& heap, uint64_t size, uint64_t alignment, uint32_t& blockIndex);
+    static void HeapFree(Heap& heap, uint32_t blockIndex);
+    static uint64_t GetLargestFreeBlockSize(const Heap& heap);
+
+    bool CreateHeap(nri::CoreInterface& NRI, nri::MemoryType type, bool isTexture, uint64_t requestSize, uint32_t& heapIndex);
+    bool AllocateInHeap(uint32_t heapIndex, uint64_t size, uint64_t alignment, MemoryAllocation& allocation);
+
+private:
+    std::vector<Heap> m_Heaps;
+    std::vector<nri::Memory*> m_DedicatedAllocations;
+    std::vector<uint64_t> m_DedicatedSizes;
+    nri::Device* m_Device = nullptr;
+    uint64_t m_HeapSize = DEFAULT_HEAP_SIZE;
+};
+
+inline void MemoryAllocator::Initialize(nri::Device& device, uint64_t heapSize) {
+    m_Device = &device;
+    m_HeapSize = AlignUp(heapSize < HEAP_MAX_SIZE ? heapSize : HEAP_MAX_SIZE, SMALL_BLOCK_SIZE);
+}
+
+inline void MemoryAllocator::Destroy(nri::CoreInterface& NRI) {
+    for (Heap& heap : m_Heaps) {
+        if (heap.memory)
+            NRI.FreeMemory(*heap.memory);
+    }
+
+    for (nri::Memory* memory : m_DedicatedAllocations)
+        NRI.FreeMemory(*memory);
+
+    m_Heaps.clear();
+    m_DedicatedAllocations.clear();
+    m_DedicatedSizes.clear();
+}
+
+inline void MemoryAllocator::Mapping(uint64_t size, uint32_t& fl, uint32_t& sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        fl = 0;
+        sl = (uint32_t)(size >> GRANULARITY_LOG2);
+    } else {
+        const uint32_t msb = FindMsb(size);
+        fl = msb - FL_SHIFT + 1;
+        sl = (uint32_t)(size >> (msb - SL_LOG2)) ^ SL_NUM;
+    }
+}
+
+inline uint32_t MemoryAllocator::NewBlock(Heap& heap) {
+    if (!heap.unusedBlocks.empty()) {
+        const uint32_t blockIndex = heap.unusedBlocks.back();
+        heap.unusedBlocks.pop_back();
+
+        return blockIndex;
+    }
+
+    heap.blocks.push_back({});
+
+    return (uint32_t)heap.blocks.size() - 1;
+}
+
+inline void MemoryAllocator::InsertFreeBlock(Heap& heap, uint32_t blockIndex) {
+    Block& block = heap.blocks[blockIndex];
+
+    uint32_t fl, sl;
+    Mapping(block.size, fl, sl);
+
+    const uint32_t head = heap.freeHeads[fl][sl];
+    if (head != INVALID_INDEX)
+        heap.blocks[head].prevFree = blockIndex;
+
+    block.isFree = true;
+    block.prevFree = INVALID_INDEX;
+    block.nextFree = head;
+
+    heap.freeHeads[fl][sl] = blockIndex;
+    heap.flBitmap |= 1u << fl;
+    heap.slBitmaps[fl] |= 1u << sl;
+}
+
+inline void MemoryAllocator::RemoveFreeBlock(Heap& heap, uint32_t blockIndex) {
+    Block& block = heap.blocks[blockIndex];
+
+    if (block.prevFree != INVALID_INDEX)
+        heap.blocks[block.prevFree].nextFree = block.nextFree;
+
+    if (block.nextFree != INVALID_INDEX)
+        heap.blocks[block.nextFree].prevFree = block.prevFree;
+
+    uint32_t fl, sl;
+    Mapping(block.size, fl, sl);
+
+    if (heap.freeHeads[fl][sl] == blockIndex) {
+        heap.freeHeads[fl][sl] = block.nextFree;
+
+        if (block.nextFree == INVALID_INDEX) {
+            heap.slBitmaps[fl] &= ~(1u << sl);
+            if (!heap.slBitmaps[fl])
+                heap.flBitmap &= ~(1u << fl);
+        }
+    }
+
+    block.isFree = false;
+}
+
+inline bool MemoryAllocator::HeapAllocate(Heap& heap, uint64_t size, uint64_t alignment, uint32_t& blockIndex) {
+    // Any block of the next size class fits the size and the worst alignment padding
+    uint64_t searchSize = size + alignment - GRANULARITY;
+    if (searchSize >= SMALL_BLOCK_SIZE)
+        searchSize += (1ull << (FindMsb(searchSize) - SL_LOG2)) - 1;
+
+    uint32_t fl, sl;
+    Mapping(searchSize, fl, sl);
+    if (fl >= FL_NUM)
+        return false;
+
+    uint32_t slBitmap = heap.slBitmaps[fl] & (~0u << sl);
+    if (!slBitmap) {
+        const uint32_t flBitmap = fl + 1 < FL_NUM ? heap.flBitmap & (~0u << (fl + 1)) : 0;
+        if (!flBitmap)
+            return false;
+
+        fl = FindLsb(flBitmap);
+        slBitmap = heap.slBitmaps[fl];
+    }
+
+    sl = FindLsb(slBitmap);
+    blockIndex = heap.freeHeads[fl][sl];
+    RemoveFreeBlock(heap, blockIndex);
+
+    // Leading padding goes back to the free lists (the previous block is never free)
+    const uint64_t padding = AlignUp(heap.blocks[blockIndex].offset, alignment) - heap.blocks[blockIndex].offset;
+    if (padding) {
+        const uint32_t paddingIndex = NewBlock(heap);
+        Block& block = heap.blocks[blockIndex];
+        Block& paddingBlock = heap.blocks[paddingIndex];
+
+        paddingBlock.offset = block.offset;
+        paddingBlock.size = padding;
+        paddingBlock.prevPhysical = block.prevPhysical;
+        paddingBlock.nextPhysical = blockIndex;
+
+        if (block.prevPhysical != INVALID_INDEX)
+            heap.blocks[block.prevPhysical].nextPhysical = paddingIndex;
+
+        block.prevPhysical = paddingIndex;
+        block.offset += padding;
+        block.size -= padding;
+
+        InsertFreeBlock(heap, paddingIndex);
+    }
+
+    // Same for the tail (the next block is never free)
+    const uint64_t remainder = heap.blocks[blockIndex].size - size;
+    if (remainder) {
+        const uint32_t remainderIndex = NewBlock(heap);
+        Block& block = heap.blocks[blockIndex];
+        Block& remainderBlock = heap.blocks[remainderIndex];
+
+        remainderBlock.offset = block.offset + size;
+        remainderBlock.size = remainder;
+        remainderBlock.prevPhysical = blockIndex;
+        remainderBlock.nextPhysical = block.nextPhysical;
+
+        if (block.nextPhysical != INVALID_INDEX)
+            heap.blocks[block.nextPhysical].prevPhysical = remainderIndex;
+
+        block.nextPhysical = remainderIndex;
+        block.size = size;
+
+        InsertFreeBlock(heap, remainderIndex);
+    }
+
+    heap.freeSize -= size;
+    heap.allocationNum++;
+
+    return true;
+}
+
+inline void MemoryAllocator::HeapFree(Heap& heap, uint32_t blockIndex) {
+    heap.freeSize += heap.blocks[blockIndex].size;
+    heap.allocationNum--;
+
+    // Merge with free neighbors
+    const uint32_t nextIndex = heap.blocks[blockIndex].nextPhysical;
+    if (nextIndex != INVALID_INDEX && heap.blocks[nextIndex].isFree) {
+        RemoveFreeBlock(heap, nextIndex);
+
+        Block& block = heap.blocks[blockIndex];
+        const Block& next = heap.blocks[nextIndex];
+
+        block.size += next.size;
+        block.nextPhysical = next.nextPhysical;
+
+        if (next.nextPhysical != INVALID_INDEX)
+            heap.blocks[next.nextPhysical].prevPhysical = blockIndex;
+
+        heap.unusedBlocks.push_back(nextIndex);
+    }
+
+    const uint32_t prevIndex = heap.blocks[blockIndex].prevPhysical;
+    if (prevIndex != INVALID_INDEX && heap.blocks[prevIndex].isFree) {
+        RemoveFreeBlock(heap, prevIndex);
+
+        Block& prev = heap.blocks[prevIndex];
+        const Block& block = heap.blocks[blockIndex];
+
+        prev.size += block.size;
+        prev.nextPhysical = block.nextPhysical;
+
+        if (block.nextPhysical != INVALID_INDEX)
+            heap.blocks[block.nextPhysical].prevPhysical = prevIndex;
+
+        heap.unusedBlocks.push_back(blockIndex);
+        blockIndex = prevIndex;
+    }
+
+    InsertFreeBlock(heap, blockIndex);
+}
+
+inline uint64_t MemoryAllocator::GetLargestFreeBlockSize(const Heap& heap) {
+    if (!heap.flBitmap)
+        return 0;
+
+    // Only the highest non-empty list needs to be checked
+    const uint32_t fl = FindMsb(heap.flBitmap);
+    const uint32_t sl = FindMsb(heap.slBitmaps[fl]);
+
+    uint64_t largestSize = 0;
+    for (uint32_t i = heap.freeHeads[fl][sl]; i != INVALID_INDEX; i = heap.blocks[i].nextFree)
+        largestSize = heap.blocks[i].size > largestSize ? heap.blocks[i].size : largestSize;
+
+    return largestSize;
+}
+
+inline bool MemoryAllocator::CreateHeap(nri::CoreInterface& NRI, nri::MemoryType type, bool isTexture, uint64_t requestSize, uint32_t& heapIndex) {
+    // Released slots are reused
+    heapIndex = INVALID_INDEX;
+    uint64_t prevHeapSize = 0;
+
+    for (uint32_t i = 0; i < (uint32_t)m_Heaps.size(); i++) {
+        const Heap& heap = m_Heaps[i];
+        if (!heap.memory) {
+            if (heapIndex == INVALID_INDEX)
+                heapIndex = i;
+        } else if (heap.type == type && heap.isTexture == isTexture)
+            prevHeapSize = heap.size > prevHeapSize ? heap.size : prevHeapSize;
+    }
+
+    // Power of 2 sizes are multiples of "SMALL_BLOCK_SIZE", "requestSize" is not bigger than "m_HeapSize / 2"
+    const uint64_t requestHeapSize = NextPow2(requestSize) * HEAP_SIZE_PER_REQUEST;
+    uint64_t heapSize = prevHeapSize * 2 > requestHeapSize ? prevHeapSize * 2 : requestHeapSize;
+    heapSize = heapSize > HEAP_MIN_SIZE ? heapSize : HEAP_MIN_SIZE;
+    heapSize = heapSize < m_HeapSize ? heapSize : m_HeapSize;
+
+    nri::AllocateMemoryDesc allocateMemoryDesc = {};
+    allocateMemoryDesc.size = heapSize;
+    allocateMemoryDesc.type = type;
+
+    nri::Memory* memory = nullptr;
+    if (NRI.AllocateMemory(*m_Device, allocateMemoryDesc, memory) != nri::Result::SUCCESS)
+        return false;
+
+    if (heapIndex == INVALID_INDEX) {
+        heapIndex = (uint32_t)m_Heaps.size();
+        m_Heaps.push_back({});
+    }
+
+    Heap& heap = m_Heaps[heapIndex];
+    heap.blocks.clear();
+    heap.unusedBlocks.clear();
+    heap.memory = memory;
+    heap.type = type;
+    heap.size = heapSize;
+    heap.freeSize = heapSize;
+    heap.allocationNum = 0;
+    heap.flBitmap = 0;
+    heap.isTexture = isTexture;
+
+    for (uint32_t fl = 0; fl < FL_NUM; fl++) {
+        heap.slBitmaps[fl] = 0;
+
+        for (uint32_t sl = 0; sl < SL_NUM; sl++)
+            heap.freeHeads[fl][sl] = INVALID_INDEX;
+    }
+
+    heap.blocks.push_back({0, heapSize, INVALID_INDEX, INVALID_INDEX, INVALID_INDEX, INVALID_INDEX, false});
+    InsertFreeBlock(heap, 0);
+
+    return true;
+}
+
+inline bool MemoryAllocator::Allocate(nri::CoreInterface& NRI, const nri::MemoryDesc& memoryDesc, bool isTexture, MemoryAllocation& allocation) {
+    allocation = {};
+
+    const uint64_t size = AlignUp(memoryDesc.size, GRANULARITY);
+    const uint64_t alignment = memoryDesc.alignment > GRANULARITY ? memoryDesc.alignment : GRANULARITY;
+
+    // Dedicated
+    if (memoryDesc.mustBeDedicated || size + alignment - GRANULARITY > m_HeapSize / 2) {
+        nri::AllocateMemoryDesc allocateMemoryDesc = {};
+        allocateMemoryDesc.size = memoryDesc.size;
+        allocateMemoryDesc.type = memoryDesc.type;
+
+        if (NRI.AllocateMemory(*m_Device, allocateMemoryDesc, allocation.memory) != nri::Result::SUCCESS)
+            return false;
+
+        m_DedicatedAllocations.push_back(allocation.memory);
+        m_DedicatedSizes.push_back(memoryDesc.size);
+
+        return true;
+    }
+
+    // Sub-allocation, a new heap is created if existing ones are full
+    for (uint32_t i = 0; i < (uint32_t)m_Heaps.size(); i++) {
+        const Heap& heap = m_Heaps[i];
+        if (heap.memory && heap.type == memoryDesc.type && heap.isTexture == isTexture && heap.freeSize >= size && AllocateInHeap(i, size, alignment, allocation))
+            return true;
+    }
+
+    uint32_t heapIndex = INVALID_INDEX;
+    if (!CreateHeap(NRI, memoryDesc.type, isTexture, size + alignment - GRANULARITY, heapIndex))
+        return false;
+
+    return AllocateInHeap(heapIndex, size, alignment, allocation);
+}
+
+inline bool MemoryAllocator::AllocateInHeap(uint32_t heapIndex, uint64_t size, uint64_t alignment, MemoryAllocation& allocation) {
+    Heap& heap = m_Heaps[heapIndex];
+
+    uint32_t blockIndex = INVALID_INDEX;
+    if (!HeapAllocate(heap, size, alignment, blockIndex))
+        return false;
+
+    allocation.memory = heap.memory;
+    allocation.offset = heap.blocks[blockIndex].offset;
+    allocation.heapIndex = heapIndex;
+    allocation.blockIndex = blockIndex;
+
+    return true;
+}
+
+inline void MemoryAllocator::Free(nri::CoreInterface& NRI, MemoryAllocation& allocation) {
+    if (!allocation.memory)
+        return;
+
+    if (allocation.heapIndex != INVALID_INDEX) {
+        Heap& heap = m_Heaps[allocation.heapIndex];
+        HeapFree(heap, allocation.blockIndex);
+
+        // Short-lived upload and scratch buffers don't pin their heaps until "Destroy"
+        if (!heap.allocationNum) {
+            NRI.FreeMemory(*heap.memory);
+
+            heap.memory = nullptr;
+            heap.blocks.clear();
+            heap.blocks.shrink_to_fit();
+            heap.unusedBlocks.clear();
+            heap.unusedBlocks.shrink_to_fit();
+        }
+    } else {
+        for (size_t i = 0; i < m_DedicatedAllocations.size(); i++) {
+            if (m_DedicatedAllocations[i] == allocation.memory) {
+                m_DedicatedAllocations[i] = m_DedicatedAllocations.back();
+                m_DedicatedAllocations.pop_back();
+                m_DedicatedSizes[i] = m_DedicatedSizes.back();
+                m_DedicatedSizes.pop_back();
+                break;
+            }
+        }
+
+        NRI.FreeMemory(*allocation.memory);
+    }
+
+    allocation = {};
+}
+
+inline bool MemoryAllocator::AllocateAndBindBuffer(nri::CoreInterface& NRI, nri::Buffer& buffer, nri::MemoryLocation memoryLocation, MemoryAllocation& allocation) {
+    nri::MemoryDesc memoryDesc = {};
+    NRI.GetBufferMemoryDesc(buffer, memoryLocation, memoryDesc);
+
+    if (!Allocate(NRI, memoryDesc, false, allocation))
+        return false;
+
+    const nri::BufferMemoryBindingDesc bufferMemoryBindingDesc = {allocation.memory, &buffer, allocation.offset};
+
+    return NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1) == nri::Result::SUCCESS;
+}
+
+inline bool MemoryAllocator::AllocateAndBindTexture(nri::CoreInterface& NRI, nri::Texture& texture, nri::MemoryLocation memoryLocation, MemoryAllocation& allocation) {
+    nri::MemoryDesc memoryDesc = {};
+    NRI.GetTextureMemoryDesc(texture, memoryLocation, memoryDesc);
+
+    if (!Allocate(NRI, memoryDesc, true, allocation))
+        return false;
+
+    const nri::TextureMemoryBindingDesc textureMemoryBindingDesc = {allocation.memory, &texture, allocation.offset};
+
+    return NRI.BindTextureMemory(*m_Device, &textureMemoryBindingDesc, 1) == nri::Result::SUCCESS;
+}
+
+inline bool MemoryAllocator::AllocateAndBindAccelerationStructure(nri::CoreInterface& NRI, nri::RayTracingInterface& rayTracing, nri::AccelerationStructure& accelerationStructure, MemoryAllocation& allocation) {
+    nri::MemoryDesc memoryDesc = {};
+    rayTracing.GetAccelerationStructureMemoryDesc(accelerationStructure, nri::MemoryLocation::DEVICE, memoryDesc);
+
+    // Acceleration structures are buffers
+    if (!Allocate(NRI, memoryDesc, false, allocation))
+        return false;
+
+    const nri::AccelerationStructureMemoryBindingDesc accelerationStructureMemoryBindingDesc = {allocation.memory, &accelerationStructure, allocation.offset};
+
+    return rayTracing.BindAccelerationStructureMemory(*m_Device, &accelerationStructureMemoryBindingDesc, 1) == nri::Result::SUCCESS;
+}
+
+inline MemoryAllocatorStats MemoryAllocator::GetStats() const {
+    MemoryAllocatorStats stats = {};
+    stats.dedicatedAllocationNum = (uint32_t)m_DedicatedAllocations.size();
+    stats.allocationNum = stats.dedicatedAllocationNum;
+
+    uint64_t freeSize = 0;
+    uint64_t fragmentedSize = 0;
+    for (const Heap& heap : m_Heaps) {
+        if (!heap.memory)
+            continue;
+
+        stats.heapNum++;
+        stats.reservedSize += heap.size;
+        stats.usedSize += heap.size - heap.freeSize;
+        stats.allocationNum += heap.allocationNum;
+
+        freeSize += heap.freeSize;
+        fragmentedSize += heap.freeSize - GetLargestFreeBlockSize(heap);
+    }
+
+    for (uint64_t size : m_DedicatedSizes) {
+        stats.reservedSize += size;
+        stats.usedSize += size;
+    }
+
+    stats.fragmentation = freeSize ? float(double(fragmentedSize) / double(freeSize)) : 0.0f;
+
+    return stats;
+}
@@ -0,0 +1,151 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include "NRI.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Each frame writes its own slot of queries and readback memory. A slot is read only after the frame fence reports that
+// the frame is finished. "frameInFlightNum + 1" slots guarantee that the latest finished frame is not overwritten by a frame in flight
+class QueryReadbackRing {
+public:
+    bool Initialize(nri::CoreInterface& NRI, nri::Device& device, nri::QueryType queryType, uint32_t queryNum, uint32_t frameInFlightNum);
+    void Destroy(nri::CoreInterface& NRI);
+
+    // Recording, "queryIndex" is relative to the frame slot
+    void CmdResetQueries(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, uint32_t frameIndex, uint32_t queryIndex, uint32_t queryNum);
+    void CmdCopyQueries(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, uint32_t frameIndex, uint32_t queryIndex, uint32_t queryNum);
+
+    // Must be called for every frame which writes queries, "queryNum" is the number of queries to read back
+    void SetFrameQueryNum(uint32_t frameIndex, uint32_t queryNum);
+
+    // Copies results of the latest finished frame (the fence is signaled with "1 + frameIndex"), never waits. Returns "true" if results got updated
+    bool Update(nri::CoreInterface& NRI, nri::Fence& frameFence);
+
+    inline uint32_t GetQueryIndex(uint32_t frameIndex, uint32_t queryIndex) const {
+        return (frameIndex % (uint32_t)m_SlotFrames.size()) * m_QueryNum + queryIndex;
+    }
+
+    inline nri::QueryPool& GetQueryPool() {
+        return *m_QueryPool;
+    }
+
+    template <typename T>
+    inline const T* GetResults() const {
+        return (const T*)m_Results.data();
+    }
+
+    inline uint32_t GetResultNum() const {
+        return m_ResultNum;
+    }
+
+    // Frame which produced the current results
+    inline uint64_t GetResultFrameIndex() const {
+        return m_LastReadFrame;
+    }
+
+private:
+    std::vector<uint8_t> m_Results;
+    std::vector<uint32_t> m_SlotFrames;
+    std::vector<uint32_t> m_SlotQueryNums;
+    nri::QueryPool* m_QueryPool = nullptr;
+    nri::Buffer* m_Buffer = nullptr;
+    nri::Memory* m_Memory = nullptr;
+    uint64_t m_LastReadFrame = uint64_t(-1);
+    uint32_t m_QueryNum = 0;
+    uint32_t m_QuerySize = 0;
+    uint32_t m_ResultNum = 0;
+};
+
+inline bool QueryReadbackRing::Initialize(nri::CoreInterface& NRI, nri::Device& device, nri::QueryType queryType, uint32_t queryNum, uint32_t frameInFlightNum) {
+    const uint32_t slotNum = frameInFlightNum + 1;
+
+    m_QueryNum = queryNum;
+    m_SlotFrames.resize(slotNum, uint32_t(-1));
+    m_SlotQueryNums.resize(slotNum, 0);
+
+    nri::QueryPoolDesc queryPoolDesc = {};
+    queryPoolDesc.queryType = queryType;
+    queryPoolDesc.capacity = queryNum * slotNum;
+
+    if (NRI.CreateQueryPool(device, queryPoolDesc, m_QueryPool) != nri::Result::SUCCESS)
+        return false;
+
+    m_QuerySize = NRI.GetQuerySize(*m_QueryPool);
+    m_Results.resize(m_QuerySize * queryNum, 0);
+
+    nri::BufferDesc bufferDesc = {};
+    bufferDesc.size = m_QuerySize * queryNum * slotNum;
+    bufferDesc.usage = nri::BufferUsageBits::NONE;
+
+    if (NRI.CreateBuffer(device, bufferDesc, m_Buffer) != nri::Result::SUCCESS)
+        return false;
+
+    nri::ResourceGroupDesc resourceGroupDesc = {};
+    resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
+    resourceGroupDesc.bufferNum = 1;
+    resourceGroupDesc.buffers = &m_Buffer;
+
+    return NRI.AllocateAndBindMemory(device, resourceGroupDesc, &m_Memory) == nri::Result::SUCCESS;
+}
+
+inline void QueryReadbackRing::Destroy(nri::CoreInterface& NRI) {
+    if (m_Buffer)
+        NRI.DestroyBuffer(*m_Buffer);
+
+    if (m_Memory)
+        NRI.FreeMemory(*m_Memory);
+
+    if (m_QueryPool)
+        NRI.DestroyQueryPool(*m_QueryPool);
+
+    m_Buffer = nullptr;
+    m_Memory = nullptr;
+    m_QueryPool = nullptr;
+}
+
+inline void QueryReadbackRing::CmdResetQueries(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, uint32_t frameIndex, uint32_t queryIndex, uint32_t queryNum) {
+    NRI.CmdResetQueries(commandBuffer, *m_QueryPool, GetQueryIndex(frameIndex, queryIndex), queryNum);
+}
+
+inline void QueryReadbackRing::CmdCopyQueries(nri::CoreInterface& NRI, nri::CommandBuffer& commandBuffer, uint32_t frameIndex, uint32_t queryIndex, uint32_t queryNum) {
+    const uint32_t offset = GetQueryIndex(frameIndex, queryIndex);
+    NRI.CmdCopyQueries(commandBuffer, *m_QueryPool, offset, queryNum, *m_Buffer, (uint64_t)offset * m_QuerySize);
+}
+
+inline void QueryReadbackRing::SetFrameQueryNum(uint32_t frameIndex, uint32_t queryNum) {
+    const uint32_t slot = frameIndex % (uint32_t)m_SlotFrames.size();
+
+    m_SlotFrames[slot] = frameIndex;
+    m_SlotQueryNums[slot] = queryNum;
+}
+
+inline bool QueryReadbackRing::Update(nri::CoreInterface& NRI, nri::Fence& frameFence) {
+    const uint64_t finishedFrameNum = NRI.GetFenceValue(frameFence);
+    if (!finishedFrameNum || finishedFrameNum - 1 == m_LastReadFrame)
+        return false;
+
+    // Frames are not necessarily finished one by one, only the latest one matters
+    const uint32_t frameIndex = (uint32_t)(finishedFrameNum - 1);
+    const uint32_t slot = frameIndex % (uint32_t)m_SlotFrames.size();
+    if (m_SlotFrames[slot] != frameIndex)
+        return false;
+
+    const uint64_t size = (uint64_t)m_SlotQueryNums[slot] * m_QuerySize;
+    if (size) {
+        const void* data = NRI.MapBuffer(*m_Buffer, (uint64_t)slot * m_QueryNum * m_QuerySize, size);
+        if (!data)
+            return false;
+
+        memcpy(m_Results.data(), data, (size_t)size);
+        NRI.UnmapBuffer(*m_Buffer);
+    }
+
+    m_LastReadFrame = frameIndex;
+    m_ResultNum = m_SlotQueryNums[slot];
+
+    return true;
+}
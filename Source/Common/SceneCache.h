@@ -0,0 +1,578 @@
+// © 2021 NVIDIA Corporation
+
+#pragma once
+
+#include "NRIFramework.h"
+
+#include "JobScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+// Scene chunks are copied as is
+static_assert(std::is_trivially_copyable<utils::Vertex>::value, "Unexpected 'utils::Vertex'");
+static_assert(std::is_trivially_copyable<utils::Mesh>::value, "Unexpected 'utils::Mesh'");
+static_assert(std::is_trivially_copyable<utils::MeshInstance>::value, "Unexpected 'utils::MeshInstance'");
+static_assert(std::is_trivially_copyable<utils::Instance>::value, "Unexpected 'utils::Instance'");
+static_assert(std::is_trivially_copyable<utils::Material>::value, "Unexpected 'utils::Material'");
+
+// Preprocessed static scenes ("allowUpdate = false"). On the first load the scene is parsed by "utils::LoadScene" and
+// written to "<scene>.cache" next to it. Next loads map the cache: vertices and indices are used in place (no copies,
+// the pointers go straight to "BufferUploadDesc"), small arrays are copied, textures are decoded by jobs in the
+// background. The cache is rebuilt if the scene file or the layout of the packed structures changes
+class SceneCache {
+public:
+    static constexpr uint32_t MAGIC = 0x4353524E; // "NRSC"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t TEXTURE_BATCH_MIN_NUM = 16;
+
+    ~SceneCache() {
+        Release();
+    }
+
+    // Returns before textures are decoded, "jobScheduler" must stay alive until "UploadTextures" or "Release"
+    bool Load(const std::string& sceneFile, utils::Scene& scene, JobScheduler& jobScheduler);
+
+    // Creates scene textures (appended to "textures" in scene order) and uploads them in batches, as soon as they are
+    // decoded. Each batch gets its own memory, the upload of a batch overlaps with decoding of the next ones
+    bool UploadTextures(nri::CoreInterface& NRI, nri::HelperInterface& helperInterface, nri::Device& device, nri::Queue& queue,
+        std::vector<nri::Texture*>& textures, std::vector<nri::Memory*>& memoryAllocations);
+
+    // Geometry data is not needed after the upload
+    void Release();
+
+    inline bool IsLoadedFromCache() const {
+        return m_MappedData != nullptr;
+    }
+
+    // Valid until "Release" or "utils::Scene::UnloadGeometryData"
+    inline const void* GetVertexData() const {
+        return m_Vertices;
+    }
+
+    inline uint64_t GetVertexDataSize() const {
+        return m_VertexDataSize;
+    }
+
+    inline const void* GetIndexData() const {
+        return m_Indices;
+    }
+
+    inline uint64_t GetIndexDataSize() const {
+        return m_IndexDataSize;
+    }
+
+private:
+    enum TextureState : uint32_t {
+        TEXTURE_PENDING,
+        TEXTURE_READY,
+        TEXTURE_FAILED
+    };
+
+    enum Chunk : uint32_t {
+        VERTICES,
+        INDICES,
+        MESHES,
+        MESH_INSTANCES,
+        INSTANCES,
+        MATERIALS,
+        TEXTURE_PATHS, // null-terminated strings
+
+        CHUNK_NUM
+    };
+
+    struct ChunkDesc {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t num;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint32_t elementSizes[CHUNK_NUM];
+        float4x4 mSceneToWorld;
+        cBoxf aabb;
+        ChunkDesc chunks[CHUNK_NUM];
+    };
+
+    // Chunks start at aligned offsets (the mapping is page aligned)
+    static constexpr uint64_t CHUNK_ALIGNMENT = 256;
+
+    static inline void GetElementSizes(uint32_t* elementSizes) {
+        elementSizes[VERTICES] = sizeof(utils::Vertex);
+        elementSizes[INDICES] = sizeof(utils::Index);
+        elementSizes[MESHES] = sizeof(utils::Mesh);
+        elementSizes[MESH_INSTANCES] = sizeof(utils::MeshInstance);
+        elementSizes[INSTANCES] = sizeof(utils::Instance);
+        elementSizes[MATERIALS] = sizeof(utils::Material);
+        elementSizes[TEXTURE_PATHS] = sizeof(char);
+    }
+
+    bool Read(const std::string& cacheFile, uint64_t sourceSize, int64_t sourceTime, utils::Scene& scene);
+    static bool Write(const std::string& cacheFile, uint64_t sourceSize, int64_t sourceTime, const utils::Scene& scene);
+
+    bool Map(const std::string& path);
+    void Unmap();
+
+    void DecodeTexture(uint32_t textureIndex);
+    bool WaitForTexture(uint32_t textureIndex);
+
+    static inline uint64_t GetTimeStamp() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    JobScheduler* m_JobScheduler = nullptr;
+    std::unique_ptr<JobCounter[]> m_TextureCounters; // one per texture, to wait for a specific one
+    JobFunc m_DecodeTextureJob;
+    std::vector<utils::Texture*> m_Textures;
+    std::vector<const char*> m_TexturePaths; // in the mapping
+    std::unique_ptr<std::atomic_uint32_t[]> m_TextureStates;
+    std::atomic_uint64_t m_DecodingEnd = {0};
+    uint64_t m_LoadBegin = 0;
+    uint64_t m_LoadEnd = 0;
+    const void* m_Vertices = nullptr;
+    const void* m_Indices = nullptr;
+    uint64_t m_VertexDataSize = 0;
+    uint64_t m_IndexDataSize = 0;
+    const uint8_t* m_MappedData = nullptr;
+    uint64_t m_MappedSize = 0;
+};
+
+inline bool SceneCache::Load(const std::string& sceneFile, utils::Scene& scene, JobScheduler& jobScheduler) {
+    Release();
+
+    m_JobScheduler = &jobScheduler;
+    m_LoadBegin = GetTimeStamp();
+
+    std::error_code error;
+    const uint64_t sourceSize = (uint64_t)std::filesystem::file_size(sceneFile, error);
+    if (error)
+        return false;
+
+    const int64_t sourceTime = (int64_t)std::filesystem::last_write_time(sceneFile, error).time_since_epoch().count();
+    if (error)
+        return false;
+
+    const std::string cacheFile = sceneFile + ".cache";
+    if (Read(cacheFile, sourceSize, sourceTime, scene)) {
+        m_LoadEnd = GetTimeStamp();
+        return true;
+    }
+
+    // Textures get decoded by the parser
+    if (!utils::LoadScene(sceneFile, scene, false))
+        return false;
+
+    m_LoadEnd = GetTimeStamp();
+    m_DecodingEnd.store(m_LoadEnd, std::memory_order_relaxed);
+
+    m_Textures = scene.textures;
+    m_TextureStates = std::make_unique<std::atomic_uint32_t[]>(m_Textures.size());
+    for (size_t i = 0; i < m_Textures.size(); i++)
+        m_TextureStates[i].store(TEXTURE_READY, std::memory_order_relaxed);
+
+    // Not fatal, the data folder can be read-only
+    if (!Write(cacheFile, sourceSize, sourceTime, scene))
+        printf("WARNING: Can't write scene cache '%s'\n", cacheFile.c_str());
+
+    m_Vertices = scene.vertices.data();
+    m_Indices = scene.indices.data();
+    m_VertexDataSize = helper::GetByteSizeOf(scene.vertices);
+    m_IndexDataSize = helper::GetByteSizeOf(scene.indices);
+
+    return true;
+}
+
+inline void SceneCache::Release() {
+    // Texture paths point to the mapping
+    if (m_JobScheduler && m_TextureCounters) {
+        for (size_t i = 0; i < m_Textures.size(); i++)
+            m_JobScheduler->Wait(m_TextureCounters[i]);
+    }
+
+    Unmap();
+
+    m_JobScheduler = nullptr;
+    m_DecodingEnd.store(0, std::memory_order_relaxed);
+    m_Textures.clear();
+    m_TexturePaths.clear();
+    m_TextureStates.reset();
+    m_TextureCounters.reset();
+
+    m_Vertices = nullptr;
+    m_Indices = nullptr;
+    m_VertexDataSize = 0;
+    m_IndexDataSize = 0;
+}
+
+inline bool SceneCache::Read(const std::string& cacheFile, uint64_t sourceSize, int64_t sourceTime, utils::Scene& scene) {
+    if (!Map(cacheFile))
+        return false;
+
+    // The mapping is page aligned
+    const Header& header = *(const Header*)m_MappedData;
+
+    bool isValid = m_MappedSize >= sizeof(header);
+    if (isValid) {
+        uint32_t elementSizes[CHUNK_NUM] = {};
+        GetElementSizes(elementSizes);
+
+        isValid = header.magic == MAGIC && header.version == VERSION && header.sourceSize == sourceSize && header.sourceTime == sourceTime;
+        isValid = isValid && memcmp(header.elementSizes, elementSizes, sizeof(elementSizes)) == 0;
+
+        for (uint32_t i = 0; i < CHUNK_NUM && isValid; i++) {
+            const ChunkDesc& chunk = header.chunks[i];
+            isValid = chunk.offset <= m_MappedSize && chunk.size <= m_MappedSize - chunk.offset && chunk.size == chunk.num * elementSizes[i];
+        }
+
+        const ChunkDesc& texturePaths = header.chunks[TEXTURE_PATHS];
+        isValid = isValid && (texturePaths.size == 0 || m_MappedData[texturePaths.offset + texturePaths.size - 1] == '\0');
+    }
+
+    if (!isValid) {
+        Unmap();
+        return false;
+    }
+
+    // Decoding happens later, only missing files can still make the cache unusable
+    const char* path = (const char*)m_MappedData + header.chunks[TEXTURE_PATHS].offset;
+    const char* pathsEnd = path + header.chunks[TEXTURE_PATHS].size;
+
+    for (; path < pathsEnd; path += strlen(path) + 1) {
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(path, error)) {
+            m_TexturePaths.clear();
+            Unmap();
+            return false;
+        }
+
+        m_TexturePaths.push_back(path);
+    }
+
+    const uint32_t textureNum = (uint32_t)m_TexturePaths.size();
+
+    m_Textures.resize(textureNum);
+    m_TextureStates = std::make_unique<std::atomic_uint32_t[]>(textureNum);
+    for (uint32_t i = 0; i < textureNum; i++) {
+        m_Textures[i] = new utils::Texture;
+        m_TextureStates[i].store(TEXTURE_PENDING, std::memory_order_relaxed);
+    }
+
+    scene.textures.insert(scene.textures.end(), m_Textures.begin(), m_Textures.end());
+
+    m_DecodeTextureJob = [this](uint32_t textureIndex) { DecodeTexture(textureIndex); };
+    m_TextureCounters = std::make_unique<JobCounter[]>(textureNum);
+    for (uint32_t i = 0; i < textureNum; i++)
+        m_JobScheduler->Submit(m_DecodeTextureJob, i, 1, m_TextureCounters[i]);
+
+    // Small arrays
+    const auto copyChunk = [&](auto& dst, Chunk chunk) {
+        dst.resize((size_t)header.chunks[chunk].num);
+        if (header.chunks[chunk].size)
+            memcpy(dst.data(), m_MappedData + header.chunks[chunk].offset, (size_t)header.chunks[chunk].size);
+    };
+
+    copyChunk(scene.meshes, MESHES);
+    copyChunk(scene.meshInstances, MESH_INSTANCES);
+    copyChunk(scene.instances, INSTANCES);
+    copyChunk(scene.materials, MATERIALS);
+
+    scene.mSceneToWorld = header.mSceneToWorld;
+    scene.aabb = header.aabb;
+
+    // Geometry is used in place
+    m_Vertices = m_MappedData + header.chunks[VERTICES].offset;
+    m_Indices = m_MappedData + header.chunks[INDICES].offset;
+    m_VertexDataSize = header.chunks[VERTICES].size;
+    m_IndexDataSize = header.chunks[INDICES].size;
+
+    return true;
+}
+
+inline bool SceneCache::Write(const std::string& cacheFile, uint64_t sourceSize, int64_t sourceTime, const utils::Scene& scene) {
+    // Textures are referenced by path, in-memory textures can't be cached
+    std::string texturePaths;
+    for (const utils::Texture* texture : scene.textures) {
+        std::error_code error;
+        if (texture->name.empty() || !std::filesystem::is_regular_file(texture->name, error))
+            return false;
+
+        texturePaths.append(texture->name.c_str(), texture->name.size() + 1);
+    }
+
+    Header header = {};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+    header.mSceneToWorld = scene.mSceneToWorld;
+    header.aabb = scene.aabb;
+    GetElementSizes(header.elementSizes);
+
+    const void* chunkData[CHUNK_NUM] = {
+        scene.vertices.data(),
+        scene.indices.data(),
+        scene.meshes.data(),
+        scene.meshInstances.data(),
+        scene.instances.data(),
+        scene.materials.data(),
+        texturePaths.data(),
+    };
+
+    const uint64_t chunkNum[CHUNK_NUM] = {
+        scene.vertices.size(),
+        scene.indices.size(),
+        scene.meshes.size(),
+        scene.meshInstances.size(),
+        scene.instances.size(),
+        scene.materials.size(),
+        texturePaths.size(),
+    };
+
+    uint64_t offset = helper::Align((uint64_t)sizeof(header), CHUNK_ALIGNMENT);
+    for (uint32_t i = 0; i < CHUNK_NUM; i++) {
+        header.chunks[i] = {offset, chunkNum[i] * header.elementSizes[i], chunkNum[i]};
+        offset = helper::Align(offset + header.chunks[i].size, CHUNK_ALIGNMENT);
+    }
+
+    // A partially written cache must never be picked up
+    const std::string tempFile = cacheFile + ".tmp";
+
+    FILE* file = fopen(tempFile.c_str(), "wb");
+    if (!file)
+        return false;
+
+    static const uint8_t padding[CHUNK_ALIGNMENT] = {};
+
+    bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t fileSize = sizeof(header);
+
+    for (uint32_t i = 0; i < CHUNK_NUM && isWritten; i++) {
+        const ChunkDesc& chunk = header.chunks[i];
+
+        isWritten = fwrite(padding, 1, (size_t)(chunk.offset - fileSize), file) == chunk.offset - fileSize;
+        if (chunk.size)
+            isWritten = isWritten && fwrite(chunkData[i], 1, (size_t)chunk.size, file) == chunk.size;
+
+        fileSize = chunk.offset + chunk.size;
+    }
+
+    isWritten = fclose(file) == 0 && isWritten;
+
+    std::error_code error;
+    if (isWritten) {
+        std::filesystem::rename(tempFile, cacheFile, error);
+        if (!error)
+            return true;
+    }
+
+    std::filesystem::remove(tempFile, error);
+
+    return false;
+}
+
+inline bool SceneCache::Map(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size = {};
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    CloseHandle(file);
+
+    if (!mapping)
+        return false;
+
+    m_MappedData = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    m_MappedSize = m_MappedData ? (uint64_t)size.QuadPart : 0;
+#else
+    int32_t file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat fileStat = {};
+    void* data = MAP_FAILED;
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size)
+        data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    close(file);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    m_MappedData = (const uint8_t*)data;
+    m_MappedSize = (uint64_t)fileStat.st_size;
+#endif
+
+    return m_MappedData != nullptr;
+}
+
+inline void SceneCache::Unmap() {
+    if (!m_MappedData)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_MappedData);
+#else
+    munmap((void*)m_MappedData, (size_t)m_MappedSize);
+#endif
+
+    m_MappedData = nullptr;
+    m_MappedSize = 0;
+}
+
+inline void SceneCache::DecodeTexture(uint32_t textureIndex) {
+    const bool isDecoded = utils::LoadTexture(m_TexturePaths[textureIndex], *m_Textures[textureIndex]);
+
+    const uint64_t decodingEnd = GetTimeStamp();
+    uint64_t prevDecodingEnd = m_DecodingEnd.load(std::memory_order_relaxed);
+    while (prevDecodingEnd < decodingEnd && !m_DecodingEnd.compare_exchange_weak(prevDecodingEnd, decodingEnd, std::memory_order_relaxed))
+        ;
+
+    m_TextureStates[textureIndex].store(isDecoded ? TEXTURE_READY : TEXTURE_FAILED, std::memory_order_release);
+}
+
+inline bool SceneCache::WaitForTexture(uint32_t textureIndex) {
+    // Helps with decoding, then sleeps until the texture is decoded. Textures decoded by the parser have no counters
+    if (m_TextureCounters)
+        m_JobScheduler->Wait(m_TextureCounters[textureIndex]);
+
+    return m_TextureStates[textureIndex].load(std::memory_order_acquire) == TEXTURE_READY;
+}
+
+inline bool SceneCache::UploadTextures(nri::CoreInterface& NRI, nri::HelperInterface& helperInterface, nri::Device& device, nri::Queue& queue,
+    std::vector<nri::Texture*>& textures, std::vector<nri::Memory*>& memoryAllocations) {
+    const uint64_t uploadBegin = GetTimeStamp();
+    const uint32_t textureNum = (uint32_t)m_Textures.size();
+
+    std::vector<nri::TextureUploadDesc> textureData;
+    std::vector<nri::TextureSubresourceUploadDesc> subresources;
+
+    uint32_t batchNum = 0;
+    for (uint32_t batchBegin = 0; batchBegin < textureNum; batchNum++) {
+        // At least "TEXTURE_BATCH_MIN_NUM" textures (keeps the number of allocations low) and everything ready after them
+        const uint32_t batchMinEnd = std::min(batchBegin + TEXTURE_BATCH_MIN_NUM, textureNum);
+
+        uint32_t batchEnd = batchBegin;
+        for (; batchEnd < textureNum; batchEnd++) {
+            if (batchEnd < batchMinEnd) {
+                if (!WaitForTexture(batchEnd)) {
+                    printf("ERROR: Can't load texture '%s'\n", m_TexturePaths[batchEnd]);
+                    return false;
+                }
+            } else if (m_TextureStates[batchEnd].load(std::memory_order_acquire) != TEXTURE_READY)
+                break;
+        }
+
+        const uint32_t batchSize = batchEnd - batchBegin;
+        const size_t batchTextureBase = textures.size();
+
+        // Textures
+        uint32_t subresourceNum = 0;
+        for (uint32_t i = batchBegin; i < batchEnd; i++) {
+            const utils::Texture& texture = *m_Textures[i];
+
+            nri::TextureDesc textureDesc = {};
+            textureDesc.type = nri::TextureType::TEXTURE_2D;
+            textureDesc.usage = nri::TextureUsageBits::SHADER_RESOURCE;
+            textureDesc.format = texture.GetFormat();
+            textureDesc.width = texture.GetWidth();
+            textureDesc.height = texture.GetHeight();
+            textureDesc.mipNum = texture.GetMipNum();
+            textureDesc.layerNum = texture.GetArraySize();
+
+            nri::Texture* nriTexture = nullptr;
+            if (NRI.CreateTexture(device, textureDesc, nriTexture) != nri::Result::SUCCESS)
+                return false;
+
+            textures.push_back(nriTexture);
+            subresourceNum += texture.GetArraySize() * texture.GetMipNum();
+        }
+
+        { // Memory
+            nri::ResourceGroupDesc resourceGroupDesc = {};
+            resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+            resourceGroupDesc.textureNum = batchSize;
+            resourceGroupDesc.textures = textures.data() + batchTextureBase;
+
+            const size_t baseAllocation = memoryAllocations.size();
+            const uint32_t allocationNum = helperInterface.CalculateAllocationNumber(device, resourceGroupDesc);
+            memoryAllocations.resize(baseAllocation + allocationNum, nullptr);
+
+            if (helperInterface.AllocateAndBindMemory(device, resourceGroupDesc, memoryAllocations.data() + baseAllocation) != nri::Result::SUCCESS)
+                return false;
+        }
+
+        { // Upload
+            textureData.resize(batchSize);
+            subresources.resize(subresourceNum);
+
+            nri::TextureSubresourceUploadDesc* subresourceBegin = subresources.data();
+            for (uint32_t i = 0; i < batchSize; i++) {
+                const utils::Texture& texture = *m_Textures[batchBegin + i];
+
+                for (uint32_t slice = 0; slice < texture.GetArraySize(); slice++) {
+                    for (uint32_t mip = 0; mip < texture.GetMipNum(); mip++)
+                        texture.GetSubresource(subresourceBegin[slice * texture.GetMipNum() + mip], mip, slice);
+                }
+
+                textureData[i] = {};
+                textureData[i].subresources = subresourceBegin;
+                textureData[i].texture = textures[batchTextureBase + i];
+                textureData[i].after = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE};
+
+                subresourceBegin += texture.GetArraySize() * texture.GetMipNum();
+            }
+
+            // Blocking, but workers keep decoding
+            if (helperInterface.UploadData(queue, textureData.data(), batchSize, nullptr, 0) != nri::Result::SUCCESS)
+                return false;
+        }
+
+        batchBegin = batchEnd;
+    }
+
+    const uint64_t uploadEnd = GetTimeStamp();
+    const uint64_t decodingEnd = std::max(m_DecodingEnd.load(std::memory_order_relaxed), m_LoadEnd);
+
+    printf("Scene: %s in %.1f ms, %u textures decoded in %.1f ms (%u threads), uploaded in %u batches in %.1f ms, %.1f ms in total\n",
+        m_MappedData ? "cache mapped" : "parsed", double(m_LoadEnd - m_LoadBegin) / 1000.0,
+        textureNum, double(decodingEnd - m_LoadBegin) / 1000.0, m_JobScheduler->GetWorkerNum() + 1,
+        batchNum, double(uploadEnd - uploadBegin) / 1000.0, double(uploadEnd - m_LoadBegin) / 1000.0);
+
+    return true;
+}
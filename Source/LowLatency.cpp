@@ -2,6 +2,9 @@
 
 #include "NRIFramework.h"
 
+#include "Common/CpuProfiler.h"
+#include "Common/GpuProfiler.h"
+
 #include <array>
 
 // Tweakables, which must be set only once
@@ -55,6 +58,7 @@ private:
     nri::Memory* m_Memory = nullptr;
     nri::Descriptor* m_BufferStorage = nullptr;
 
+    GpuProfiler m_GpuProfiler;
     std::array<Frame, QUEUED_FRAMES_MAX_NUM> m_Frames = {};
     std::vector<BackBuffer> m_SwapChainBuffers;
     float m_CpuWorkload = 4.0f;                        // ms
@@ -82,6 +86,7 @@ Sample::~Sample() {
     NRI.DestroyPipelineLayout(*m_PipelineLayout);
     NRI.DestroyFence(*m_FrameFence);
     NRI.DestroySwapChain(*m_SwapChain);
+    m_GpuProfiler.Destroy(NRI);
     NRI.DestroyStreamer(*m_Streamer);
 
     NRI.FreeMemory(*m_Memory);
@@ -135,6 +140,9 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     // Fence
     NRI_ABORT_ON_FAILURE(NRI.CreateFence(*m_Device, 0, m_FrameFence));
 
+    // GPU profiler
+    NRI_ABORT_ON_FALSE(m_GpuProfiler.Initialize(NRI, *m_Device, QUEUED_FRAMES_MAX_NUM));
+
     // Swap chain
     nri::Format swapChainFormat;
     {
@@ -230,6 +238,7 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
 void Sample::LatencySleep(uint32_t frameIndex) {
     nri::nriBeginAnnotation("LatencySleep", COLOR_LATENCY_SLEEP);
+    CpuProfiler::Zone zone("LatencySleep");
 
     // Marker
     if (m_AllowLowLatency)
@@ -259,6 +268,7 @@ void Sample::LatencySleep(uint32_t frameIndex) {
 
 void Sample::PrepareFrame(uint32_t) {
     nri::nriBeginAnnotation("Simulation", COLOR_SIMULATION);
+    CpuProfiler::Zone zone("Simulation");
 
     // Emulate CPU workload
     double begin = m_Timer.GetTimeStamp() + m_CpuWorkload;
@@ -320,9 +330,15 @@ void Sample::PrepareFrame(uint32_t) {
         bool badPractice = EMULATE_BAD_PRACTICE;
         ImGui::Checkbox("Bad practice", &badPractice);
         ImGui::EndDisabled();
+
+        if (ImGui::Button("Save CPU trace"))
+            CpuProfiler::Get().SaveChromeTrace("LowLatencyCpuTrace.json");
     }
     ImGui::End();
 
+    m_GpuProfiler.Update(NRI, *m_FrameFence);
+    m_GpuProfiler.RenderUI();
+
     EndUI(NRI, *m_Streamer);
     NRI.CopyStreamerUpdateRequests(*m_Streamer);
 
@@ -346,6 +362,7 @@ void Sample::PrepareFrame(uint32_t) {
 
 void Sample::RenderFrame(uint32_t frameIndex) {
     nri::nriBeginAnnotation("Render", COLOR_RENDER);
+    CpuProfiler::Zone zone("Render");
 
     const uint32_t backBufferIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
     const BackBuffer& backBuffer = m_SwapChainBuffers[backBufferIndex];
@@ -360,9 +377,13 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     }
 
     // Record
+    m_GpuProfiler.BeginFrame(frameIndex);
+
     nri::CommandBuffer& commandBuffer = *frame.commandBuffer;
     NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
     {
+        m_GpuProfiler.CmdResetQueries(NRI, commandBuffer);
+
         NRI.CmdBeginAnnotation(commandBuffer, "Render", COLOR_RENDER);
 
         nri::TextureBarrierDesc swapchainBarrier = {};
@@ -379,44 +400,50 @@ void Sample::RenderFrame(uint32_t frameIndex) {
             NRI.CmdBarrier(commandBuffer, barriers);
         }
 
-        // Compute workload (main, resolution independent)
-        NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
-        NRI.CmdSetPipeline(commandBuffer, *m_Pipeline);
-        NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DescriptorSet, nullptr);
+        { // Compute workload (main, resolution independent)
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Compute workload");
+
+            NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+            NRI.CmdSetPipeline(commandBuffer, *m_Pipeline);
+            NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DescriptorSet, nullptr);
 
-        for (uint32_t i = 0; i < m_GpuWorkload; i++) {
-            NRI.CmdDispatch(commandBuffer, {CTA_NUM, 1, 1});
+            for (uint32_t i = 0; i < m_GpuWorkload; i++) {
+                NRI.CmdDispatch(commandBuffer, {CTA_NUM, 1, 1});
 
-            { // Barrier
-                nri::GlobalBarrierDesc storageBarrier = {};
-                storageBarrier.before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
-                storageBarrier.after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+                { // Barrier
+                    nri::GlobalBarrierDesc storageBarrier = {};
+                    storageBarrier.before = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
+                    storageBarrier.after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::COMPUTE_SHADER};
 
-                nri::BarrierGroupDesc barriers = {};
-                barriers.globalNum = 1;
-                barriers.globals = &storageBarrier;
+                    nri::BarrierGroupDesc barriers = {};
+                    barriers.globalNum = 1;
+                    barriers.globals = &storageBarrier;
 
-                NRI.CmdBarrier(commandBuffer, barriers);
+                    NRI.CmdBarrier(commandBuffer, barriers);
+                }
             }
         }
 
-        // Clear and UI
-        nri::AttachmentsDesc attachmentsDesc = {};
-        attachmentsDesc.colorNum = 1;
-        attachmentsDesc.colors = &backBuffer.colorAttachment;
+        { // Clear and UI
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "UI");
+
+            nri::AttachmentsDesc attachmentsDesc = {};
+            attachmentsDesc.colorNum = 1;
+            attachmentsDesc.colors = &backBuffer.colorAttachment;
 
-        NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-        {
-            nri::ClearDesc clearDesc = {};
-            clearDesc.colorAttachmentIndex = 0;
-            clearDesc.planes = nri::PlaneBits::COLOR;
-            clearDesc.value.color.f = {0.0f, 0.1f, 0.0f, 1.0f};
+            NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
+            {
+                nri::ClearDesc clearDesc = {};
+                clearDesc.colorAttachmentIndex = 0;
+                clearDesc.planes = nri::PlaneBits::COLOR;
+                clearDesc.value.color.f = {0.0f, 0.1f, 0.0f, 1.0f};
 
-            NRI.CmdClearAttachments(commandBuffer, &clearDesc, 1, nullptr, 0);
+                NRI.CmdClearAttachments(commandBuffer, &clearDesc, 1, nullptr, 0);
 
-            RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
+                RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
+            }
+            NRI.CmdEndRendering(commandBuffer);
         }
-        NRI.CmdEndRendering(commandBuffer);
 
         { // Barrier
             swapchainBarrier.before = swapchainBarrier.after;
@@ -430,6 +457,8 @@ void Sample::RenderFrame(uint32_t frameIndex) {
         }
 
         NRI.CmdEndAnnotation(commandBuffer);
+
+        m_GpuProfiler.CmdEndFrame(NRI, commandBuffer);
     }
     NRI.EndCommandBuffer(commandBuffer);
 
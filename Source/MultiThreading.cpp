@@ -2,21 +2,36 @@
 
 #if _WIN32
 #    include <windows.h>
+#    include <d3d12.h>
+#elif __linux__
+#    include <pthread.h>
+#    include <sched.h>
 #endif
 
 #include "NRIFramework.h"
 
+#include "Common/CpuProfiler.h"
+#include "Common/GpuProfiler.h"
+#include "Common/JobScheduler.h"
+
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
 #include <thread>
 
 constexpr uint32_t BOX_NUM = 30000;
+constexpr uint32_t BOX_MAX_NUM = 3000000;
+constexpr uint32_t PER_BOX_DESCRIPTOR_SET_MAX_NUM = 65536; // keeps descriptor heaps in D3D12 limits
 constexpr uint32_t DRAW_CALLS_PER_PIPELINE = 4;
 constexpr uint32_t THREAD_MAX_NUM = 256;
-
-constexpr uint32_t HALT = 0;
-constexpr uint32_t GO = 1;
-constexpr uint32_t STOP = 2;
+constexpr uint32_t BOXES_PER_CHUNK = 64;
+constexpr uint32_t PIPELINE_NUM = 8;
+constexpr uint32_t TEXTURE_SET_NUM = 64;
+constexpr uint32_t TEXTURE_VARIATION_NUM = 1024;
 
 struct NRIInterface
     : public nri::CoreInterface,
@@ -29,17 +44,411 @@ struct Vertex {
     float texCoords[2];
 };
 
+enum RenderMode : int32_t {
+    PER_BOX,
+    INSTANCED,
+    BINDLESS
+};
+
+constexpr const char* RENDER_MODE_NAMES[] = {
+    "Per box",
+    "Instanced",
+    "Bindless",
+};
+
+enum AffinityPolicy : int32_t {
+    UNPINNED,
+    PHYSICAL_CORES,
+    FILL_SMT
+};
+
+constexpr const char* AFFINITY_POLICY_NAMES[] = {
+    "Unpinned",
+    "One thread per physical core",
+    "Fill SMT siblings",
+};
+
+enum SubmitMode : int32_t {
+    SUBMIT_ALL,
+    SUBMIT_WHEN_READY,
+    RECORD_AHEAD
+};
+
+constexpr const char* SUBMIT_MODE_NAMES[] = {
+    "Submit all at once",
+    "Submit when ready",
+    "Record next frame ahead",
+};
+
+constexpr const char* AFFINITY_POLICY_CMD_NAMES[] = {
+    "unpinned",
+    "cores",
+    "smt",
+};
+
+constexpr uint32_t ANY_LOGICAL_CORE = uint32_t(-1);
+constexpr uint32_t RECORDING_TIME_HISTORY_SIZE = 128;
+
+static std::thread::native_handle_type GetCurrentThreadHandle() {
+#if _WIN32
+    return GetCurrentThread();
+#elif __linux__
+    return pthread_self();
+#else
+    return {};
+#endif
+}
+
+// Affinity of the process at startup, respects "start /affinity", "taskset" and container cpusets
+#if _WIN32
+static DWORD_PTR g_ProcessAffinityMask = 0;
+#elif __linux__
+static cpu_set_t g_ProcessCpuSet;
+#endif
+
+static void SaveProcessAffinity() {
+#if _WIN32
+    // Only the first processor group is addressable with a mask
+    DWORD_PTR systemMask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &g_ProcessAffinityMask, &systemMask)) {
+        printf("WARNING: 'GetProcessAffinityMask' failed (error %u), all logical cores are assumed to be available\n", (uint32_t)GetLastError());
+
+        g_ProcessAffinityMask = 0;
+        for (uint32_t i = 0; i < std::thread::hardware_concurrency() && i < sizeof(DWORD_PTR) * 8; i++)
+            g_ProcessAffinityMask |= DWORD_PTR(1) << i;
+    }
+#elif __linux__
+    CPU_ZERO(&g_ProcessCpuSet);
+    if (sched_getaffinity(0, sizeof(g_ProcessCpuSet), &g_ProcessCpuSet) != 0) {
+        printf("WARNING: 'sched_getaffinity' failed, all logical cores are assumed to be available\n");
+
+        for (uint32_t i = 0; i < std::thread::hardware_concurrency() && i < CPU_SETSIZE; i++)
+            CPU_SET(i, &g_ProcessCpuSet);
+    }
+#endif
+}
+
+// Logical cores the process is allowed to run on, IDs are not necessarily contiguous
+static std::vector<uint32_t> GetAvailableLogicalCores() {
+    std::vector<uint32_t> logicalCores;
+#if _WIN32
+    for (uint32_t i = 0; i < sizeof(DWORD_PTR) * 8; i++) {
+        if (g_ProcessAffinityMask & (DWORD_PTR(1) << i))
+            logicalCores.push_back(i);
+    }
+#elif __linux__
+    for (uint32_t i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &g_ProcessCpuSet))
+            logicalCores.push_back(i);
+    }
+#else
+    for (uint32_t i = 0; i < std::thread::hardware_concurrency(); i++)
+        logicalCores.push_back(i);
+#endif
+
+    return logicalCores;
+}
+
+static void SetThreadAffinity(std::thread::native_handle_type thread, uint32_t logicalCore) {
+#if _WIN32
+    // "Unpinned" restores the affinity the process started with
+    const bool isPinned = logicalCore != ANY_LOGICAL_CORE && logicalCore < sizeof(DWORD_PTR) * 8;
+    if (SetThreadAffinityMask(thread, isPinned ? (DWORD_PTR(1) << logicalCore) : g_ProcessAffinityMask))
+        return;
+
+    printf("WARNING: 'SetThreadAffinityMask' failed for logical core %d (error %u), the thread stays unpinned\n", (int32_t)logicalCore, (uint32_t)GetLastError());
+
+    if (isPinned && !SetThreadAffinityMask(thread, g_ProcessAffinityMask))
+        printf("WARNING: 'SetThreadAffinityMask' can't restore the process affinity (error %u)\n", (uint32_t)GetLastError());
+#elif __linux__
+    // "Unpinned" restores the affinity the process started with
+    cpu_set_t cpuSet = g_ProcessCpuSet;
+    if (logicalCore != ANY_LOGICAL_CORE) {
+        CPU_ZERO(&cpuSet);
+        CPU_SET(logicalCore, &cpuSet);
+    }
+
+    int32_t result = pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet);
+    if (result == 0)
+        return;
+
+    printf("WARNING: 'pthread_setaffinity_np' failed for logical core %d (error %d), the thread stays unpinned\n", (int32_t)logicalCore, result);
+
+    if (logicalCore != ANY_LOGICAL_CORE) {
+        result = pthread_setaffinity_np(thread, sizeof(g_ProcessCpuSet), &g_ProcessCpuSet);
+        if (result != 0)
+            printf("WARNING: 'pthread_setaffinity_np' can't restore the process affinity (error %d)\n", result);
+    }
+#else
+    (void)thread;
+    (void)logicalCore;
+#endif
+}
+
+#if _WIN32
+static bool GetLogicalProcessorInfos(std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION>& infos) {
+    // The first call reports the required size
+    DWORD bufferSize = 0;
+    DWORD error = GetLogicalProcessorInformation(nullptr, &bufferSize) ? ERROR_SUCCESS : GetLastError();
+    if (error == ERROR_INSUFFICIENT_BUFFER) {
+        infos.resize((bufferSize + sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) - 1) / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+        error = GetLogicalProcessorInformation(infos.data(), &bufferSize) ? ERROR_SUCCESS : GetLastError();
+    }
+
+    if (error != ERROR_SUCCESS) {
+        printf("WARNING: 'GetLogicalProcessorInformation' failed (error %u), SMT siblings are unknown\n", (uint32_t)error);
+        infos.clear();
+
+        return false;
+    }
+
+    infos.resize(bufferSize / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+    return true;
+}
+#elif __linux__
+static bool ReadCpuTopologyValue(uint32_t logicalCore, const char* name, uint32_t& value) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/topology/%s", logicalCore, name);
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    const bool result = fscanf(file, "%u", &value) == 1;
+    fclose(file);
+
+    return result;
+}
+#endif
+
 struct Box {
     uint32_t dynamicConstantBufferOffset;
+    nri::DescriptorSet* descriptorSet;
+    uint32_t pipelineIndex;
+    uint32_t textureSetIndex;
+    uint32_t transformIndex; // in the sorted transform buffer
+};
+
+// Must match "BoxBindless.vs.hlsl" and "BoxBindless.fs.hlsl"
+struct BindlessConstants {
+    uint32_t transformIndex;
+    uint32_t textureIndices[3];
+    uint32_t materialIndex;
+};
+
+struct BenchmarkConfig {
+    uint32_t threadNum;
+    uint32_t boxNum;
+    uint32_t drawCallsPerPipeline;
+    int32_t renderMode;
+};
+
+struct BenchmarkResult {
+    BenchmarkConfig config;
+    double recordingMean;
+    double recordingP50;
+    double recordingP99;
+    double submitMean;
+    double submitP50;
+    double submitP99;
+    double drawsPerSecondPerThread;
+};
+
+static void GetTimeStats(std::vector<double>& times, double& mean, double& p50, double& p99) {
+    mean = 0.0;
+    for (double time : times)
+        mean += time;
+    mean /= (double)std::max(times.size(), (size_t)1);
+
+    std::sort(times.begin(), times.end());
+
+    const double last = times.empty() ? 0.0 : double(times.size() - 1);
+    p50 = times.empty() ? 0.0 : times[(size_t)(0.50 * last + 0.5)];
+    p99 = times.empty() ? 0.0 : times[(size_t)(0.99 * last + 0.5)];
+}
+
+// Bytes per descriptor in a descriptor heap (D3D12) or a descriptor buffer (VK)
+struct DescriptorSizes {
+    uint32_t constantBuffer;
+    uint32_t dynamicConstantBuffer;
+    uint32_t texture;
+    uint32_t structuredBuffer;
+    uint32_t sampler;
+};
+
+static uint64_t GetDescriptorMemorySize(const nri::DescriptorPoolDesc& descriptorPoolDesc, const DescriptorSizes& descriptorSizes) {
+    uint64_t size = 0;
+    size += (uint64_t)descriptorPoolDesc.constantBufferMaxNum * descriptorSizes.constantBuffer;
+    size += (uint64_t)descriptorPoolDesc.dynamicConstantBufferMaxNum * descriptorSizes.dynamicConstantBuffer;
+    size += (uint64_t)descriptorPoolDesc.textureMaxNum * descriptorSizes.texture;
+    size += (uint64_t)descriptorPoolDesc.structuredBufferMaxNum * descriptorSizes.structuredBuffer;
+    size += (uint64_t)descriptorPoolDesc.samplerMaxNum * descriptorSizes.sampler;
+
+    return size;
+}
+
+// 3 textures and "MaterialConstants", shared by many boxes to make instancing possible
+struct TextureSet {
+    uint32_t textureIndices[3];
+    uint32_t materialConstantBufferIndex;
+};
+
+// Boxes with the same pipeline and texture set, drawn with one instanced draw call
+struct InstanceGroup {
     nri::DescriptorSet* descriptorSet;
     nri::Pipeline* pipeline;
+    uint32_t baseInstance;
+    uint32_t instanceNum;
 };
 
-struct ThreadContext {
+// Each thread owns a contiguous range of chunks, idle threads steal from the ranges of others
+struct alignas(64) ThreadContext {
     std::array<nri::CommandAllocator*, BUFFERED_FRAME_MAX_NUM> commandAllocators;
     std::array<nri::CommandBuffer*, BUFFERED_FRAME_MAX_NUM> commandBuffers;
-    std::thread thread;
-    std::atomic_uint32_t control;
+    std::atomic_uint32_t nextChunk;
+    uint32_t endChunk;
+    uint32_t recordedChunkNum;
+    uint32_t stolenChunkNum;
+    uint32_t requestedCallNum;
+    uint32_t issuedCallNum;
+    std::atomic_bool isRecorded;
+};
+
+// Everything recording jobs read, captured before they start, since jobs can overlap with the next "PrepareFrame"
+struct JobSettings {
+    const nri::Descriptor* colorAttachment;
+    uint32_t frameIndex;
+    uint32_t threadNum;
+    uint32_t boxNum;
+    uint32_t drawCallsPerPipeline;
+    int32_t renderMode;
+    bool isStateFilteringEnabled;
+};
+
+// Thin wrapper over a command buffer, which drops binds matching the already bound state
+class CommandRecorder {
+public:
+    inline CommandRecorder(const NRIInterface& nri, nri::CommandBuffer& commandBuffer, bool isFilteringEnabled)
+        : NRI(nri), m_CommandBuffer(commandBuffer), m_IsFilteringEnabled(isFilteringEnabled) {
+    }
+
+    inline uint32_t GetRequestedCallNum() const {
+        return m_RequestedCallNum;
+    }
+
+    inline uint32_t GetIssuedCallNum() const {
+        return m_IssuedCallNum;
+    }
+
+    void SetPipelineLayout(const nri::PipelineLayout& pipelineLayout);
+    void SetPipeline(const nri::Pipeline& pipeline);
+    void SetDescriptorSet(uint32_t setIndex, const nri::DescriptorSet& descriptorSet, const uint32_t* dynamicConstantBufferOffset);
+    void SetIndexBuffer(const nri::Buffer& buffer, uint64_t offset, nri::IndexType indexType);
+    void SetVertexBuffer(const nri::Buffer& buffer, uint64_t offset);
+    void SetRootConstants(uint32_t rootConstantIndex, const void* data, uint32_t size);
+    void DrawIndexed(const nri::DrawIndexedDesc& drawIndexedDesc);
+
+private:
+    bool Filter(bool isRedundant);
+
+private:
+    static constexpr uint32_t SET_MAX_NUM = 3;
+
+    const NRIInterface& NRI;
+    nri::CommandBuffer& m_CommandBuffer;
+    const nri::PipelineLayout* m_PipelineLayout = nullptr;
+    const nri::Pipeline* m_Pipeline = nullptr;
+    const nri::DescriptorSet* m_DescriptorSets[SET_MAX_NUM] = {};
+    uint32_t m_DynamicConstantBufferOffsets[SET_MAX_NUM] = {};
+    const nri::Buffer* m_IndexBuffer = nullptr;
+    uint64_t m_IndexBufferOffset = 0;
+    nri::IndexType m_IndexType = nri::IndexType::UINT16;
+    const nri::Buffer* m_VertexBuffer = nullptr;
+    uint64_t m_VertexBufferOffset = 0;
+    uint32_t m_RequestedCallNum = 0;
+    uint32_t m_IssuedCallNum = 0;
+    bool m_IsFilteringEnabled = true;
+};
+
+bool CommandRecorder::Filter(bool isRedundant) {
+    m_RequestedCallNum++;
+
+    if (isRedundant && m_IsFilteringEnabled)
+        return true;
+
+    m_IssuedCallNum++;
+
+    return false;
+}
+
+void CommandRecorder::SetPipelineLayout(const nri::PipelineLayout& pipelineLayout) {
+    if (Filter(m_PipelineLayout == &pipelineLayout))
+        return;
+
+    NRI.CmdSetPipelineLayout(m_CommandBuffer, pipelineLayout);
+
+    // A new layout invalidates all bindings
+    m_PipelineLayout = &pipelineLayout;
+    m_Pipeline = nullptr;
+    for (uint32_t i = 0; i < SET_MAX_NUM; i++)
+        m_DescriptorSets[i] = nullptr;
+}
+
+void CommandRecorder::SetPipeline(const nri::Pipeline& pipeline) {
+    if (Filter(m_Pipeline == &pipeline))
+        return;
+
+    NRI.CmdSetPipeline(m_CommandBuffer, pipeline);
+    m_Pipeline = &pipeline;
+}
+
+void CommandRecorder::SetDescriptorSet(uint32_t setIndex, const nri::DescriptorSet& descriptorSet, const uint32_t* dynamicConstantBufferOffset) {
+    const uint32_t offset = dynamicConstantBufferOffset ? *dynamicConstantBufferOffset : 0;
+    if (Filter(m_DescriptorSets[setIndex] == &descriptorSet && m_DynamicConstantBufferOffsets[setIndex] == offset))
+        return;
+
+    NRI.CmdSetDescriptorSet(m_CommandBuffer, setIndex, descriptorSet, dynamicConstantBufferOffset);
+    m_DescriptorSets[setIndex] = &descriptorSet;
+    m_DynamicConstantBufferOffsets[setIndex] = offset;
+}
+
+void CommandRecorder::SetIndexBuffer(const nri::Buffer& buffer, uint64_t offset, nri::IndexType indexType) {
+    if (Filter(m_IndexBuffer == &buffer && m_IndexBufferOffset == offset && m_IndexType == indexType))
+        return;
+
+    NRI.CmdSetIndexBuffer(m_CommandBuffer, buffer, offset, indexType);
+    m_IndexBuffer = &buffer;
+    m_IndexBufferOffset = offset;
+    m_IndexType = indexType;
+}
+
+void CommandRecorder::SetVertexBuffer(const nri::Buffer& buffer, uint64_t offset) {
+    if (Filter(m_VertexBuffer == &buffer && m_VertexBufferOffset == offset))
+        return;
+
+    const nri::Buffer* buffers[] = {&buffer};
+    NRI.CmdSetVertexBuffers(m_CommandBuffer, 0, 1, buffers, &offset);
+    m_VertexBuffer = &buffer;
+    m_VertexBufferOffset = offset;
+}
+
+void CommandRecorder::SetRootConstants(uint32_t rootConstantIndex, const void* data, uint32_t size) {
+    Filter(false);
+
+    NRI.CmdSetRootConstants(m_CommandBuffer, rootConstantIndex, data, size);
+}
+
+void CommandRecorder::DrawIndexed(const nri::DrawIndexedDesc& drawIndexedDesc) {
+    Filter(false);
+
+    NRI.CmdDrawIndexed(m_CommandBuffer, drawIndexedDesc);
+}
+
+// Box command buffers for one back buffer, recorded once and resubmitted every frame
+struct RecordingCache {
+    std::vector<nri::CommandAllocator*> commandAllocators;
+    std::vector<nri::CommandBuffer*> commandBuffers;
 };
 
 class Sample : public SampleBase {
@@ -50,25 +459,49 @@ public:
     ~Sample();
 
 private:
+    void InitCmdLine(cmdline::parser& cmdLine) override;
+    void ReadCmdLine(cmdline::parser& cmdLine) override;
     bool Initialize(nri::GraphicsAPI graphicsAPI) override;
     void PrepareFrame(uint32_t frameIndex) override;
     void RenderFrame(uint32_t frameIndex) override;
 
-    void RenderBoxes(nri::CommandBuffer& commandBuffer, uint32_t offset, uint32_t number);
-    void ThreadEntryPoint(uint32_t threadIndex);
+    void RenderBoxes(nri::CommandBuffer& commandBuffer, uint32_t threadIndex);
+    void RenderInstancedBoxes(nri::CommandBuffer& commandBuffer);
+    void RenderBindlessBoxes(nri::CommandBuffer& commandBuffer, uint32_t threadIndex);
+    void RenderScene(nri::CommandBuffer& commandBuffer, uint32_t threadIndex);
+    void RecordJob(uint32_t threadIndex);
+    void RecordCachedJob(uint32_t threadIndex);
+    void RecordBoxes(nri::CommandBuffer& commandBuffer, const nri::Descriptor& colorAttachment, uint32_t threadIndex, bool isProfiled);
+    void PrintStartupPhase(const char* name, double& phaseTime);
+    void StartRecording(uint32_t frameIndex, uint32_t threadNum, const nri::Descriptor& colorAttachment);
+    void CaptureJobSettings(uint32_t frameIndex, uint32_t threadNum, const nri::Descriptor* colorAttachment);
+    void UpdateRecordingCache();
+    void UpdateRecordingStats();
+    void RecordPresent(nri::CommandBuffer& commandBuffer, bool isColorTextureUsed);
+    void DistributeChunks(uint32_t threadNum);
+    bool AcquireChunk(uint32_t threadIndex, uint32_t& chunkIndex);
     void CreateSwapChain(nri::Format& swapChainFormat);
     void CreateCommandBuffers();
     bool CreatePipeline(nri::Format swapChainFormat);
     void CreateDepthTexture();
+    void CreateColorTexture(nri::Format swapChainFormat);
     void CreateVertexBuffer();
     void CreateDescriptorPool();
+    bool GetDescriptorSizes(DescriptorSizes& descriptorSizes);
     void LoadTextures();
-    void CreateTransformConstantBuffer();
+    void CreateTransformConstantBuffer(std::vector<float4x4>& transforms);
     void CreateDescriptorSets();
+    void CreateInstanceGroups(const std::vector<float4x4>& transforms);
+    void CreateBindlessResources();
     void CreateFakeConstantBuffers();
     void CreateViewConstantBuffer();
     void SetupProjViewMatrix(float4x4& projViewMatrix);
-    uint32_t GetPhysicalCoreNum() const;
+    void InitBenchmark();
+    void ApplyBenchmarkConfig();
+    void UpdateBenchmark(uint32_t frameIndex);
+    void SaveBenchmarkResults() const;
+    void ApplyAffinityPolicy();
+    void QueryCpuTopology();
 
 private:
     NRIInterface NRI = {};
@@ -77,52 +510,121 @@ private:
     nri::SwapChain* m_SwapChain = nullptr;
     nri::Queue* m_GraphicsQueue = nullptr;
     nri::PipelineLayout* m_PipelineLayout = nullptr;
+    nri::PipelineLayout* m_InstancedPipelineLayout = nullptr;
+    nri::PipelineLayout* m_BindlessPipelineLayout = nullptr;
     nri::DescriptorPool* m_DescriptorPool = nullptr;
     nri::Fence* m_FrameFence = nullptr;
     nri::Texture* m_DepthTexture = nullptr;
     nri::Descriptor* m_DepthTextureView = nullptr;
+    nri::Texture* m_ColorTexture = nullptr;
+    nri::Descriptor* m_ColorAttachment = nullptr;
     nri::Descriptor* m_TransformConstantBufferView = nullptr;
     nri::Descriptor* m_ViewConstantBufferView = nullptr;
     nri::Descriptor* m_Sampler = nullptr;
     nri::DescriptorSet* m_DescriptorSetWithSharedSampler = nullptr;
+    nri::DescriptorSet* m_InstancedDescriptorSetWithSharedSampler = nullptr;
+    nri::DescriptorSet* m_BindlessDescriptorSet = nullptr;
+    nri::DescriptorSet* m_BindlessDescriptorSetWithSharedSampler = nullptr;
+    nri::DescriptorSet* m_BindlessTextureDescriptorSet = nullptr;
+    nri::Descriptor* m_MaterialBufferView = nullptr;
+    nri::Descriptor* m_TransformBufferView = nullptr;
     nri::Buffer* m_VertexBuffer = nullptr;
     nri::Buffer* m_IndexBuffer = nullptr;
     nri::Buffer* m_TransformConstantBuffer = nullptr;
+    nri::Buffer* m_TransformBuffer = nullptr;
     nri::Buffer* m_ViewConstantBuffer = nullptr;
     nri::Buffer* m_FakeConstantBuffer = nullptr;
+    nri::Buffer* m_MaterialBuffer = nullptr;
     nri::Format m_DepthFormat = nri::Format::UNKNOWN;
 
+    GpuProfiler m_GpuProfiler;
     std::vector<nri::CommandBuffer*> m_FrameCommandBuffers;
     std::array<ThreadContext, THREAD_MAX_NUM> m_ThreadContexts;
+    JobScheduler m_JobScheduler;
+    JobCounter m_RecordingCounter;
+    std::mutex m_RecordedMutex;
+    std::condition_variable m_RecordedCondition; // signaled when a command buffer is recorded
+    JobFunc m_RecordJob;
+    JobFunc m_RecordCachedJob;
+    std::vector<RecordingCache> m_RecordingCaches;
+    std::vector<BenchmarkConfig> m_BenchmarkConfigs;
+    std::vector<uint32_t> m_BenchmarkBoxNums;
+    std::vector<BenchmarkResult> m_BenchmarkResults;
+    std::vector<double> m_BenchmarkRecordingTimes;
+    std::vector<double> m_BenchmarkSubmitTimes;
+    std::string m_BenchmarkOutput;
+    std::string m_CpuTraceOutput;
     std::vector<nri::Pipeline*> m_Pipelines;
+    std::vector<nri::Pipeline*> m_InstancedPipelines;
+    std::vector<nri::Pipeline*> m_BindlessPipelines;
+    std::vector<BindlessConstants> m_BindlessConstants;
+    std::vector<TextureSet> m_TextureSets;
+    std::vector<InstanceGroup> m_InstanceGroups;
     std::vector<nri::Texture*> m_Textures;
     std::vector<nri::Descriptor*> m_TextureViews;
     std::vector<nri::Descriptor*> m_FakeConstantBufferViews;
     std::vector<Box> m_Boxes;
     std::vector<BackBuffer> m_SwapChainBuffers;
     std::vector<nri::Memory*> m_MemoryAllocations;
-    uint32_t m_FrameIndex = 0;
+    std::vector<std::vector<uint32_t>> m_PhysicalCores; // logical cores of each physical core
+    std::array<double, RECORDING_TIME_HISTORY_SIZE> m_RecordingTimeHistory = {};
+    uint64_t m_PerBoxDescriptorMemorySize = 0;
+    uint64_t m_InstancedDescriptorMemorySize = 0;
+    uint64_t m_BindlessDescriptorMemorySize = 0;
     uint32_t m_ThreadNum = 0;
-    uint32_t m_BoxesPerThread = 0;
+    uint32_t m_RecordingThreadNum = 0;
+    uint32_t m_BoxNum = BOX_NUM;
+    uint32_t m_PerBoxDescriptorSetNum = 0;
+    uint32_t m_DrawCallsPerPipeline = DRAW_CALLS_PER_PIPELINE;
+    uint32_t m_ActiveThreadNum = 0;
+    uint32_t m_ChunkNum = 0;
+    uint32_t m_StolenChunkNum = 0;
+    uint32_t m_RequestedCallNum = 0;
+    uint32_t m_IssuedCallNum = 0;
     uint32_t m_IndexNum = 0;
+    uint32_t m_CachedBackBufferIndex = 0;
+    uint32_t m_CachedCommandBufferNum = 0;
+    uint32_t m_CachedBoxNum = 0;
+    uint32_t m_CachedDrawCallsPerPipeline = 0;
+    uint32_t m_BenchmarkConfigIndex = 0;
+    uint32_t m_BenchmarkFrame = 0;
+    uint32_t m_BenchmarkWarmupFrameNum = 0;
+    uint32_t m_BenchmarkFrameNum = 0;
+    uint32_t m_RecordingTimeHistoryFrameNum = 0;
     const BackBuffer* m_BackBuffer = nullptr;
     double m_RecordingTime = 0.0;
     double m_SubmitTime = 0.0;
+    double m_FrameWaitTime = 0.0; // excluded from "m_RecordingTime"
+    int32_t m_RenderMode = PER_BOX;
+    int32_t m_CachedRenderMode = PER_BOX;
+    int32_t m_AffinityPolicy = UNPINNED;
+    int32_t m_SubmitMode = SUBMIT_ALL;
+    JobSettings m_JobSettings = {};
     bool m_IsMultithreadingEnabled = true;
-
-    std::atomic_uint32_t m_ReadyCount;
+    bool m_IsStateFilteringEnabled = true;
+    bool m_IsCachedStateFilteringEnabled = true;
+    bool m_IsRecordingCacheEnabled = false;
+    bool m_IsRecordingCacheSupported = false;
+    bool m_IsRecordingCacheValid = false;
+    bool m_IsBindlessSupported = false;
+    bool m_IsDescriptorMemorySizeKnown = false;
+    bool m_IsBenchmark = false;
+    bool m_IsNextFrameRecordedAhead = false;
 };
 
 Sample::~Sample() {
+    // The next frame could be still recording
+    m_JobScheduler.Wait(m_RecordingCounter);
+
     NRI.WaitForIdle(*m_GraphicsQueue);
 
-    for (size_t i = 1; m_IsMultithreadingEnabled && i < m_ThreadNum; i++) {
-        ThreadContext& context = m_ThreadContexts[i];
-        context.control.store(STOP);
-        context.thread.join();
-    }
+    m_JobScheduler.Shutdown();
 
-    for (size_t i = 0; i < m_ThreadNum; i++) {
+    // Also covers "--frameNum" and benchmark exits
+    if (!m_CpuTraceOutput.empty())
+        CpuProfiler::Get().SaveChromeTrace(m_CpuTraceOutput.c_str());
+
+    for (size_t i = 0; i <= m_ThreadNum; i++) {
         ThreadContext& context = m_ThreadContexts[i];
 
         for (size_t j = 0; j < context.commandAllocators.size(); j++) {
@@ -131,6 +633,13 @@ Sample::~Sample() {
         }
     }
 
+    for (const RecordingCache& cache : m_RecordingCaches) {
+        for (size_t i = 0; i < cache.commandAllocators.size(); i++) {
+            NRI.DestroyCommandBuffer(*cache.commandBuffers[i]);
+            NRI.DestroyCommandAllocator(*cache.commandAllocators[i]);
+        }
+    }
+
     for (uint32_t i = 0; i < m_SwapChainBuffers.size(); i++)
         NRI.DestroyDescriptor(*m_SwapChainBuffers[i].colorAttachment);
 
@@ -146,20 +655,39 @@ Sample::~Sample() {
     for (size_t i = 0; i < m_Pipelines.size(); i++)
         NRI.DestroyPipeline(*m_Pipelines[i]);
 
+    for (size_t i = 0; i < m_InstancedPipelines.size(); i++)
+        NRI.DestroyPipeline(*m_InstancedPipelines[i]);
+
+    for (size_t i = 0; i < m_BindlessPipelines.size(); i++)
+        NRI.DestroyPipeline(*m_BindlessPipelines[i]);
+
+    if (m_IsBindlessSupported) {
+        NRI.DestroyDescriptor(*m_MaterialBufferView);
+        NRI.DestroyBuffer(*m_MaterialBuffer);
+        NRI.DestroyPipelineLayout(*m_BindlessPipelineLayout);
+    }
+
     NRI.DestroyDescriptor(*m_Sampler);
     NRI.DestroyDescriptor(*m_DepthTextureView);
+    NRI.DestroyDescriptor(*m_ColorAttachment);
     NRI.DestroyDescriptor(*m_TransformConstantBufferView);
+    NRI.DestroyDescriptor(*m_TransformBufferView);
     NRI.DestroyDescriptor(*m_ViewConstantBufferView);
     NRI.DestroyTexture(*m_DepthTexture);
+    NRI.DestroyTexture(*m_ColorTexture);
     NRI.DestroyBuffer(*m_TransformConstantBuffer);
+    NRI.DestroyBuffer(*m_TransformBuffer);
     NRI.DestroyBuffer(*m_ViewConstantBuffer);
     NRI.DestroyBuffer(*m_FakeConstantBuffer);
     NRI.DestroyBuffer(*m_VertexBuffer);
     NRI.DestroyBuffer(*m_IndexBuffer);
     NRI.DestroyPipelineLayout(*m_PipelineLayout);
+    NRI.DestroyPipelineLayout(*m_InstancedPipelineLayout);
     NRI.DestroyDescriptorPool(*m_DescriptorPool);
     NRI.DestroyFence(*m_FrameFence);
-    NRI.DestroySwapChain(*m_SwapChain);
+    m_GpuProfiler.Destroy(NRI);
+    if (m_SwapChain)
+        NRI.DestroySwapChain(*m_SwapChain);
     NRI.DestroyStreamer(*m_Streamer);
 
     for (size_t i = 0; i < m_MemoryAllocations.size(); i++)
@@ -170,23 +698,83 @@ Sample::~Sample() {
     nri::nriDestroyDevice(*m_Device);
 }
 
+void Sample::InitCmdLine(cmdline::parser& cmdLine) {
+    cmdLine.add<uint32_t>("boxNum", 0, "number of boxes, resources are sized for it (1 - 3M, 3M boxes need ~1 GB of video memory)", false, BOX_NUM);
+    cmdLine.add("benchmark", 0, "sweep thread number, box number and draw calls per pipeline, save results and exit");
+    cmdLine.add<uint32_t>("benchmarkWarmupFrames", 0, "not measured frames per configuration", false, 32);
+    cmdLine.add<uint32_t>("benchmarkFrames", 0, "measured frames per configuration", false, 256);
+    cmdLine.add<std::string>("benchmarkBoxes", 0, "comma separated box numbers to sweep (default: boxNum / 4, boxNum / 2, boxNum)", false, "");
+    cmdLine.add<std::string>("benchmarkOutput", 0, "output file name, '.csv' and '.json' are appended", false, "MultiThreadingBenchmark");
+    cmdLine.add<std::string>("affinity", 0, "thread affinity policy", false, AFFINITY_POLICY_CMD_NAMES[UNPINNED],
+        cmdline::oneof<std::string>(AFFINITY_POLICY_CMD_NAMES[UNPINNED], AFFINITY_POLICY_CMD_NAMES[PHYSICAL_CORES], AFFINITY_POLICY_CMD_NAMES[FILL_SMT]));
+    cmdLine.add<std::string>("cpuTrace", 0, "save CPU zones as Chrome trace JSON to this file at exit", false, "");
+}
+
+void Sample::ReadCmdLine(cmdline::parser& cmdLine) {
+    m_BoxNum = std::min(std::max(cmdLine.get<uint32_t>("boxNum"), 1u), BOX_MAX_NUM);
+    m_IsBenchmark = cmdLine.exist("benchmark");
+    m_BenchmarkWarmupFrameNum = cmdLine.get<uint32_t>("benchmarkWarmupFrames");
+    m_BenchmarkFrameNum = std::max(cmdLine.get<uint32_t>("benchmarkFrames"), 1u);
+    m_BenchmarkOutput = cmdLine.get<std::string>("benchmarkOutput");
+
+    const std::string benchmarkBoxes = cmdLine.get<std::string>("benchmarkBoxes");
+    for (const char* s = benchmarkBoxes.c_str(); *s;) {
+        char* end = nullptr;
+        const uint32_t boxNum = (uint32_t)strtoul(s, &end, 10);
+        if (end == s)
+            end++; // skip a separator
+        else
+            m_BenchmarkBoxNums.push_back(std::min(std::max(boxNum, 1u), BOX_MAX_NUM));
+
+        s = end;
+    }
+
+    // Resources are sized for the biggest swept box number
+    if (m_IsBenchmark) {
+        for (uint32_t boxNum : m_BenchmarkBoxNums)
+            m_BoxNum = std::max(m_BoxNum, boxNum);
+    }
+    m_CpuTraceOutput = cmdLine.get<std::string>("cpuTrace");
+
+    const std::string affinity = cmdLine.get<std::string>("affinity");
+    for (uint32_t i = 0; i < helper::GetCountOf(AFFINITY_POLICY_CMD_NAMES); i++) {
+        if (affinity == AFFINITY_POLICY_CMD_NAMES[i])
+            m_AffinityPolicy = (int32_t)i;
+    }
+}
+
 bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
-    const uint32_t logicalCoreNum = std::thread::hardware_concurrency();
-    const uint32_t phyiscalCoreNum = GetPhysicalCoreNum();
+    CpuProfiler::Get().SetThreadName("Main");
+    CpuProfiler::Zone zone("Initialize");
+
+    // Before any thread gets pinned
+    SaveProcessAffinity();
+    QueryCpuTopology();
+
+    uint32_t logicalCoreNum = 0;
+    for (const std::vector<uint32_t>& physicalCore : m_PhysicalCores)
+        logicalCoreNum += (uint32_t)physicalCore.size();
+
+    const uint32_t phyiscalCoreNum = (uint32_t)m_PhysicalCores.size();
     const uint32_t ratio = std::max(logicalCoreNum / std::max(phyiscalCoreNum, 1u), 1u);
 
-    m_ThreadNum = std::min((phyiscalCoreNum - 1) * ratio, THREAD_MAX_NUM);
-    for (uint32_t i = 0; i < m_ThreadNum; i++) {
+    // The last context ("m_ThreadNum") records UI and the present barrier after all boxes. At least the main thread records boxes
+    m_ThreadNum = std::min((phyiscalCoreNum - 1) * ratio, THREAD_MAX_NUM - 1);
+    m_ThreadNum = std::max(m_ThreadNum, 1u);
+    for (uint32_t i = 0; i <= m_ThreadNum; i++) {
         ThreadContext& context = m_ThreadContexts[i];
-        context.control.store(HALT, std::memory_order_relaxed);
         context.commandAllocators.fill(nullptr);
         context.commandBuffers.fill(nullptr);
     }
 
-    m_FrameCommandBuffers.resize(m_ThreadNum);
+    // Main + boxes + present
+    m_FrameCommandBuffers.resize(m_ThreadNum + 2);
 
-    m_Boxes.resize(std::max(BOX_NUM, m_ThreadNum));
-    m_BoxesPerThread = (uint32_t)m_Boxes.size() / m_ThreadNum;
+    m_RecordingThreadNum = m_ThreadNum;
+    m_Boxes.resize(m_BoxNum);
+
+    // Descriptor heaps can't hold sets for millions of boxes, boxes above the limit reuse sets of earlier boxes
+    m_PerBoxDescriptorSetNum = std::min(m_BoxNum, PER_BOX_DESCRIPTOR_SET_MAX_NUM);
 
     nri::AdapterDesc bestAdapterDesc = {};
     uint32_t adapterDescsNum = 1;
@@ -219,101 +807,211 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
     NRI_ABORT_ON_FAILURE(NRI.GetQueue(*m_Device, nri::QueueType::GRAPHICS, 0, m_GraphicsQueue));
     NRI_ABORT_ON_FAILURE(NRI.CreateFence(*m_Device, 0, m_FrameFence));
+    NRI_ABORT_ON_FALSE(m_GpuProfiler.Initialize(NRI, *m_Device, BUFFERED_FRAME_MAX_NUM));
+
+    // NRI records VK command buffers with "ONE_TIME_SUBMIT", they can't be resubmitted
+    m_IsRecordingCacheSupported = NRI.GetDeviceDesc(*m_Device).graphicsAPI != nri::GraphicsAPI::VK;
+
+    // Unbounded texture arrays are not available in D3D11
+    m_IsBindlessSupported = graphicsAPI != nri::GraphicsAPI::D3D11;
 
     m_DepthFormat = nri::GetSupportedDepthFormat(NRI, *m_Device, 24, false);
     nri::Format swapChainFormat = nri::Format::UNKNOWN;
 
+    // Thread 0 is the main thread, workers are parked until there is recording work for them
+    m_RecordJob = [this](uint32_t threadIndex) { RecordJob(threadIndex); };
+    m_RecordCachedJob = [this](uint32_t threadIndex) { RecordCachedJob(threadIndex); };
+    m_JobScheduler.Initialize(m_ThreadNum - 1);
+    ApplyAffinityPolicy();
+
+    // Workers also help with resource creation
+    const double startupTime = m_Timer.GetTimeStamp();
+    double phaseTime = startupTime;
+
     CreateCommandBuffers();
     CreateDepthTexture();
-    CreateSwapChain(swapChainFormat);
+
+    // Benchmark renders offscreen, presentation and vsync don't affect measurements
+    if (m_IsBenchmark)
+        swapChainFormat = nri::Format::RGBA8_UNORM;
+    else
+        CreateSwapChain(swapChainFormat);
+
+    CreateColorTexture(swapChainFormat);
+    PrintStartupPhase("Swap chain & command buffers", phaseTime);
 
     NRI_ABORT_ON_FALSE(CreatePipeline(swapChainFormat));
+    PrintStartupPhase("Pipelines", phaseTime);
 
     LoadTextures();
+    PrintStartupPhase("Textures", phaseTime);
+
     CreateFakeConstantBuffers();
     CreateViewConstantBuffer();
     CreateVertexBuffer();
     CreateDescriptorPool();
+    PrintStartupPhase("Buffers & views", phaseTime);
 
-    CreateTransformConstantBuffer();
+    std::vector<float4x4> transforms;
+    CreateTransformConstantBuffer(transforms);
     CreateDescriptorSets();
+    PrintStartupPhase("Descriptor sets", phaseTime);
 
-    if (m_IsMultithreadingEnabled) {
-        for (uint32_t i = 1; i < m_ThreadNum; i++)
-            m_ThreadContexts[i].thread = std::thread(&Sample::ThreadEntryPoint, this, i);
-    }
+    CreateInstanceGroups(transforms);
+    PrintStartupPhase("Instance groups", phaseTime);
+
+    CreateBindlessResources();
+    PrintStartupPhase("Bindless resources", phaseTime);
+
+    printf("Startup: %.2f ms total\n", m_Timer.GetTimeStamp() - startupTime);
+
+    if (m_IsBenchmark)
+        InitBenchmark();
 
     return InitUI(NRI, NRI, *m_Device, swapChainFormat);
 }
 
 void Sample::PrepareFrame(uint32_t) {
+    CpuProfiler::Zone zone("PrepareFrame");
+
     BeginUI();
 
     ImGui::SetNextWindowPos(ImVec2(30, 30), ImGuiCond_Always);
     ImGui::SetNextWindowSize(ImVec2(0, 0));
     ImGui::Begin("Settings", nullptr, ImGuiWindowFlags_NoResize);
     {
-        ImGui::Text("Box number: %u", (uint32_t)m_Boxes.size());
-        ImGui::Text("Draw calls per pipeline: %u", DRAW_CALLS_PER_PIPELINE);
+        if (m_IsBenchmark) {
+            const uint32_t configNum = (uint32_t)m_BenchmarkConfigs.size();
+            ImGui::Text("Benchmark: %u / %u", std::min(m_BenchmarkConfigIndex + 1, configNum), configNum);
+            ImGui::Separator();
+        }
+
+        ImGui::BeginDisabled(m_IsBenchmark || m_RenderMode == INSTANCED);
+        ImGui::SliderInt("Box number", (int32_t*)&m_BoxNum, 1, (int32_t)m_Boxes.size());
+        ImGui::SliderInt("Draw calls per pipeline", (int32_t*)&m_DrawCallsPerPipeline, 1, 64);
+        ImGui::SliderInt("Threads", (int32_t*)&m_RecordingThreadNum, 1, (int32_t)m_ThreadNum);
+        ImGui::EndDisabled();
+
+        ImGui::Text("Chunks: %u (stolen: %u)", m_ChunkNum, m_StolenChunkNum);
+        ImGui::Text("API calls: %u issued / %u requested", m_IssuedCallNum, m_RequestedCallNum);
 
         ImGui::Text("Command buffer recording: %.2f ms", m_RecordingTime);
-        ImGui::Text("Command buffer submit: %.2f ms", m_SubmitTime);
+        { // Jitter over the last frames
+            const uint32_t historyNum = std::min(m_RecordingTimeHistoryFrameNum, RECORDING_TIME_HISTORY_SIZE);
 
-        bool isMultithreadingEnabled = m_IsMultithreadingEnabled;
-        ImGui::Checkbox("Multithreading", &isMultithreadingEnabled);
-
-        if (isMultithreadingEnabled != m_IsMultithreadingEnabled) {
-            m_IsMultithreadingEnabled = isMultithreadingEnabled;
-
-            if (m_IsMultithreadingEnabled) {
-                for (uint32_t i = 1; i < m_ThreadNum; i++) {
-                    ThreadContext& context = m_ThreadContexts[i];
-                    context.control.store(HALT);
-                    context.thread = std::thread(&Sample::ThreadEntryPoint, this, i);
-                }
-            } else {
-                for (size_t i = 1; i < m_ThreadNum; i++) {
-                    ThreadContext& context = m_ThreadContexts[i];
-                    context.control.store(STOP);
-                    context.thread.join();
-                }
-            }
+            double mean = 0.0;
+            for (uint32_t i = 0; i < historyNum; i++)
+                mean += m_RecordingTimeHistory[i];
+            mean /= std::max(historyNum, 1u);
+
+            double variance = 0.0;
+            for (uint32_t i = 0; i < historyNum; i++)
+                variance += (m_RecordingTimeHistory[i] - mean) * (m_RecordingTimeHistory[i] - mean);
+            variance /= std::max(historyNum, 1u);
+
+            ImGui::Text("  mean: %.3f ms, std dev: %.3f ms", mean, sqrt(variance));
         }
+        ImGui::Text("Command buffer submit: %.2f ms", m_SubmitTime);
+
+        if (m_IsDescriptorMemorySizeKnown) { // Descriptor memory of each path, the shared sampler set is included
+            ImGui::Text("Descriptor memory per box: %.1f KB (%u sets)", m_PerBoxDescriptorMemorySize / 1024.0, m_PerBoxDescriptorSetNum + 1);
+            ImGui::Text("Descriptor memory instanced: %.1f KB", m_InstancedDescriptorMemorySize / 1024.0);
+            if (m_IsBindlessSupported)
+                ImGui::Text("Descriptor memory bindless: %.1f KB (3 sets)", m_BindlessDescriptorMemorySize / 1024.0);
+        } else
+            ImGui::Text("Descriptor memory: unknown for this API");
+
+        ImGui::Combo("Mode", &m_RenderMode, RENDER_MODE_NAMES, (int32_t)helper::GetCountOf(RENDER_MODE_NAMES));
+        if (m_RenderMode == BINDLESS && !m_IsBindlessSupported)
+            m_RenderMode = PER_BOX;
+
+        if (m_RenderMode == INSTANCED)
+            ImGui::Text("Instanced draws: %u", (uint32_t)m_InstanceGroups.size());
+
+        ImGui::BeginDisabled(m_IsBenchmark || m_RenderMode == INSTANCED);
+        ImGui::Checkbox("Multithreading", &m_IsMultithreadingEnabled);
+        ImGui::EndDisabled();
+
+        ImGui::BeginDisabled(!m_IsMultithreadingEnabled || m_IsRecordingCacheEnabled || m_RenderMode == INSTANCED);
+        ImGui::Combo("Submission", &m_SubmitMode, SUBMIT_MODE_NAMES, (int32_t)helper::GetCountOf(SUBMIT_MODE_NAMES));
+        ImGui::EndDisabled();
+        ImGui::Checkbox("Redundant state filtering", &m_IsStateFilteringEnabled);
+
+        if (ImGui::Combo("Affinity", &m_AffinityPolicy, AFFINITY_POLICY_NAMES, (int32_t)helper::GetCountOf(AFFINITY_POLICY_NAMES)))
+            ApplyAffinityPolicy();
+
+        ImGui::BeginDisabled(m_IsBenchmark || !m_IsRecordingCacheSupported);
+        ImGui::Checkbox("Reuse recorded command buffers", &m_IsRecordingCacheEnabled);
+        ImGui::EndDisabled();
+
+        bool isCpuProfilerEnabled = CpuProfiler::Get().IsEnabled();
+        if (ImGui::Checkbox("CPU profiler", &isCpuProfilerEnabled))
+            CpuProfiler::Get().SetEnabled(isCpuProfilerEnabled);
+
+        ImGui::SameLine();
+        if (ImGui::Button("Save trace"))
+            CpuProfiler::Get().SaveChromeTrace(m_CpuTraceOutput.empty() ? "MultiThreadingCpuTrace.json" : m_CpuTraceOutput.c_str());
     }
     ImGui::End();
 
+    m_GpuProfiler.Update(NRI, *m_FrameFence);
+    m_GpuProfiler.RenderUI();
+
     EndUI(NRI, *m_Streamer);
     NRI.CopyStreamerUpdateRequests(*m_Streamer);
 }
 
 void Sample::RenderFrame(uint32_t frameIndex) {
-    m_FrameIndex = frameIndex;
+    CpuProfiler::Zone zone("RenderFrame");
 
-    const uint32_t backBufferIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
-    m_BackBuffer = &m_SwapChainBuffers[backBufferIndex];
-
-    m_RecordingTime = m_Timer.GetTimeStamp();
+    // Offscreen frames (benchmark) have no back buffer
+    uint32_t backBufferIndex = 0;
+    if (!m_IsBenchmark) {
+        backBufferIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
+        m_BackBuffer = &m_SwapChainBuffers[backBufferIndex];
+    }
 
     const uint32_t threadIndex0 = 0;
     ThreadContext& context0 = m_ThreadContexts[threadIndex0];
+    ThreadContext& presentContext = m_ThreadContexts[m_ThreadNum];
 
     const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
     if (frameIndex >= BUFFERED_FRAME_MAX_NUM) {
-        NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
+        {
+            CpuProfiler::Zone waitZone("WaitForFrame");
+            NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
+        }
+
         NRI.ResetCommandAllocator(*context0.commandAllocators[bufferedFrameIndex]);
+        NRI.ResetCommandAllocator(*presentContext.commandAllocators[bufferedFrameIndex]);
     }
 
-    if (m_IsMultithreadingEnabled) {
-        m_ReadyCount.store(0, std::memory_order_seq_cst);
+    // Starts after the frame fence, otherwise GPU back-pressure would be reported as recording time
+    m_RecordingTime = m_Timer.GetTimeStamp();
+    m_SubmitTime = 0.0;
+    m_FrameWaitTime = 0.0;
 
-        for (uint32_t i = 1; i < m_ThreadNum; i++) {
-            ThreadContext& context = m_ThreadContexts[i];
-            if (frameIndex >= BUFFERED_FRAME_MAX_NUM)
-                NRI.ResetCommandAllocator(*context.commandAllocators[bufferedFrameIndex]);
+    // Workers could have started recording this frame at the end of the previous one
+    const bool isRecordedAhead = m_IsNextFrameRecordedAhead;
+    m_IsNextFrameRecordedAhead = false;
 
-            context.control.store(GO, std::memory_order_relaxed);
-        }
-    }
+    // Instanced mode issues only a few hundred draws, they are recorded on the main thread
+    const bool isCached = !isRecordedAhead && m_IsRecordingCacheEnabled && m_IsRecordingCacheSupported;
+    const bool isMultithreaded = isRecordedAhead || (!isCached && m_IsMultithreadingEnabled && m_RenderMode != INSTANCED);
+    const int32_t submitMode = isRecordedAhead ? RECORD_AHEAD : (isMultithreaded ? m_SubmitMode : SUBMIT_ALL);
+
+    // Frames recorded ahead can't know their back buffer, boxes go to the color texture which is copied to the back buffer
+    const bool isColorTextureUsed = submitMode == RECORD_AHEAD || m_IsBenchmark;
+    const nri::Descriptor* colorAttachment = isColorTextureUsed ? m_ColorAttachment : m_BackBuffer->colorAttachment;
+
+    // Otherwise the profiler frame begins in "StartRecording", possibly during the previous frame
+    if (isCached) {
+        m_GpuProfiler.BeginFrame(frameIndex);
+        UpdateRecordingCache();
+    } else if (!isRecordedAhead)
+        StartRecording(frameIndex, isMultithreaded ? m_RecordingThreadNum : 1, *colorAttachment);
+
+    const uint32_t threadNum = isCached ? 1 : m_JobSettings.threadNum;
 
     nri::CommandBuffer& commandBuffer = *context0.commandBuffers[bufferedFrameIndex];
     m_FrameCommandBuffers[threadIndex0] = &commandBuffer;
@@ -321,186 +1019,540 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     // Record
     NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
     {
+        // Submitted first in all modes
+        m_GpuProfiler.CmdResetQueries(NRI, commandBuffer);
+
         helper::Annotation annotation1(NRI, commandBuffer, "Frame");
 
-        nri::TextureBarrierDesc backBufferTransition = {};
-        backBufferTransition.texture = m_BackBuffer->texture;
-        backBufferTransition.after = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
-        backBufferTransition.layerNum = nri::REMAINING_LAYERS;
-        backBufferTransition.mipNum = nri::REMAINING_MIPS;
+        nri::TextureBarrierDesc textureTransition = {};
+        textureTransition.texture = isColorTextureUsed ? m_ColorTexture : m_BackBuffer->texture;
+        if (isColorTextureUsed)
+            textureTransition.before = {nri::AccessBits::COPY_SOURCE, nri::Layout::COPY_SOURCE};
+        textureTransition.after = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
+        textureTransition.layerNum = nri::REMAINING_LAYERS;
+        textureTransition.mipNum = nri::REMAINING_MIPS;
 
         nri::BarrierGroupDesc barrierGroupDesc = {};
-        barrierGroupDesc.textures = &backBufferTransition;
+        barrierGroupDesc.textures = &textureTransition;
         barrierGroupDesc.textureNum = 1;
 
         NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
 
         nri::AttachmentsDesc attachmentsDesc = {};
         attachmentsDesc.colorNum = 1;
-        attachmentsDesc.colors = &m_BackBuffer->colorAttachment;
+        attachmentsDesc.colors = &colorAttachment;
+        attachmentsDesc.depthStencil = m_DepthTextureView;
+
+        NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
+        {
+            nri::ClearDesc clearDescs[2] = {};
+            clearDescs[0].planes = nri::PlaneBits::COLOR;
+            clearDescs[1].planes = nri::PlaneBits::DEPTH;
+            clearDescs[1].value.depthStencil.depth = 1.0f;
+            NRI.CmdClearAttachments(commandBuffer, clearDescs, helper::GetCountOf(clearDescs), nullptr, 0);
+
+            // In cached mode boxes come from the recording cache
+            if (!isCached) {
+                GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Boxes");
+                RenderScene(commandBuffer, threadIndex0);
+            }
+        }
+        NRI.CmdEndRendering(commandBuffer);
+
+        if (!isMultithreaded && !isCached) {
+            RecordPresent(commandBuffer, isColorTextureUsed);
+            m_GpuProfiler.CmdEndFrame(NRI, commandBuffer);
+        }
+    }
+    NRI.EndCommandBuffer(commandBuffer);
+
+    uint32_t submittedNum = 0;
+    uint32_t commandBufferNum = 1;
+    if (isCached) {
+        const RecordingCache& cache = m_RecordingCaches[backBufferIndex];
+        for (uint32_t i = 0; i < m_CachedCommandBufferNum; i++)
+            m_FrameCommandBuffers[commandBufferNum++] = cache.commandBuffers[i];
+    } else if (submitMode == SUBMIT_WHEN_READY) {
+        context0.isRecorded.store(true, std::memory_order_release);
+
+        // Submit contiguous recorded command buffers, helping workers meanwhile or sleeping until the next one is recorded
+        while (submittedNum < threadNum) {
+            const ThreadContext& nextContext = m_ThreadContexts[submittedNum];
+            if (!nextContext.isRecorded.load(std::memory_order_acquire) && !m_JobScheduler.TryExecute()) {
+                CpuProfiler::Zone waitZone("WaitForRecording");
+
+                std::unique_lock<std::mutex> lock(m_RecordedMutex);
+                m_RecordedCondition.wait(lock, [&nextContext] { return nextContext.isRecorded.load(std::memory_order_acquire); });
+            }
+
+            uint32_t readyNum = submittedNum;
+            while (readyNum < threadNum && m_ThreadContexts[readyNum].isRecorded.load(std::memory_order_acquire))
+                readyNum++;
+
+            if (readyNum != submittedNum) {
+                double submitTime = m_Timer.GetTimeStamp();
+
+                nri::QueueSubmitDesc queueSubmitDesc = {};
+                queueSubmitDesc.commandBuffers = m_FrameCommandBuffers.data() + submittedNum;
+                queueSubmitDesc.commandBufferNum = readyNum - submittedNum;
+
+                NRI.QueueSubmit(*m_GraphicsQueue, queueSubmitDesc);
+
+                m_SubmitTime += m_Timer.GetTimeStamp() - submitTime;
+                submittedNum = readyNum;
+            }
+        }
+
+        CpuProfiler::Zone waitZone("WaitForRecording");
+        m_JobScheduler.Wait(m_RecordingCounter);
+        commandBufferNum = threadNum;
+    } else if (isMultithreaded) {
+        CpuProfiler::Zone waitZone("WaitForRecording");
+        m_JobScheduler.Wait(m_RecordingCounter);
+        commandBufferNum = threadNum;
+    }
+
+    if (isCached || isMultithreaded) {
+        // UI and the present barrier must go after all boxes
+        nri::CommandBuffer& presentCommandBuffer = *presentContext.commandBuffers[bufferedFrameIndex];
+        m_FrameCommandBuffers[commandBufferNum++] = &presentCommandBuffer;
+
+        NRI.BeginCommandBuffer(presentCommandBuffer, m_DescriptorPool);
+        {
+            RecordPresent(presentCommandBuffer, isColorTextureUsed);
+
+            // Workers are done, all scopes of the frame are recorded
+            m_GpuProfiler.CmdEndFrame(NRI, presentCommandBuffer);
+        }
+        NRI.EndCommandBuffer(presentCommandBuffer);
+    }
+
+    if (!isCached)
+        UpdateRecordingStats();
+
+    m_RecordingTime = m_Timer.GetTimeStamp() - m_RecordingTime - m_SubmitTime - m_FrameWaitTime;
+
+    m_RecordingTimeHistory[m_RecordingTimeHistoryFrameNum++ % RECORDING_TIME_HISTORY_SIZE] = m_RecordingTime;
+
+    { // Submit
+        double submitTime = m_Timer.GetTimeStamp();
+
+        nri::QueueSubmitDesc queueSubmitDesc = {};
+        queueSubmitDesc.commandBuffers = m_FrameCommandBuffers.data() + submittedNum;
+        queueSubmitDesc.commandBufferNum = commandBufferNum - submittedNum;
+
+        NRI.QueueSubmit(*m_GraphicsQueue, queueSubmitDesc);
+
+        m_SubmitTime += m_Timer.GetTimeStamp() - submitTime;
+    }
+
+    if (m_IsBenchmark)
+        UpdateBenchmark(frameIndex);
+
+    // Let workers record the next frame while this one is presented
+    bool isNextFrameRecordedAhead = !m_IsRecordingCacheEnabled || !m_IsRecordingCacheSupported;
+    isNextFrameRecordedAhead = isNextFrameRecordedAhead && m_IsMultithreadingEnabled && m_RenderMode != INSTANCED;
+    isNextFrameRecordedAhead = isNextFrameRecordedAhead && m_SubmitMode == RECORD_AHEAD;
+    if (isNextFrameRecordedAhead) {
+        StartRecording(frameIndex + 1, m_RecordingThreadNum, *m_ColorAttachment);
+        m_IsNextFrameRecordedAhead = true;
+    }
+
+    // Present
+    if (!m_IsBenchmark)
+        NRI.QueuePresent(*m_SwapChain);
+
+    { // Signaling after "Present" improves D3D11 performance a bit
+        nri::FenceSubmitDesc signalFence = {};
+        signalFence.fence = m_FrameFence;
+        signalFence.value = 1 + frameIndex;
+
+        nri::QueueSubmitDesc queueSubmitDesc = {};
+        queueSubmitDesc.signalFences = &signalFence;
+        queueSubmitDesc.signalFenceNum = 1;
+
+        NRI.QueueSubmit(*m_GraphicsQueue, queueSubmitDesc);
+    }
+}
+
+void Sample::PrintStartupPhase(const char* name, double& phaseTime) {
+    const double time = m_Timer.GetTimeStamp();
+    printf("Startup: %-30s %.2f ms\n", name, time - phaseTime);
+
+    phaseTime = time;
+}
+
+void Sample::StartRecording(uint32_t frameIndex, uint32_t threadNum, const nri::Descriptor& colorAttachment) {
+    CaptureJobSettings(frameIndex, threadNum, &colorAttachment);
+    DistributeChunks(threadNum);
+
+    // Up to "BUFFERED_FRAME_MAX_NUM" frames in flight, including the one recorded ahead
+    const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
+    if (frameIndex >= BUFFERED_FRAME_MAX_NUM) {
+        { // Already signaled for the current frame, blocks only when recording ahead
+            CpuProfiler::Zone waitZone("WaitForFrame");
+
+            const double waitTime = m_Timer.GetTimeStamp();
+            NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
+            m_FrameWaitTime += m_Timer.GetTimeStamp() - waitTime;
+        }
+
+        for (uint32_t i = 1; i < threadNum; i++)
+            NRI.ResetCommandAllocator(*m_ThreadContexts[i].commandAllocators[bufferedFrameIndex]);
+    }
+
+    m_GpuProfiler.BeginFrame(frameIndex);
+    m_JobScheduler.Submit(m_RecordJob, 1, threadNum - 1, m_RecordingCounter);
+}
+
+void Sample::CaptureJobSettings(uint32_t frameIndex, uint32_t threadNum, const nri::Descriptor* colorAttachment) {
+    m_JobSettings.colorAttachment = colorAttachment;
+    m_JobSettings.frameIndex = frameIndex;
+    m_JobSettings.threadNum = threadNum;
+    m_JobSettings.boxNum = m_BoxNum;
+    m_JobSettings.drawCallsPerPipeline = m_DrawCallsPerPipeline;
+    m_JobSettings.renderMode = m_RenderMode;
+    m_JobSettings.isStateFilteringEnabled = m_IsStateFilteringEnabled;
+}
+
+void Sample::RenderBoxes(nri::CommandBuffer& commandBuffer, uint32_t threadIndex) {
+    helper::Annotation annotation(NRI, commandBuffer, "RenderBoxes");
+    CpuProfiler::Zone zone("RenderBoxes");
+
+    const nri::Rect scissorRect = {0, 0, (nri::Dim_t)GetWindowResolution().x, (nri::Dim_t)GetWindowResolution().y};
+    const nri::Viewport viewport = {0.0f, 0.0f, (float)scissorRect.width, (float)scissorRect.height, 0.0f, 1.0f};
+    NRI.CmdSetViewports(commandBuffer, &viewport, 1);
+    NRI.CmdSetScissors(commandBuffer, &scissorRect, 1);
+
+    CommandRecorder recorder(NRI, commandBuffer, m_JobSettings.isStateFilteringEnabled);
+    recorder.SetPipelineLayout(*m_PipelineLayout);
+
+    uint32_t chunkIndex = 0;
+    while (AcquireChunk(threadIndex, chunkIndex)) {
+        const uint32_t baseBoxIndex = chunkIndex * BOXES_PER_CHUNK;
+        const uint32_t endBoxIndex = std::min(baseBoxIndex + BOXES_PER_CHUNK, m_JobSettings.boxNum);
+
+        for (uint32_t i = baseBoxIndex; i < endBoxIndex; i++) {
+            const Box& box = m_Boxes[i];
+            const nri::Pipeline* pipeline = m_Pipelines[(i / m_JobSettings.drawCallsPerPipeline) % PIPELINE_NUM];
+
+            recorder.SetPipeline(*pipeline);
+            recorder.SetDescriptorSet(0, *box.descriptorSet, &box.dynamicConstantBufferOffset);
+            recorder.SetDescriptorSet(1, *m_DescriptorSetWithSharedSampler, nullptr);
+            recorder.SetIndexBuffer(*m_IndexBuffer, 0, nri::IndexType::UINT16);
+            recorder.SetVertexBuffer(*m_VertexBuffer, 0);
+            recorder.DrawIndexed({m_IndexNum, 1, 0, 0, 0});
+        }
+    }
+
+    ThreadContext& context = m_ThreadContexts[threadIndex];
+    context.requestedCallNum = recorder.GetRequestedCallNum();
+    context.issuedCallNum = recorder.GetIssuedCallNum();
+}
+
+void Sample::RenderInstancedBoxes(nri::CommandBuffer& commandBuffer) {
+    helper::Annotation annotation(NRI, commandBuffer, "RenderInstancedBoxes");
+    CpuProfiler::Zone zone("RenderInstancedBoxes");
+
+    const nri::Rect scissorRect = {0, 0, (nri::Dim_t)GetWindowResolution().x, (nri::Dim_t)GetWindowResolution().y};
+    const nri::Viewport viewport = {0.0f, 0.0f, (float)scissorRect.width, (float)scissorRect.height, 0.0f, 1.0f};
+    NRI.CmdSetViewports(commandBuffer, &viewport, 1);
+    NRI.CmdSetScissors(commandBuffer, &scissorRect, 1);
+
+    CommandRecorder recorder(NRI, commandBuffer, m_JobSettings.isStateFilteringEnabled);
+    recorder.SetPipelineLayout(*m_InstancedPipelineLayout);
+
+    for (const InstanceGroup& group : m_InstanceGroups) {
+        recorder.SetPipeline(*group.pipeline);
+        recorder.SetDescriptorSet(0, *group.descriptorSet, nullptr);
+        recorder.SetDescriptorSet(1, *m_InstancedDescriptorSetWithSharedSampler, nullptr);
+        recorder.SetRootConstants(0, &group.baseInstance, sizeof(group.baseInstance));
+        recorder.SetIndexBuffer(*m_IndexBuffer, 0, nri::IndexType::UINT16);
+        recorder.SetVertexBuffer(*m_VertexBuffer, 0);
+        recorder.DrawIndexed({m_IndexNum, group.instanceNum, 0, 0, 0});
+    }
+
+    ThreadContext& context = m_ThreadContexts[0];
+    context.requestedCallNum = recorder.GetRequestedCallNum();
+    context.issuedCallNum = recorder.GetIssuedCallNum();
+}
+
+void Sample::RenderBindlessBoxes(nri::CommandBuffer& commandBuffer, uint32_t threadIndex) {
+    helper::Annotation annotation(NRI, commandBuffer, "RenderBindlessBoxes");
+    CpuProfiler::Zone zone("RenderBindlessBoxes");
+
+    const nri::Rect scissorRect = {0, 0, (nri::Dim_t)GetWindowResolution().x, (nri::Dim_t)GetWindowResolution().y};
+    const nri::Viewport viewport = {0.0f, 0.0f, (float)scissorRect.width, (float)scissorRect.height, 0.0f, 1.0f};
+    NRI.CmdSetViewports(commandBuffer, &viewport, 1);
+    NRI.CmdSetScissors(commandBuffer, &scissorRect, 1);
+
+    CommandRecorder recorder(NRI, commandBuffer, m_JobSettings.isStateFilteringEnabled);
+    recorder.SetPipelineLayout(*m_BindlessPipelineLayout);
+
+    // Only root constants change from box to box
+    uint32_t chunkIndex = 0;
+    while (AcquireChunk(threadIndex, chunkIndex)) {
+        const uint32_t baseBoxIndex = chunkIndex * BOXES_PER_CHUNK;
+        const uint32_t endBoxIndex = std::min(baseBoxIndex + BOXES_PER_CHUNK, m_JobSettings.boxNum);
+
+        for (uint32_t i = baseBoxIndex; i < endBoxIndex; i++) {
+            const nri::Pipeline* pipeline = m_BindlessPipelines[(i / m_JobSettings.drawCallsPerPipeline) % PIPELINE_NUM];
+
+            recorder.SetPipeline(*pipeline);
+            recorder.SetDescriptorSet(0, *m_BindlessDescriptorSet, nullptr);
+            recorder.SetDescriptorSet(1, *m_BindlessDescriptorSetWithSharedSampler, nullptr);
+            recorder.SetDescriptorSet(2, *m_BindlessTextureDescriptorSet, nullptr);
+            recorder.SetRootConstants(0, &m_BindlessConstants[i], sizeof(BindlessConstants));
+            recorder.SetIndexBuffer(*m_IndexBuffer, 0, nri::IndexType::UINT16);
+            recorder.SetVertexBuffer(*m_VertexBuffer, 0);
+            recorder.DrawIndexed({m_IndexNum, 1, 0, 0, 0});
+        }
+    }
+
+    ThreadContext& context = m_ThreadContexts[threadIndex];
+    context.requestedCallNum = recorder.GetRequestedCallNum();
+    context.issuedCallNum = recorder.GetIssuedCallNum();
+}
+
+void Sample::RenderScene(nri::CommandBuffer& commandBuffer, uint32_t threadIndex) {
+    if (m_JobSettings.renderMode == INSTANCED)
+        RenderInstancedBoxes(commandBuffer);
+    else if (m_JobSettings.renderMode == BINDLESS)
+        RenderBindlessBoxes(commandBuffer, threadIndex);
+    else
+        RenderBoxes(commandBuffer, threadIndex);
+}
+
+void Sample::RecordJob(uint32_t threadIndex) {
+    ThreadContext& context = m_ThreadContexts[threadIndex];
+
+    const uint32_t bufferedFrameIndex = m_JobSettings.frameIndex % BUFFERED_FRAME_MAX_NUM;
+    nri::CommandBuffer& commandBuffer = *context.commandBuffers[bufferedFrameIndex];
+    m_FrameCommandBuffers[threadIndex] = &commandBuffer;
+
+    RecordBoxes(commandBuffer, *m_JobSettings.colorAttachment, threadIndex, true);
+
+    { // Taking the lock prevents a lost wakeup between the check and the wait in "RenderFrame"
+        std::lock_guard<std::mutex> lock(m_RecordedMutex);
+        context.isRecorded.store(true, std::memory_order_release);
+    }
+    m_RecordedCondition.notify_one();
+}
+
+void Sample::RecordCachedJob(uint32_t threadIndex) {
+    const RecordingCache& cache = m_RecordingCaches[m_CachedBackBufferIndex];
+
+    // Cached command buffers are resubmitted, their timestamps would land in a stale profiler frame
+    RecordBoxes(*cache.commandBuffers[threadIndex], *m_SwapChainBuffers[m_CachedBackBufferIndex].colorAttachment, threadIndex, false);
+}
+
+void Sample::RecordBoxes(nri::CommandBuffer& commandBuffer, const nri::Descriptor& colorAttachment, uint32_t threadIndex, bool isProfiled) {
+    NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
+    {
+        const nri::Descriptor* colorAttachments[] = {&colorAttachment};
+
+        nri::AttachmentsDesc attachmentsDesc = {};
+        attachmentsDesc.colorNum = 1;
+        attachmentsDesc.colors = colorAttachments;
         attachmentsDesc.depthStencil = m_DepthTextureView;
 
         NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-        {
-            nri::ClearDesc clearDescs[2] = {};
-            clearDescs[0].planes = nri::PlaneBits::COLOR;
-            clearDescs[1].planes = nri::PlaneBits::DEPTH;
-            clearDescs[1].value.depthStencil.depth = 1.0f;
-            NRI.CmdClearAttachments(commandBuffer, clearDescs, helper::GetCountOf(clearDescs), nullptr, 0);
-
-            if (m_IsMultithreadingEnabled) {
-                const uint32_t baseBoxIndex = threadIndex0 * m_BoxesPerThread;
-                const uint32_t boxNum = std::min(m_BoxesPerThread, (uint32_t)m_Boxes.size() - baseBoxIndex);
-                RenderBoxes(commandBuffer, baseBoxIndex, boxNum);
-            } else
-                RenderBoxes(commandBuffer, 0, (uint32_t)m_Boxes.size());
-        }
+        if (isProfiled) {
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Boxes");
+            RenderScene(commandBuffer, threadIndex);
+        } else
+            RenderScene(commandBuffer, threadIndex);
         NRI.CmdEndRendering(commandBuffer);
+    }
+    NRI.EndCommandBuffer(commandBuffer);
+}
 
-        if (!m_IsMultithreadingEnabled) {
-            attachmentsDesc.depthStencil = nullptr;
+void Sample::UpdateRecordingCache() {
+    const uint32_t threadNum = (m_IsMultithreadingEnabled && m_RenderMode != INSTANCED) ? m_RecordingThreadNum : 1;
 
-            NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-            {
-                RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
-            }
-            NRI.CmdEndRendering(commandBuffer);
+    // Recorded commands depend on these settings only, resources don't change after "Initialize"
+    bool isValid = m_IsRecordingCacheValid;
+    isValid = isValid && m_CachedCommandBufferNum == threadNum;
+    isValid = isValid && m_CachedRenderMode == m_RenderMode;
+    isValid = isValid && m_CachedBoxNum == m_BoxNum;
+    isValid = isValid && m_CachedDrawCallsPerPipeline == m_DrawCallsPerPipeline;
+    isValid = isValid && m_IsCachedStateFilteringEnabled == m_IsStateFilteringEnabled;
+    if (isValid)
+        return;
+
+    // Cached command buffers can be in flight
+    NRI.WaitForIdle(*m_GraphicsQueue);
 
-            backBufferTransition.texture = m_BackBuffer->texture;
-            backBufferTransition.before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
-            backBufferTransition.after = {nri::AccessBits::UNKNOWN, nri::Layout::PRESENT};
-            backBufferTransition.layerNum = 1;
-            backBufferTransition.mipNum = 1;
+    if (m_RecordingCaches.empty()) {
+        m_RecordingCaches.resize(m_SwapChainBuffers.size());
 
-            barrierGroupDesc.textures = &backBufferTransition;
-            barrierGroupDesc.textureNum = 1;
+        for (RecordingCache& cache : m_RecordingCaches) {
+            cache.commandAllocators.resize(m_ThreadNum, nullptr);
+            cache.commandBuffers.resize(m_ThreadNum, nullptr);
 
-            NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+            for (uint32_t i = 0; i < m_ThreadNum; i++) {
+                NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_GraphicsQueue, cache.commandAllocators[i]));
+                NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*cache.commandAllocators[i], cache.commandBuffers[i]));
+            }
         }
     }
-    NRI.EndCommandBuffer(commandBuffer);
 
-    while (m_IsMultithreadingEnabled && m_ReadyCount.load(std::memory_order_relaxed) != m_ThreadNum - 1) {
-        for (volatile uint32_t i = 0; i < 100; i++)
-            ;
-    }
+    for (uint32_t i = 0; i < (uint32_t)m_RecordingCaches.size(); i++) {
+        const RecordingCache& cache = m_RecordingCaches[i];
+        for (nri::CommandAllocator* commandAllocator : cache.commandAllocators)
+            NRI.ResetCommandAllocator(*commandAllocator);
 
-    m_RecordingTime = m_Timer.GetTimeStamp() - m_RecordingTime;
+        // Each back buffer needs its own set, since color attachments are baked into command buffers
+        m_CachedBackBufferIndex = i;
+        CaptureJobSettings(0, threadNum, nullptr);
+        DistributeChunks(threadNum);
 
-    { // Submit
-        m_SubmitTime = m_Timer.GetTimeStamp();
+        m_JobScheduler.Submit(m_RecordCachedJob, 0, threadNum, m_RecordingCounter);
+        m_JobScheduler.Wait(m_RecordingCounter);
+    }
 
-        nri::QueueSubmitDesc queueSubmitDesc = {};
-        queueSubmitDesc.commandBuffers = m_FrameCommandBuffers.data();
-        queueSubmitDesc.commandBufferNum = m_IsMultithreadingEnabled ? m_ThreadNum : 1;
+    UpdateRecordingStats();
 
-        NRI.QueueSubmit(*m_GraphicsQueue, queueSubmitDesc);
+    m_CachedCommandBufferNum = threadNum;
+    m_CachedRenderMode = m_RenderMode;
+    m_CachedBoxNum = m_BoxNum;
+    m_CachedDrawCallsPerPipeline = m_DrawCallsPerPipeline;
+    m_IsCachedStateFilteringEnabled = m_IsStateFilteringEnabled;
+    m_IsRecordingCacheValid = true;
+}
 
-        m_SubmitTime = m_Timer.GetTimeStamp() - m_SubmitTime;
+void Sample::UpdateRecordingStats() {
+    m_StolenChunkNum = 0;
+    m_RequestedCallNum = 0;
+    m_IssuedCallNum = 0;
+
+    for (uint32_t i = 0; i < m_ActiveThreadNum; i++) {
+        const ThreadContext& context = m_ThreadContexts[i];
+        m_StolenChunkNum += context.stolenChunkNum;
+        m_RequestedCallNum += context.requestedCallNum;
+        m_IssuedCallNum += context.issuedCallNum;
     }
+}
 
-    // Present
-    NRI.QueuePresent(*m_SwapChain);
+void Sample::RecordPresent(nri::CommandBuffer& commandBuffer, bool isColorTextureUsed) {
+    if (m_IsBenchmark) {
+        // Offscreen: no UI, the color texture only returns to the state expected by the next frame
+        nri::TextureBarrierDesc textureTransition = {};
+        textureTransition.texture = m_ColorTexture;
+        textureTransition.before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
+        textureTransition.after = {nri::AccessBits::COPY_SOURCE, nri::Layout::COPY_SOURCE};
+        textureTransition.layerNum = 1;
+        textureTransition.mipNum = 1;
 
-    { // Signaling after "Present" improves D3D11 performance a bit
-        nri::FenceSubmitDesc signalFence = {};
-        signalFence.fence = m_FrameFence;
-        signalFence.value = 1 + frameIndex;
+        nri::BarrierGroupDesc barrierGroupDesc = {};
+        barrierGroupDesc.textures = &textureTransition;
+        barrierGroupDesc.textureNum = 1;
 
-        nri::QueueSubmitDesc queueSubmitDesc = {};
-        queueSubmitDesc.signalFences = &signalFence;
-        queueSubmitDesc.signalFenceNum = 1;
+        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
 
-        NRI.QueueSubmit(*m_GraphicsQueue, queueSubmitDesc);
+        return;
     }
-}
 
-void Sample::RenderBoxes(nri::CommandBuffer& commandBuffer, uint32_t offset, uint32_t number) {
-    helper::Annotation annotation(NRI, commandBuffer, "RenderBoxes");
+    if (isColorTextureUsed) {
+        nri::TextureBarrierDesc textureTransitions[2] = {};
+        textureTransitions[0].texture = m_BackBuffer->texture;
+        textureTransitions[0].after = {nri::AccessBits::COPY_DESTINATION, nri::Layout::COPY_DESTINATION};
+        textureTransitions[0].layerNum = 1;
+        textureTransitions[0].mipNum = 1;
 
-    const nri::Rect scissorRect = {0, 0, (nri::Dim_t)GetWindowResolution().x, (nri::Dim_t)GetWindowResolution().y};
-    const nri::Viewport viewport = {0.0f, 0.0f, (float)scissorRect.width, (float)scissorRect.height, 0.0f, 1.0f};
-    NRI.CmdSetViewports(commandBuffer, &viewport, 1);
-    NRI.CmdSetScissors(commandBuffer, &scissorRect, 1);
-    NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+        textureTransitions[1].texture = m_ColorTexture;
+        textureTransitions[1].before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
+        textureTransitions[1].after = {nri::AccessBits::COPY_SOURCE, nri::Layout::COPY_SOURCE};
+        textureTransitions[1].layerNum = 1;
+        textureTransitions[1].mipNum = 1;
+
+        nri::BarrierGroupDesc barrierGroupDesc = {};
+        barrierGroupDesc.textures = textureTransitions;
+        barrierGroupDesc.textureNum = helper::GetCountOf(textureTransitions);
+
+        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+        NRI.CmdCopyTexture(commandBuffer, *m_BackBuffer->texture, nullptr, *m_ColorTexture, nullptr);
 
-    const uint64_t nullOffset = 0;
+        textureTransitions[0].before = textureTransitions[0].after;
+        textureTransitions[0].after = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
 
-    for (uint32_t i = 0; i < number; i++) {
-        const Box& box = m_Boxes[offset + i];
+        barrierGroupDesc.textureNum = 1;
 
-        NRI.CmdSetPipeline(commandBuffer, *box.pipeline);
-        NRI.CmdSetDescriptorSet(commandBuffer, 0, *box.descriptorSet, &box.dynamicConstantBufferOffset);
-        NRI.CmdSetDescriptorSet(commandBuffer, 1, *m_DescriptorSetWithSharedSampler, nullptr);
-        NRI.CmdSetIndexBuffer(commandBuffer, *m_IndexBuffer, 0, nri::IndexType::UINT16);
-        NRI.CmdSetVertexBuffers(commandBuffer, 0, 1, &m_VertexBuffer, &nullOffset);
-        NRI.CmdDrawIndexed(commandBuffer, {m_IndexNum, 1, 0, 0, 0});
+        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
     }
-}
 
-void Sample::ThreadEntryPoint(uint32_t threadIndex) {
-    ThreadContext& context = m_ThreadContexts[threadIndex];
+    nri::AttachmentsDesc attachmentsDesc = {};
+    attachmentsDesc.colorNum = 1;
+    attachmentsDesc.colors = &m_BackBuffer->colorAttachment;
 
-    while (true) {
-        uint32_t control = context.control.load(std::memory_order_relaxed);
-        if (control == HALT)
-            continue;
-        else if (control == STOP)
-            break;
+    NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
+    {
+        GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "UI");
+        RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
+    }
+    NRI.CmdEndRendering(commandBuffer);
 
-        context.control.store(HALT, std::memory_order_seq_cst);
+    nri::TextureBarrierDesc backBufferTransition = {};
+    backBufferTransition.texture = m_BackBuffer->texture;
+    backBufferTransition.before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
+    backBufferTransition.after = {nri::AccessBits::UNKNOWN, nri::Layout::PRESENT};
+    backBufferTransition.layerNum = 1;
+    backBufferTransition.mipNum = 1;
 
-        const uint32_t bufferedFrameIndex = m_FrameIndex % BUFFERED_FRAME_MAX_NUM;
-        nri::CommandBuffer& commandBuffer = *context.commandBuffers[bufferedFrameIndex];
-        m_FrameCommandBuffers[threadIndex] = &commandBuffer;
+    nri::BarrierGroupDesc barrierGroupDesc = {};
+    barrierGroupDesc.textures = &backBufferTransition;
+    barrierGroupDesc.textureNum = 1;
 
-        NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
-        {
-            nri::AttachmentsDesc attachmentsDesc = {};
-            attachmentsDesc.colorNum = 1;
-            attachmentsDesc.colors = &m_BackBuffer->colorAttachment;
-            attachmentsDesc.depthStencil = m_DepthTextureView;
-
-            NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-            {
-                const uint32_t baseBoxIndex = threadIndex * m_BoxesPerThread;
-                const uint32_t boxNum = std::min(m_BoxesPerThread, (uint32_t)m_Boxes.size() - baseBoxIndex);
-                RenderBoxes(commandBuffer, baseBoxIndex, boxNum);
-            }
-            NRI.CmdEndRendering(commandBuffer);
+    NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+}
 
-            if (threadIndex == m_ThreadNum - 1) {
-                attachmentsDesc.depthStencil = nullptr;
+void Sample::DistributeChunks(uint32_t threadNum) {
+    m_ActiveThreadNum = threadNum;
+    m_ChunkNum = (m_JobSettings.boxNum + BOXES_PER_CHUNK - 1) / BOXES_PER_CHUNK;
 
-                NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-                {
-                    RenderUI(NRI, NRI, *m_Streamer, commandBuffer, 1.0f, true);
-                }
-                NRI.CmdEndRendering(commandBuffer);
-            }
+    // Initial split is even, but all remaining chunks are covered
+    for (uint32_t i = 0; i < threadNum; i++) {
+        ThreadContext& context = m_ThreadContexts[i];
+        context.nextChunk.store((uint32_t)((uint64_t)m_ChunkNum * i / threadNum), std::memory_order_relaxed);
+        context.endChunk = (uint32_t)((uint64_t)m_ChunkNum * (i + 1) / threadNum);
+        context.recordedChunkNum = 0;
+        context.stolenChunkNum = 0;
+        context.requestedCallNum = 0;
+        context.issuedCallNum = 0;
+        context.isRecorded.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool Sample::AcquireChunk(uint32_t threadIndex, uint32_t& chunkIndex) {
+    ThreadContext& context = m_ThreadContexts[threadIndex];
 
-            if (threadIndex == m_ThreadNum - 1) {
-                nri::TextureBarrierDesc backBufferTransition = {};
-                backBufferTransition.texture = m_BackBuffer->texture;
-                backBufferTransition.before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
-                backBufferTransition.after = {nri::AccessBits::UNKNOWN, nri::Layout::PRESENT};
-                backBufferTransition.layerNum = 1;
-                backBufferTransition.mipNum = 1;
+    // Own range first
+    chunkIndex = context.nextChunk.fetch_add(1, std::memory_order_relaxed);
+    if (chunkIndex < context.endChunk) {
+        context.recordedChunkNum++;
+        return true;
+    }
 
-                nri::BarrierGroupDesc barrierGroupDesc = {};
-                barrierGroupDesc.textures = &backBufferTransition;
-                barrierGroupDesc.textureNum = 1;
+    // Steal from others, starting from the neighbor to spread contention
+    for (uint32_t i = 1; i < m_ActiveThreadNum; i++) {
+        ThreadContext& victim = m_ThreadContexts[(threadIndex + i) % m_ActiveThreadNum];
+        if (victim.nextChunk.load(std::memory_order_relaxed) >= victim.endChunk)
+            continue;
 
-                NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
-            }
+        chunkIndex = victim.nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunkIndex < victim.endChunk) {
+            context.recordedChunkNum++;
+            context.stolenChunkNum++;
+            return true;
         }
-        NRI.EndCommandBuffer(commandBuffer);
-
-        m_ReadyCount.fetch_add(1, std::memory_order_release);
     }
+
+    return false;
 }
 
 void Sample::CreateSwapChain(nri::Format& swapChainFormat) {
+    CpuProfiler::Zone zone("CreateSwapChain");
+
     nri::SwapChainDesc swapChainDesc = {};
     swapChainDesc.window = GetWindow();
     swapChainDesc.queue = m_GraphicsQueue;
@@ -512,6 +1564,9 @@ void Sample::CreateSwapChain(nri::Format& swapChainFormat) {
 
     NRI_ABORT_ON_FAILURE(NRI.CreateSwapChain(*m_Device, swapChainDesc, m_SwapChain));
 
+    // Cached command buffers reference back buffers and depend on the swap chain format
+    m_IsRecordingCacheValid = false;
+
     uint32_t swapChainTextureNum = 0;
     nri::Texture* const* swapChainTextures = NRI.GetSwapChainTextures(*m_SwapChain, swapChainTextureNum);
     swapChainFormat = NRI.GetTextureDesc(*swapChainTextures[0]).format;
@@ -528,8 +1583,10 @@ void Sample::CreateSwapChain(nri::Format& swapChainFormat) {
 }
 
 void Sample::CreateCommandBuffers() {
+    CpuProfiler::Zone zone("CreateCommandBuffers");
+
     for (uint32_t j = 0; j < BUFFERED_FRAME_MAX_NUM; j++) {
-        for (uint32_t i = 0; i < m_ThreadNum; i++) {
+        for (uint32_t i = 0; i <= m_ThreadNum; i++) {
             ThreadContext& context = m_ThreadContexts[i];
             NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_GraphicsQueue, context.commandAllocators[j]));
             NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*context.commandAllocators[j], context.commandBuffers[j]));
@@ -538,6 +1595,8 @@ void Sample::CreateCommandBuffers() {
 }
 
 bool Sample::CreatePipeline(nri::Format swapChainFormat) {
+    CpuProfiler::Zone zone("CreatePipeline");
+
     nri::DescriptorRangeDesc descriptorRanges0[] = {
         {1, 3, nri::DescriptorType::CONSTANT_BUFFER, nri::StageBits::ALL},
         {0, 3, nri::DescriptorType::TEXTURE, nri::StageBits::FRAGMENT_SHADER}};
@@ -567,15 +1626,59 @@ bool Sample::CreatePipeline(nri::Format swapChainFormat) {
 
     NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, m_PipelineLayout));
 
-    constexpr uint32_t pipelineNum = 8;
+    { // Instanced: transforms come from a structured buffer, the first instance is a root constant
+        nri::DescriptorRangeDesc instancedDescriptorRanges0[] = {
+            {1, 3, nri::DescriptorType::CONSTANT_BUFFER, nri::StageBits::ALL},
+            {0, 3, nri::DescriptorType::TEXTURE, nri::StageBits::FRAGMENT_SHADER},
+            {3, 1, nri::DescriptorType::STRUCTURED_BUFFER, nri::StageBits::VERTEX_SHADER}};
+
+        nri::DescriptorSetDesc instancedDescriptorSetDescs[] = {
+            {0, instancedDescriptorRanges0, helper::GetCountOf(instancedDescriptorRanges0)},
+            {1, descriptorRanges1, helper::GetCountOf(descriptorRanges1)},
+        };
+
+        nri::RootConstantDesc rootConstant = {0, sizeof(uint32_t), nri::StageBits::VERTEX_SHADER};
+
+        pipelineLayoutDesc.descriptorSets = instancedDescriptorSetDescs;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(instancedDescriptorSetDescs);
+        pipelineLayoutDesc.rootConstants = &rootConstant;
+        pipelineLayoutDesc.rootConstantNum = 1;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, m_InstancedPipelineLayout));
+    }
+
+    if (m_IsBindlessSupported) { // Bindless: all textures in one array, per box indices are root constants
+        nri::DescriptorRangeDesc bindlessDescriptorRanges0[] = {
+            {1, 2, nri::DescriptorType::CONSTANT_BUFFER, nri::StageBits::ALL},
+            {0, 2, nri::DescriptorType::STRUCTURED_BUFFER, nri::StageBits::ALL}};
+
+        nri::DescriptorRangeDesc bindlessDescriptorRanges2[] = {
+            {0, TEXTURE_VARIATION_NUM, nri::DescriptorType::TEXTURE, nri::StageBits::FRAGMENT_SHADER, nri::DescriptorRangeBits::VARIABLE_SIZED_ARRAY | nri::DescriptorRangeBits::PARTIALLY_BOUND}};
+
+        nri::DescriptorSetDesc bindlessDescriptorSetDescs[] = {
+            {0, bindlessDescriptorRanges0, helper::GetCountOf(bindlessDescriptorRanges0)},
+            {1, descriptorRanges1, helper::GetCountOf(descriptorRanges1)},
+            {2, bindlessDescriptorRanges2, helper::GetCountOf(bindlessDescriptorRanges2)},
+        };
+
+        nri::RootConstantDesc rootConstant = {0, sizeof(BindlessConstants), nri::StageBits::VERTEX_SHADER | nri::StageBits::FRAGMENT_SHADER};
+
+        pipelineLayoutDesc.descriptorSets = bindlessDescriptorSetDescs;
+        pipelineLayoutDesc.descriptorSetNum = helper::GetCountOf(bindlessDescriptorSetDescs);
+        pipelineLayoutDesc.rootConstants = &rootConstant;
+        pipelineLayoutDesc.rootConstantNum = 1;
+
+        NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, pipelineLayoutDesc, m_BindlessPipelineLayout));
+    }
 
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
     utils::ShaderCodeStorage shaderCodeStorage;
 
-    nri::ShaderDesc shaders[1 + pipelineNum];
+    nri::ShaderDesc shaders[2 + PIPELINE_NUM];
     shaders[0] = utils::LoadShader(deviceDesc.graphicsAPI, "Box.vs", shaderCodeStorage);
-    for (uint32_t i = 0; i < pipelineNum; i++)
-        shaders[1 + i] = utils::LoadShader(deviceDesc.graphicsAPI, "Box" + std::to_string(i) + ".fs", shaderCodeStorage);
+    shaders[1] = utils::LoadShader(deviceDesc.graphicsAPI, "BoxInstanced.vs", shaderCodeStorage);
+    for (uint32_t i = 0; i < PIPELINE_NUM; i++)
+        shaders[2 + i] = utils::LoadShader(deviceDesc.graphicsAPI, "Box" + std::to_string(i) + ".fs", shaderCodeStorage);
 
     nri::VertexStreamDesc vertexStreamDesc = {};
     vertexStreamDesc.bindingSlot = 0;
@@ -631,20 +1734,49 @@ bool Sample::CreatePipeline(nri::Format swapChainFormat) {
     graphicsPipelineDesc.rasterization = rasterizationDesc;
     graphicsPipelineDesc.outputMerger = outputMergerDesc;
 
-    m_Pipelines.resize(pipelineNum);
+    m_Pipelines.resize(PIPELINE_NUM);
 
     for (size_t i = 0; i < m_Pipelines.size(); i++) {
-        nri::ShaderDesc shaderStages[] = {shaders[0], shaders[1 + i]};
+        nri::ShaderDesc shaderStages[] = {shaders[0], shaders[2 + i]};
         graphicsPipelineDesc.shaders = shaderStages;
         graphicsPipelineDesc.shaderNum = helper::GetCountOf(shaderStages);
 
         NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, graphicsPipelineDesc, m_Pipelines[i]));
     }
 
+    m_InstancedPipelines.resize(PIPELINE_NUM);
+    graphicsPipelineDesc.pipelineLayout = m_InstancedPipelineLayout;
+
+    for (size_t i = 0; i < m_InstancedPipelines.size(); i++) {
+        nri::ShaderDesc shaderStages[] = {shaders[1], shaders[2 + i]};
+        graphicsPipelineDesc.shaders = shaderStages;
+        graphicsPipelineDesc.shaderNum = helper::GetCountOf(shaderStages);
+
+        NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, graphicsPipelineDesc, m_InstancedPipelines[i]));
+    }
+
+    if (m_IsBindlessSupported) {
+        nri::ShaderDesc bindlessShaders[] = {
+            utils::LoadShader(deviceDesc.graphicsAPI, "BoxBindless.vs", shaderCodeStorage),
+            utils::LoadShader(deviceDesc.graphicsAPI, "BoxBindless.fs", shaderCodeStorage),
+        };
+
+        graphicsPipelineDesc.pipelineLayout = m_BindlessPipelineLayout;
+        graphicsPipelineDesc.shaders = bindlessShaders;
+        graphicsPipelineDesc.shaderNum = helper::GetCountOf(bindlessShaders);
+
+        // Same shaders, but pipeline switches stay the same as in the per box mode
+        m_BindlessPipelines.resize(PIPELINE_NUM);
+        for (size_t i = 0; i < m_BindlessPipelines.size(); i++)
+            NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, graphicsPipelineDesc, m_BindlessPipelines[i]));
+    }
+
     return true;
 }
 
 void Sample::CreateDepthTexture() {
+    CpuProfiler::Zone zone("CreateDepthTexture");
+
     nri::TextureDesc textureDesc = {};
     textureDesc.type = nri::TextureType::TEXTURE_2D;
     textureDesc.usage = nri::TextureUsageBits::DEPTH_STENCIL_ATTACHMENT;
@@ -673,7 +1805,41 @@ void Sample::CreateDepthTexture() {
     NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, &textureData, 1, nullptr, 0));
 }
 
+void Sample::CreateColorTexture(nri::Format swapChainFormat) {
+    CpuProfiler::Zone zone("CreateColorTexture");
+
+    nri::TextureDesc textureDesc = {};
+    textureDesc.type = nri::TextureType::TEXTURE_2D;
+    textureDesc.usage = nri::TextureUsageBits::COLOR_ATTACHMENT;
+    textureDesc.format = swapChainFormat;
+    textureDesc.width = (uint16_t)GetWindowResolution().x;
+    textureDesc.height = (uint16_t)GetWindowResolution().y;
+    textureDesc.mipNum = 1;
+
+    NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, m_ColorTexture));
+
+    nri::ResourceGroupDesc resourceGroupDesc = {};
+    resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+    resourceGroupDesc.textureNum = 1;
+    resourceGroupDesc.textures = &m_ColorTexture;
+
+    const size_t baseAllocation = m_MemoryAllocations.size();
+    m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
+    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+
+    nri::Texture2DViewDesc texture2DViewDesc = {m_ColorTexture, nri::Texture2DViewType::COLOR_ATTACHMENT, swapChainFormat};
+    NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texture2DViewDesc, m_ColorAttachment));
+
+    // Frames start with the state left by the copy to the back buffer
+    nri::TextureUploadDesc textureData = {};
+    textureData.texture = m_ColorTexture;
+    textureData.after = {nri::AccessBits::COPY_SOURCE, nri::Layout::COPY_SOURCE};
+    NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, &textureData, 1, nullptr, 0));
+}
+
 void Sample::CreateVertexBuffer() {
+    CpuProfiler::Zone zone("CreateVertexBuffer");
+
     const float boxHalfSize = 0.5f;
 
     std::vector<Vertex> vertices{
@@ -749,7 +1915,9 @@ void Sample::CreateVertexBuffer() {
     NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, nullptr, 0, bufferUpdates, helper::GetCountOf(bufferUpdates)));
 }
 
-void Sample::CreateTransformConstantBuffer() {
+void Sample::CreateTransformConstantBuffer(std::vector<float4x4>& transforms) {
+    CpuProfiler::Zone zone("CreateTransformConstantBuffer");
+
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
 
     const uint32_t matrixSize = uint32_t(sizeof(float4x4));
@@ -782,6 +1950,7 @@ void Sample::CreateTransformConstantBuffer() {
 
     constexpr uint32_t lineSize = 17;
 
+    transforms.resize(m_Boxes.size());
     for (size_t i = 0; i < m_Boxes.size(); i++) {
         Box& box = m_Boxes[i];
 
@@ -792,6 +1961,7 @@ void Sample::CreateTransformConstantBuffer() {
         const size_t y = i / lineSize;
         matrix.PreTranslation(float3(-1.35f * 0.5f * (lineSize - 1) + 1.35f * x, 8.0f + 1.25f * y, 0.0f));
         matrix.AddScale(float3(1.0f + 0.0001f * (rand() % 2001)));
+        transforms[i] = matrix;
 
         box.dynamicConstantBufferOffset = dynamicConstantBufferOffset;
         dynamicConstantBufferOffset += alignedMatrixSize;
@@ -806,31 +1976,148 @@ void Sample::CreateTransformConstantBuffer() {
 }
 
 void Sample::CreateDescriptorSets() {
+    CpuProfiler::Zone zone("CreateDescriptorSets");
+
+    m_TextureSets.resize(TEXTURE_SET_NUM);
+    for (TextureSet& textureSet : m_TextureSets) {
+        for (size_t j = 0; j < helper::GetCountOf(textureSet.textureIndices); j++)
+            textureSet.textureIndices[j] = (uint32_t)(rand() % m_TextureViews.size());
+
+        textureSet.materialConstantBufferIndex = (uint32_t)(rand() % m_FakeConstantBufferViews.size());
+    }
+
+    // A box sharing a descriptor set must use the same texture set
+    for (size_t i = 0; i < m_Boxes.size(); i++) {
+        Box& box = m_Boxes[i];
+        box.pipelineIndex = (uint32_t)((i / DRAW_CALLS_PER_PIPELINE) % m_Pipelines.size());
+        box.textureSetIndex = i < m_PerBoxDescriptorSetNum ? rand() % TEXTURE_SET_NUM : m_Boxes[i % m_PerBoxDescriptorSetNum].textureSetIndex;
+    }
+
     // DescriptorSet 0 (per box)
-    std::vector<nri::DescriptorSet*> descriptorSets(m_Boxes.size());
+    std::vector<nri::DescriptorSet*> descriptorSets(m_PerBoxDescriptorSetNum);
     NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, 0, descriptorSets.data(), (uint32_t)descriptorSets.size(), 0);
 
+    // Allocation is a single call, but updates of different sets are independent
+    m_JobScheduler.ParallelFor(m_PerBoxDescriptorSetNum, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            const Box& box = m_Boxes[i];
+            const TextureSet& textureSet = m_TextureSets[box.textureSetIndex];
+
+            nri::Descriptor* constantBuffers[] = {
+                m_FakeConstantBufferViews[0],
+                m_ViewConstantBufferView,
+                m_FakeConstantBufferViews[textureSet.materialConstantBufferIndex]};
+
+            const nri::Descriptor* textureViews[3] = {};
+            for (size_t j = 0; j < helper::GetCountOf(textureViews); j++)
+                textureViews[j] = m_TextureViews[textureSet.textureIndices[j]];
+
+            const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
+                {constantBuffers, helper::GetCountOf(constantBuffers)},
+                {textureViews, helper::GetCountOf(textureViews)}};
+
+            NRI.UpdateDescriptorRanges(*descriptorSets[i], 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+            NRI.UpdateDynamicConstantBuffers(*descriptorSets[i], 0, 1, &m_TransformConstantBufferView);
+        }
+    });
+
+    for (size_t i = 0; i < m_Boxes.size(); i++)
+        m_Boxes[i].descriptorSet = descriptorSets[i % m_PerBoxDescriptorSetNum];
+
+    // DescriptorSet 1 (shared)
+    {
+        const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
+            {&m_Sampler, 1}};
+
+        NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, 1, &m_DescriptorSetWithSharedSampler, 1, 0);
+        NRI.UpdateDescriptorRanges(*m_DescriptorSetWithSharedSampler, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+    }
+}
+
+void Sample::CreateInstanceGroups(const std::vector<float4x4>& transforms) {
+    CpuProfiler::Zone zone("CreateInstanceGroups");
+
+    // Sort boxes by (pipeline, texture set) with a counting sort, each non-empty bucket becomes a group
+    const uint32_t bucketNum = PIPELINE_NUM * TEXTURE_SET_NUM;
+    std::vector<uint32_t> bucketOffsets(bucketNum + 1, 0);
+    for (const Box& box : m_Boxes)
+        bucketOffsets[box.pipelineIndex * TEXTURE_SET_NUM + box.textureSetIndex + 1]++;
+
+    for (uint32_t i = 0; i < bucketNum; i++)
+        bucketOffsets[i + 1] += bucketOffsets[i];
+
+    std::vector<float4x4> sortedTransforms(m_Boxes.size());
+    std::vector<uint32_t> bucketCursors(bucketOffsets.begin(), bucketOffsets.end() - 1);
     for (size_t i = 0; i < m_Boxes.size(); i++) {
         Box& box = m_Boxes[i];
+        box.transformIndex = bucketCursors[box.pipelineIndex * TEXTURE_SET_NUM + box.textureSetIndex]++;
+        sortedTransforms[box.transformIndex] = transforms[i];
+    }
+
+    for (uint32_t i = 0; i < bucketNum; i++) {
+        const uint32_t instanceNum = bucketOffsets[i + 1] - bucketOffsets[i];
+        if (instanceNum)
+            m_InstanceGroups.push_back({nullptr, m_InstancedPipelines[i / TEXTURE_SET_NUM], bucketOffsets[i], instanceNum});
+    }
+
+    { // Transform buffer
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = helper::GetByteSizeOf(sortedTransforms);
+        bufferDesc.structureStride = sizeof(float4x4);
+        bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_TransformBuffer));
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_TransformBuffer;
+
+        const size_t baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
+        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+
+        nri::BufferViewDesc bufferViewDesc = {};
+        bufferViewDesc.viewType = nri::BufferViewType::SHADER_RESOURCE;
+        bufferViewDesc.buffer = m_TransformBuffer;
+        bufferViewDesc.size = bufferDesc.size;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, m_TransformBufferView));
+
+        nri::BufferUploadDesc bufferUpdate = {};
+        bufferUpdate.buffer = m_TransformBuffer;
+        bufferUpdate.data = sortedTransforms.data();
+        bufferUpdate.dataSize = bufferDesc.size;
+        bufferUpdate.after = {nri::AccessBits::SHADER_RESOURCE};
+        NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, nullptr, 0, &bufferUpdate, 1));
+    }
+
+    // DescriptorSet 0 (per group)
+    std::vector<nri::DescriptorSet*> descriptorSets(m_InstanceGroups.size());
+    NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_InstancedPipelineLayout, 0, descriptorSets.data(), (uint32_t)descriptorSets.size(), 0);
+
+    uint32_t groupIndex = 0;
+    for (uint32_t i = 0; i < bucketNum; i++) {
+        if (bucketOffsets[i + 1] == bucketOffsets[i])
+            continue;
+
+        const TextureSet& textureSet = m_TextureSets[i % TEXTURE_SET_NUM];
 
         nri::Descriptor* constantBuffers[] = {
             m_FakeConstantBufferViews[0],
             m_ViewConstantBufferView,
-            m_FakeConstantBufferViews[rand() % m_FakeConstantBufferViews.size()]};
+            m_FakeConstantBufferViews[textureSet.materialConstantBufferIndex]};
 
         const nri::Descriptor* textureViews[3] = {};
         for (size_t j = 0; j < helper::GetCountOf(textureViews); j++)
-            textureViews[j] = m_TextureViews[rand() % m_TextureViews.size()];
+            textureViews[j] = m_TextureViews[textureSet.textureIndices[j]];
 
         const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
             {constantBuffers, helper::GetCountOf(constantBuffers)},
-            {textureViews, helper::GetCountOf(textureViews)}};
-
-        box.pipeline = m_Pipelines[(i / DRAW_CALLS_PER_PIPELINE) % m_Pipelines.size()];
+            {textureViews, helper::GetCountOf(textureViews)},
+            {&m_TransformBufferView, 1}};
 
-        box.descriptorSet = descriptorSets[i];
-        NRI.UpdateDescriptorRanges(*box.descriptorSet, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
-        NRI.UpdateDynamicConstantBuffers(*box.descriptorSet, 0, 1, &m_TransformConstantBufferView);
+        InstanceGroup& group = m_InstanceGroups[groupIndex];
+        group.descriptorSet = descriptorSets[groupIndex++];
+        NRI.UpdateDescriptorRanges(*group.descriptorSet, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
     }
 
     // DescriptorSet 1 (shared)
@@ -838,25 +2125,173 @@ void Sample::CreateDescriptorSets() {
         const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
             {&m_Sampler, 1}};
 
-        NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, 1, &m_DescriptorSetWithSharedSampler, 1, 0);
-        NRI.UpdateDescriptorRanges(*m_DescriptorSetWithSharedSampler, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+        NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_InstancedPipelineLayout, 1, &m_InstancedDescriptorSetWithSharedSampler, 1, 0);
+        NRI.UpdateDescriptorRanges(*m_InstancedDescriptorSetWithSharedSampler, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+    }
+}
+
+void Sample::CreateBindlessResources() {
+    CpuProfiler::Zone zone("CreateBindlessResources");
+
+    if (!m_IsBindlessSupported)
+        return;
+
+    { // Material buffer, a structured buffer version of fake constant buffers
+        const uint32_t materialNum = (uint32_t)m_FakeConstantBufferViews.size();
+
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = materialNum * sizeof(float4);
+        bufferDesc.structureStride = sizeof(float4);
+        bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_MaterialBuffer));
+
+        nri::ResourceGroupDesc resourceGroupDesc = {};
+        resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+        resourceGroupDesc.bufferNum = 1;
+        resourceGroupDesc.buffers = &m_MaterialBuffer;
+
+        const size_t baseAllocation = m_MemoryAllocations.size();
+        m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
+        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
+
+        nri::BufferViewDesc bufferViewDesc = {};
+        bufferViewDesc.viewType = nri::BufferViewType::SHADER_RESOURCE;
+        bufferViewDesc.buffer = m_MaterialBuffer;
+        bufferViewDesc.size = bufferDesc.size;
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, m_MaterialBufferView));
+
+        std::vector<uint8_t> bufferContent((size_t)bufferDesc.size, 0);
+
+        nri::BufferUploadDesc bufferUpdate = {};
+        bufferUpdate.buffer = m_MaterialBuffer;
+        bufferUpdate.data = bufferContent.data();
+        bufferUpdate.dataSize = bufferContent.size();
+        bufferUpdate.after = {nri::AccessBits::SHADER_RESOURCE};
+        NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, nullptr, 0, &bufferUpdate, 1));
+    }
+
+    { // DescriptorSet 0 (buffers)
+        nri::Descriptor* constantBuffers[] = {
+            m_FakeConstantBufferViews[0],
+            m_ViewConstantBufferView};
+
+        nri::Descriptor* structuredBuffers[] = {
+            m_MaterialBufferView,
+            m_TransformBufferView};
+
+        const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
+            {constantBuffers, helper::GetCountOf(constantBuffers)},
+            {structuredBuffers, helper::GetCountOf(structuredBuffers)}};
+
+        NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_BindlessPipelineLayout, 0, &m_BindlessDescriptorSet, 1, 0);
+        NRI.UpdateDescriptorRanges(*m_BindlessDescriptorSet, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+    }
+
+    { // DescriptorSet 1 (shared)
+        const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
+            {&m_Sampler, 1}};
+
+        NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_BindlessPipelineLayout, 1, &m_BindlessDescriptorSetWithSharedSampler, 1, 0);
+        NRI.UpdateDescriptorRanges(*m_BindlessDescriptorSetWithSharedSampler, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+    }
+
+    { // DescriptorSet 2 (all textures)
+        const nri::DescriptorRangeUpdateDesc rangeUpdates[] = {
+            {m_TextureViews.data(), (uint32_t)m_TextureViews.size()}};
+
+        NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_BindlessPipelineLayout, 2, &m_BindlessTextureDescriptorSet, 1, TEXTURE_VARIATION_NUM);
+        NRI.UpdateDescriptorRanges(*m_BindlessTextureDescriptorSet, 0, helper::GetCountOf(rangeUpdates), rangeUpdates);
+    }
+
+    // Per box root constants, same textures and materials as in the per box mode
+    m_BindlessConstants.resize(m_Boxes.size());
+    for (size_t i = 0; i < m_Boxes.size(); i++) {
+        const Box& box = m_Boxes[i];
+        const TextureSet& textureSet = m_TextureSets[box.textureSetIndex];
+
+        BindlessConstants& constants = m_BindlessConstants[i];
+        constants.transformIndex = box.transformIndex;
+        for (size_t j = 0; j < helper::GetCountOf(constants.textureIndices); j++)
+            constants.textureIndices[j] = textureSet.textureIndices[j];
+        constants.materialIndex = textureSet.materialConstantBufferIndex;
     }
 }
 
 void Sample::CreateDescriptorPool() {
-    const uint32_t boxNum = (uint32_t)m_Boxes.size();
+    CpuProfiler::Zone zone("CreateDescriptorPool");
+
+    const uint32_t boxNum = m_PerBoxDescriptorSetNum;
+    const uint32_t instanceGroupMaxNum = PIPELINE_NUM * TEXTURE_SET_NUM;
+
+    // Each path has its own sets, including a shared sampler set
+    nri::DescriptorPoolDesc perBoxDescriptorPoolDesc = {};
+    perBoxDescriptorPoolDesc.constantBufferMaxNum = 3 * boxNum;
+    perBoxDescriptorPoolDesc.dynamicConstantBufferMaxNum = 1 * boxNum;
+    perBoxDescriptorPoolDesc.textureMaxNum = 3 * boxNum;
+    perBoxDescriptorPoolDesc.descriptorSetMaxNum = boxNum + 1;
+    perBoxDescriptorPoolDesc.samplerMaxNum = 1;
+
+    nri::DescriptorPoolDesc instancedDescriptorPoolDesc = {};
+    instancedDescriptorPoolDesc.constantBufferMaxNum = 3 * instanceGroupMaxNum;
+    instancedDescriptorPoolDesc.textureMaxNum = 3 * instanceGroupMaxNum;
+    instancedDescriptorPoolDesc.structuredBufferMaxNum = instanceGroupMaxNum;
+    instancedDescriptorPoolDesc.descriptorSetMaxNum = instanceGroupMaxNum + 1;
+    instancedDescriptorPoolDesc.samplerMaxNum = 1;
+
+    // Bindless needs 3 sets: buffers, sampler and all textures
+    nri::DescriptorPoolDesc bindlessDescriptorPoolDesc = {};
+    bindlessDescriptorPoolDesc.constantBufferMaxNum = 2;
+    bindlessDescriptorPoolDesc.textureMaxNum = TEXTURE_VARIATION_NUM;
+    bindlessDescriptorPoolDesc.structuredBufferMaxNum = 2;
+    bindlessDescriptorPoolDesc.descriptorSetMaxNum = 3;
+    bindlessDescriptorPoolDesc.samplerMaxNum = 1;
+
+    const nri::DescriptorPoolDesc* pathDescriptorPoolDescs[] = {&perBoxDescriptorPoolDesc, &instancedDescriptorPoolDesc, &bindlessDescriptorPoolDesc};
 
     nri::DescriptorPoolDesc descriptorPoolDesc = {};
-    descriptorPoolDesc.constantBufferMaxNum = 3 * boxNum;
-    descriptorPoolDesc.dynamicConstantBufferMaxNum = 1 * boxNum;
-    descriptorPoolDesc.textureMaxNum = 3 * boxNum;
-    descriptorPoolDesc.descriptorSetMaxNum = boxNum + 1;
-    descriptorPoolDesc.samplerMaxNum = 1;
+    for (const nri::DescriptorPoolDesc* pathDescriptorPoolDesc : pathDescriptorPoolDescs) {
+        descriptorPoolDesc.constantBufferMaxNum += pathDescriptorPoolDesc->constantBufferMaxNum;
+        descriptorPoolDesc.dynamicConstantBufferMaxNum += pathDescriptorPoolDesc->dynamicConstantBufferMaxNum;
+        descriptorPoolDesc.textureMaxNum += pathDescriptorPoolDesc->textureMaxNum;
+        descriptorPoolDesc.structuredBufferMaxNum += pathDescriptorPoolDesc->structuredBufferMaxNum;
+        descriptorPoolDesc.descriptorSetMaxNum += pathDescriptorPoolDesc->descriptorSetMaxNum;
+        descriptorPoolDesc.samplerMaxNum += pathDescriptorPoolDesc->samplerMaxNum;
+    }
 
     NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, descriptorPoolDesc, m_DescriptorPool));
+
+    DescriptorSizes descriptorSizes = {};
+    m_IsDescriptorMemorySizeKnown = GetDescriptorSizes(descriptorSizes);
+    m_PerBoxDescriptorMemorySize = GetDescriptorMemorySize(perBoxDescriptorPoolDesc, descriptorSizes);
+    m_InstancedDescriptorMemorySize = GetDescriptorMemorySize(instancedDescriptorPoolDesc, descriptorSizes);
+    m_BindlessDescriptorMemorySize = GetDescriptorMemorySize(bindlessDescriptorPoolDesc, descriptorSizes);
+}
+
+bool Sample::GetDescriptorSizes(DescriptorSizes& descriptorSizes) {
+#if _WIN32
+    if (NRI.GetDeviceDesc(*m_Device).graphicsAPI == nri::GraphicsAPI::D3D12) {
+        ID3D12Device* d3d12Device = (ID3D12Device*)NRI.GetDeviceNativeObject(*m_Device);
+
+        const uint32_t resourceDescriptorSize = d3d12Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+        descriptorSizes.constantBuffer = resourceDescriptorSize;
+        descriptorSizes.dynamicConstantBuffer = 0; // root descriptors, not in a heap
+        descriptorSizes.texture = resourceDescriptorSize;
+        descriptorSizes.structuredBuffer = resourceDescriptorSize;
+        descriptorSizes.sampler = d3d12Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER);
+
+        return true;
+    }
+#endif
+
+    // D3D11 views are driver objects without a known size, VK descriptor sizes are vendor specific and not exposed by NRI
+    (void)descriptorSizes;
+
+    return false;
 }
 
 void Sample::LoadTextures() {
+    CpuProfiler::Zone zone("LoadTextures");
+
     constexpr uint32_t textureNum = 8;
 
     std::vector<utils::Texture> loadedTextures(textureNum);
@@ -867,9 +2302,7 @@ void Sample::LoadTextures() {
             std::abort();
     }
 
-    const uint32_t textureVariations = 1024;
-
-    m_Textures.resize(textureVariations);
+    m_Textures.resize(TEXTURE_VARIATION_NUM);
     for (size_t i = 0; i < m_Textures.size(); i++) {
         const utils::Texture& texture = loadedTextures[i % textureNum];
 
@@ -922,6 +2355,8 @@ void Sample::LoadTextures() {
 }
 
 void Sample::CreateFakeConstantBuffers() {
+    CpuProfiler::Zone zone("CreateFakeConstantBuffers");
+
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
 
     const uint32_t constantRangeSize = (uint32_t)helper::Align(sizeof(float4), deviceDesc.constantBufferOffsetAlignment);
@@ -947,10 +2382,13 @@ void Sample::CreateFakeConstantBuffers() {
     constantBufferViewDesc.size = constantRangeSize;
 
     m_FakeConstantBufferViews.resize(fakeConstantBufferRangeNum);
-    for (size_t i = 0; i < m_FakeConstantBufferViews.size(); i++) {
-        NRI.CreateBufferView(constantBufferViewDesc, m_FakeConstantBufferViews[i]);
-        constantBufferViewDesc.offset += constantRangeSize;
-    }
+    m_JobScheduler.ParallelFor(fakeConstantBufferRangeNum, [&](uint32_t begin, uint32_t end) {
+        nri::BufferViewDesc viewDesc = constantBufferViewDesc;
+        for (uint32_t i = begin; i < end; i++) {
+            viewDesc.offset = (uint64_t)i * constantRangeSize;
+            NRI.CreateBufferView(viewDesc, m_FakeConstantBufferViews[i]);
+        }
+    });
 
     std::vector<uint8_t> bufferContent((size_t)bufferDesc.size, 0);
 
@@ -963,6 +2401,8 @@ void Sample::CreateFakeConstantBuffers() {
 }
 
 void Sample::CreateViewConstantBuffer() {
+    CpuProfiler::Zone zone("CreateViewConstantBuffer");
+
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
 
     const uint32_t constantRangeSize = (uint32_t)helper::Align(sizeof(float4x4), deviceDesc.constantBufferOffsetAlignment);
@@ -1014,49 +2454,208 @@ void Sample::SetupProjViewMatrix(float4x4& projViewMatrix) {
     projViewMatrix = projectionMatrix * viewMatrix;
 }
 
-uint32_t Sample::GetPhysicalCoreNum() const {
-#if _WIN32
-    const char* moduleName = "kernel32";
-    const char* funcName = "GetLogicalProcessorInformation";
+void Sample::InitBenchmark() {
+    // Measure recording throughput of per box paths, instancing and cached command buffers don't record boxes
+    m_IsMultithreadingEnabled = true;
+    m_IsRecordingCacheEnabled = false;
 
-    const HMODULE kernel32 = GetModuleHandleA(moduleName);
-    assert(kernel32 != nullptr);
+    std::vector<uint32_t> threadNums;
+    for (uint32_t threadNum = 1; threadNum < m_ThreadNum; threadNum *= 2)
+        threadNums.push_back(threadNum);
+    threadNums.push_back(m_ThreadNum);
 
-    void* address = (void*)GetProcAddress(kernel32, funcName);
-    assert(address != nullptr);
+    std::vector<uint32_t> boxNums = m_BenchmarkBoxNums;
+    if (boxNums.empty()) {
+        const uint32_t boxNum = (uint32_t)m_Boxes.size();
+        boxNums = {boxNum / 4, boxNum / 2, boxNum};
+    }
+    const uint32_t drawCallsPerPipelineNums[] = {1, DRAW_CALLS_PER_PIPELINE, 16 * DRAW_CALLS_PER_PIPELINE};
 
-    typedef BOOL(WINAPI * LPFN_GLPI)(PSYSTEM_LOGICAL_PROCESSOR_INFORMATION, PDWORD);
-    const LPFN_GLPI GetLogicalProcessorInformation = (LPFN_GLPI)address;
+    std::vector<int32_t> renderModes = {PER_BOX};
+    if (m_IsBindlessSupported)
+        renderModes.push_back(BINDLESS);
 
-    typedef SYSTEM_LOGICAL_PROCESSOR_INFORMATION Buffer;
-    Buffer* buffer = nullptr;
-    DWORD bufferSize = 0;
-    while (true) {
-        const DWORD res = GetLogicalProcessorInformation(buffer, &bufferSize);
-        if (res == TRUE)
-            break;
+    for (int32_t renderMode : renderModes) {
+        for (uint32_t boxNum : boxNums) {
+            for (uint32_t drawCallsPerPipeline : drawCallsPerPipelineNums) {
+                for (uint32_t threadNum : threadNums)
+                    m_BenchmarkConfigs.push_back({threadNum, std::max(boxNum, 1u), drawCallsPerPipeline, renderMode});
+            }
+        }
+    }
+
+    m_BenchmarkRecordingTimes.reserve(m_BenchmarkFrameNum);
+    m_BenchmarkSubmitTimes.reserve(m_BenchmarkFrameNum);
+
+    ApplyBenchmarkConfig();
+}
+
+void Sample::ApplyBenchmarkConfig() {
+    const BenchmarkConfig& config = m_BenchmarkConfigs[m_BenchmarkConfigIndex];
+    m_RecordingThreadNum = config.threadNum;
+    m_BoxNum = config.boxNum;
+    m_DrawCallsPerPipeline = config.drawCallsPerPipeline;
+    m_RenderMode = config.renderMode;
+
+    m_BenchmarkFrame = 0;
+    m_BenchmarkRecordingTimes.clear();
+    m_BenchmarkSubmitTimes.clear();
+}
+
+void Sample::UpdateBenchmark(uint32_t frameIndex) {
+    if (m_BenchmarkFrame++ >= m_BenchmarkWarmupFrameNum) {
+        m_BenchmarkRecordingTimes.push_back(m_RecordingTime);
+        m_BenchmarkSubmitTimes.push_back(m_SubmitTime);
+    }
+
+    if (m_BenchmarkRecordingTimes.size() < m_BenchmarkFrameNum)
+        return;
+
+    BenchmarkResult result = {};
+    result.config = m_BenchmarkConfigs[m_BenchmarkConfigIndex];
+    GetTimeStats(m_BenchmarkRecordingTimes, result.recordingMean, result.recordingP50, result.recordingP99);
+    GetTimeStats(m_BenchmarkSubmitTimes, result.submitMean, result.submitP50, result.submitP99);
+
+    // Times are in ms
+    if (result.recordingMean > 0.0)
+        result.drawsPerSecondPerThread = 1000.0 * result.config.boxNum / (result.recordingMean * result.config.threadNum);
 
-        GetLastError();
-        SetLastError(0);
+    m_BenchmarkResults.push_back(result);
 
-        free(buffer);
-        buffer = (Buffer*)malloc(bufferSize); // TODO: Use alloca?
+    printf("Benchmark %u/%u: mode = %s, threads = %u, boxes = %u, draw calls per pipeline = %u, recording = %.3f ms (p99 = %.3f ms)\n",
+        m_BenchmarkConfigIndex + 1, (uint32_t)m_BenchmarkConfigs.size(), RENDER_MODE_NAMES[result.config.renderMode],
+        result.config.threadNum, result.config.boxNum, result.config.drawCallsPerPipeline, result.recordingMean, result.recordingP99);
+
+    if (++m_BenchmarkConfigIndex < m_BenchmarkConfigs.size())
+        ApplyBenchmarkConfig();
+    else {
+        SaveBenchmarkResults();
+
+        // Stop the main loop after this frame
+        m_FrameNum = frameIndex + 1;
     }
+}
+
+void Sample::SaveBenchmarkResults() const {
+    const std::string csvPath = m_BenchmarkOutput + ".csv";
+    FILE* csv = fopen(csvPath.c_str(), "w");
+    if (csv) {
+        fprintf(csv, "mode,threads,boxes,drawCallsPerPipeline,recordingMeanMs,recordingP50Ms,recordingP99Ms,submitMeanMs,submitP50Ms,submitP99Ms,drawsPerSecondPerThread\n");
+
+        for (const BenchmarkResult& result : m_BenchmarkResults) {
+            fprintf(csv, "%s,%u,%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.1f\n",
+                RENDER_MODE_NAMES[result.config.renderMode], result.config.threadNum, result.config.boxNum, result.config.drawCallsPerPipeline,
+                result.recordingMean, result.recordingP50, result.recordingP99,
+                result.submitMean, result.submitP50, result.submitP99,
+                result.drawsPerSecondPerThread);
+        }
+
+        fclose(csv);
+    } else
+        printf("Can't open '%s'\n", csvPath.c_str());
+
+    const std::string jsonPath = m_BenchmarkOutput + ".json";
+    FILE* json = fopen(jsonPath.c_str(), "w");
+    if (json) {
+        fprintf(json, "{\n  \"affinity\": \"%s\",\n  \"warmupFrames\": %u,\n  \"frames\": %u,\n  \"results\": [\n",
+            AFFINITY_POLICY_CMD_NAMES[m_AffinityPolicy], m_BenchmarkWarmupFrameNum, m_BenchmarkFrameNum);
+
+        for (size_t i = 0; i < m_BenchmarkResults.size(); i++) {
+            const BenchmarkResult& result = m_BenchmarkResults[i];
+
+            fprintf(json, "    {\"mode\": \"%s\", \"threads\": %u, \"boxes\": %u, \"drawCallsPerPipeline\": %u, "
+                "\"recordingMs\": {\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f}, "
+                "\"submitMs\": {\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f}, "
+                "\"drawsPerSecondPerThread\": %.1f}%s\n",
+                RENDER_MODE_NAMES[result.config.renderMode], result.config.threadNum, result.config.boxNum, result.config.drawCallsPerPipeline,
+                result.recordingMean, result.recordingP50, result.recordingP99,
+                result.submitMean, result.submitP50, result.submitP99,
+                result.drawsPerSecondPerThread, i + 1 < m_BenchmarkResults.size() ? "," : "");
+        }
+
+        fprintf(json, "  ]\n}\n");
+        fclose(json);
+    } else
+        printf("Can't open '%s'\n", jsonPath.c_str());
+}
+
+void Sample::ApplyAffinityPolicy() {
+    // Logical cores in the order they are given to threads (thread 0 is the main thread)
+    std::vector<uint32_t> logicalCores;
+    if (m_AffinityPolicy == PHYSICAL_CORES) {
+        // SMT siblings are used only if there are more threads than physical cores
+        for (size_t sibling = 0;; sibling++) {
+            const size_t prevSize = logicalCores.size();
+            for (const std::vector<uint32_t>& physicalCore : m_PhysicalCores) {
+                if (sibling < physicalCore.size())
+                    logicalCores.push_back(physicalCore[sibling]);
+            }
 
-    uint32_t coreNum = 0;
-    char* ptr = (char*)buffer;
-    char* end = ptr + bufferSize;
-    for (; ptr < end; ptr += sizeof(Buffer)) {
-        Buffer* info = (Buffer*)ptr;
-        coreNum += (info->Relationship == RelationProcessorCore) ? 1 : 0;
+            if (logicalCores.size() == prevSize)
+                break;
+        }
+    } else if (m_AffinityPolicy == FILL_SMT) {
+        for (const std::vector<uint32_t>& physicalCore : m_PhysicalCores)
+            logicalCores.insert(logicalCores.end(), physicalCore.begin(), physicalCore.end());
     }
 
-    free(buffer);
+    const uint32_t threadNum = 1 + m_JobScheduler.GetWorkerNum();
+    for (uint32_t i = 0; i < threadNum; i++) {
+        const uint32_t logicalCore = logicalCores.empty() ? ANY_LOGICAL_CORE : logicalCores[i % logicalCores.size()];
+        const std::thread::native_handle_type thread = i ? m_JobScheduler.GetWorkerHandle(i - 1) : GetCurrentThreadHandle();
 
-    return coreNum;
-#else
-    return std::thread::hardware_concurrency();
+        SetThreadAffinity(thread, logicalCore);
+    }
+
+    // Variance must be measured for the new policy only
+    m_RecordingTimeHistoryFrameNum = 0;
+}
+
+void Sample::QueryCpuTopology() {
+    m_PhysicalCores.clear();
+
+#if _WIN32
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos;
+    GetLogicalProcessorInfos(infos);
+
+    for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos) {
+        // Logical cores the process is not allowed to run on are skipped
+        const ULONG_PTR processorMask = info.ProcessorMask & g_ProcessAffinityMask;
+        if (info.Relationship != RelationProcessorCore || !processorMask)
+            continue;
+
+        m_PhysicalCores.emplace_back();
+        for (uint32_t i = 0; i < sizeof(processorMask) * 8; i++) {
+            if (processorMask & (ULONG_PTR(1) << i))
+                m_PhysicalCores.back().push_back(i);
+        }
+    }
 #endif
+
+    // Linux exposes the topology in "/sys", otherwise (or if the query failed) each logical core is treated as a physical one
+    if (m_PhysicalCores.empty()) {
+        std::vector<uint64_t> coreKeys;
+        for (uint32_t i : GetAvailableLogicalCores()) {
+            uint32_t coreId = i;
+            uint32_t packageId = 0;
+#if __linux__
+            ReadCpuTopologyValue(i, "core_id", coreId);
+            ReadCpuTopologyValue(i, "physical_package_id", packageId);
+#endif
+
+            const uint64_t coreKey = ((uint64_t)packageId << 32) | coreId;
+            const size_t coreIndex = std::find(coreKeys.begin(), coreKeys.end(), coreKey) - coreKeys.begin();
+            if (coreIndex == coreKeys.size()) {
+                coreKeys.push_back(coreKey);
+                m_PhysicalCores.emplace_back();
+            }
+
+            m_PhysicalCores[coreIndex].push_back(i);
+        }
+    }
+
+    if (m_PhysicalCores.empty())
+        m_PhysicalCores.push_back({0});
 }
 
 SAMPLE_MAIN(Sample, 0);
@@ -2,6 +2,8 @@
 
 #include "NRIFramework.h"
 
+#include "Common/ConstantBufferRing.h"
+
 constexpr uint32_t VIEW_NUM = 2;
 constexpr nri::Color32f COLOR_0 = {1.0f, 1.0f, 0.0f, 1.0f};
 constexpr nri::Color32f COLOR_1 = {0.46f, 0.72f, 0.0f, 1.0f};
@@ -32,9 +34,6 @@ struct NRIInterface
 struct Frame {
     nri::CommandAllocator* commandAllocator;
     nri::CommandBuffer* commandBuffer;
-    nri::Descriptor* constantBufferView;
-    nri::DescriptorSet* constantBufferDescriptorSet;
-    uint64_t constantBufferViewOffset;
 };
 
 class Sample : public SampleBase {
@@ -58,15 +57,17 @@ private:
     nri::DescriptorPool* m_DescriptorPool = nullptr;
     nri::PipelineLayout* m_PipelineLayout = nullptr;
     nri::Pipeline* m_Pipeline = nullptr;
+    nri::DescriptorSet* m_ConstantBufferDescriptorSet = nullptr;
     nri::DescriptorSet* m_TextureDescriptorSet = nullptr;
     nri::Descriptor* m_TextureShaderResource = nullptr;
     nri::Descriptor* m_Sampler = nullptr;
     nri::Descriptor* m_MultiviewAttachment = nullptr;
-    nri::Buffer* m_ConstantBuffer = nullptr;
     nri::Buffer* m_GeometryBuffer = nullptr;
     nri::Texture* m_Texture = nullptr;
     nri::Texture* m_MultiviewTexture = nullptr;
 
+    ConstantBufferRing m_Constants;
+
     std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
     std::vector<BackBuffer> m_SwapChainBuffers;
     std::vector<nri::Memory*> m_MemoryAllocations;
@@ -82,7 +83,6 @@ Sample::~Sample() {
     for (Frame& frame : m_Frames) {
         NRI.DestroyCommandBuffer(*frame.commandBuffer);
         NRI.DestroyCommandAllocator(*frame.commandAllocator);
-        NRI.DestroyDescriptor(*frame.constantBufferView);
     }
 
     for (BackBuffer& backBuffer : m_SwapChainBuffers)
@@ -93,11 +93,11 @@ Sample::~Sample() {
     NRI.DestroyDescriptor(*m_MultiviewAttachment);
     NRI.DestroyDescriptor(*m_TextureShaderResource);
     NRI.DestroyDescriptor(*m_Sampler);
-    NRI.DestroyBuffer(*m_ConstantBuffer);
     NRI.DestroyBuffer(*m_GeometryBuffer);
     NRI.DestroyTexture(*m_Texture);
     NRI.DestroyTexture(*m_MultiviewTexture);
     NRI.DestroyDescriptorPool(*m_DescriptorPool);
+    m_Constants.Destroy(NRI);
     NRI.DestroyFence(*m_FrameFence);
     NRI.DestroySwapChain(*m_SwapChain);
     NRI.DestroyStreamer(*m_Streamer);
@@ -188,15 +188,14 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     // Pipeline
     utils::ShaderCodeStorage shaderCodeStorage;
     {
-        nri::DescriptorRangeDesc descriptorRangeConstant[1];
-        descriptorRangeConstant[0] = {0, 1, nri::DescriptorType::CONSTANT_BUFFER, nri::StageBits::ALL};
+        nri::DynamicConstantBufferDesc dynamicConstantBufferDesc = {0, nri::StageBits::ALL};
 
         nri::DescriptorRangeDesc descriptorRangeTexture[2];
         descriptorRangeTexture[0] = {0, 1, nri::DescriptorType::TEXTURE, nri::StageBits::FRAGMENT_SHADER};
         descriptorRangeTexture[1] = {0, 1, nri::DescriptorType::SAMPLER, nri::StageBits::FRAGMENT_SHADER};
 
         nri::DescriptorSetDesc descriptorSetDescs[] = {
-            {0, descriptorRangeConstant, helper::GetCountOf(descriptorRangeConstant)},
+            {0, nullptr, 0, &dynamicConstantBufferDesc, 1},
             {1, descriptorRangeTexture, helper::GetCountOf(descriptorRangeTexture)},
         };
 
@@ -274,8 +273,8 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
     { // Descriptor pool
         nri::DescriptorPoolDesc descriptorPoolDesc = {};
-        descriptorPoolDesc.descriptorSetMaxNum = BUFFERED_FRAME_MAX_NUM + 1;
-        descriptorPoolDesc.constantBufferMaxNum = BUFFERED_FRAME_MAX_NUM;
+        descriptorPoolDesc.descriptorSetMaxNum = 2;
+        descriptorPoolDesc.dynamicConstantBufferMaxNum = 1;
         descriptorPoolDesc.textureMaxNum = 1;
         descriptorPoolDesc.samplerMaxNum = 1;
 
@@ -289,7 +288,6 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         return false;
 
     // Resources
-    const uint32_t constantBufferSize = helper::Align((uint32_t)sizeof(ConstantBufferLayout), deviceDesc.constantBufferOffsetAlignment);
     const uint64_t indexDataSize = sizeof(g_IndexData);
     const uint64_t indexDataAlignedSize = helper::Align(indexDataSize, 16);
     const uint64_t vertexDataSize = sizeof(g_VertexData);
@@ -318,13 +316,6 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
             NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, m_MultiviewTexture));
         }
 
-        { // Constant buffer
-            nri::BufferDesc bufferDesc = {};
-            bufferDesc.size = constantBufferSize * BUFFERED_FRAME_MAX_NUM;
-            bufferDesc.usage = nri::BufferUsageBits::CONSTANT_BUFFER;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_ConstantBuffer));
-        }
-
         { // Geometry buffer
             nri::BufferDesc bufferDesc = {};
             bufferDesc.size = indexDataAlignedSize + vertexDataSize;
@@ -334,24 +325,20 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         m_GeometryOffset = indexDataAlignedSize;
     }
 
-    nri::ResourceGroupDesc resourceGroupDesc = {};
-    resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
-    resourceGroupDesc.bufferNum = 1;
-    resourceGroupDesc.buffers = &m_ConstantBuffer;
-
-    m_MemoryAllocations.resize(1, nullptr);
-    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data()));
+    // Constants (persistently mapped)
+    NRI_ABORT_ON_FALSE(m_Constants.Initialize(NRI, *m_Device, sizeof(ConstantBufferLayout), BUFFERED_FRAME_MAX_NUM, sizeof(ConstantBufferLayout)));
 
     nri::Texture* textures[2] = {m_Texture, m_MultiviewTexture};
 
+    nri::ResourceGroupDesc resourceGroupDesc = {};
     resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
     resourceGroupDesc.bufferNum = 1;
     resourceGroupDesc.buffers = &m_GeometryBuffer;
     resourceGroupDesc.textureNum = helper::GetCountOf(textures);
     resourceGroupDesc.textures = textures;
 
-    m_MemoryAllocations.resize(1 + NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
-    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + 1));
+    m_MemoryAllocations.resize(NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc), nullptr);
+    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data()));
 
     {     // Descriptors
         { // Read-only texture
@@ -372,18 +359,6 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
             samplerDesc.mipMax = 16.0f;
             NRI_ABORT_ON_FAILURE(NRI.CreateSampler(*m_Device, samplerDesc, m_Sampler));
         }
-
-        // Constant buffer
-        for (uint32_t i = 0; i < BUFFERED_FRAME_MAX_NUM; i++) {
-            nri::BufferViewDesc bufferViewDesc = {};
-            bufferViewDesc.buffer = m_ConstantBuffer;
-            bufferViewDesc.viewType = nri::BufferViewType::CONSTANT;
-            bufferViewDesc.offset = i * constantBufferSize;
-            bufferViewDesc.size = constantBufferSize;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, m_Frames[i].constantBufferView));
-
-            m_Frames[i].constantBufferViewOffset = bufferViewDesc.offset;
-        }
     }
 
     { // Descriptor sets
@@ -398,13 +373,11 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         descriptorRangeUpdateDescs[1].descriptors = &m_Sampler;
         NRI.UpdateDescriptorRanges(*m_TextureDescriptorSet, 0, helper::GetCountOf(descriptorRangeUpdateDescs), descriptorRangeUpdateDescs);
 
-        // Constant buffer
-        for (Frame& frame : m_Frames) {
-            NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, 0, &frame.constantBufferDescriptorSet, 1, 0));
+        // Constant buffer (a dynamic offset selects the block)
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, 0, &m_ConstantBufferDescriptorSet, 1, 0));
 
-            nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc = {&frame.constantBufferView, 1};
-            NRI.UpdateDescriptorRanges(*frame.constantBufferDescriptorSet, 0, 1, &descriptorRangeUpdateDesc);
-        }
+        nri::Descriptor* constantBufferView = m_Constants.GetView();
+        NRI.UpdateDynamicConstantBuffers(*m_ConstantBufferDescriptorSet, 0, 1, &constantBufferView);
     }
 
     { // Upload data
@@ -470,15 +443,18 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     const uint32_t currentTextureIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
     BackBuffer& currentBackBuffer = m_SwapChainBuffers[currentTextureIndex];
 
-    ConstantBufferLayout* commonConstants = (ConstantBufferLayout*)NRI.MapBuffer(*m_ConstantBuffer, frame.constantBufferViewOffset, sizeof(ConstantBufferLayout));
-    if (commonConstants) {
-        commonConstants->color[0] = 0.8f;
-        commonConstants->color[1] = 0.5f;
-        commonConstants->color[2] = 0.1f;
-        commonConstants->scale = m_Scale;
-
-        NRI.UnmapBuffer(*m_ConstantBuffer);
+    uint32_t constantBufferOffset = 0;
+    m_Constants.BeginFrame(NRI, frameIndex);
+    {
+        ConstantBufferLayout* commonConstants = m_Constants.Allocate<ConstantBufferLayout>(constantBufferOffset);
+        if (commonConstants) {
+            commonConstants->color[0] = 0.8f;
+            commonConstants->color[1] = 0.5f;
+            commonConstants->color[2] = 0.1f;
+            commonConstants->scale = m_Scale;
+        }
     }
+    m_Constants.EndFrame(NRI);
 
     // Record
     nri::CommandBuffer* commandBuffer = frame.commandBuffer;
@@ -537,7 +513,7 @@ void Sample::RenderFrame(uint32_t frameIndex) {
                 NRI.CmdSetRootConstants(*commandBuffer, 0, &m_Transparency, 4);
                 NRI.CmdSetIndexBuffer(*commandBuffer, *m_GeometryBuffer, 0, nri::IndexType::UINT16);
                 NRI.CmdSetVertexBuffers(*commandBuffer, 0, 1, &m_GeometryBuffer, &m_GeometryOffset);
-                NRI.CmdSetDescriptorSet(*commandBuffer, 0, *frame.constantBufferDescriptorSet, nullptr);
+                NRI.CmdSetDescriptorSet(*commandBuffer, 0, *m_ConstantBufferDescriptorSet, &constantBufferOffset);
                 NRI.CmdSetDescriptorSet(*commandBuffer, 1, *m_TextureDescriptorSet, nullptr);
 
                 const nri::Viewport viewport = {0.0f, 0.0f, (float)w2, (float)h, 0.0f, 1.0f};
@@ -2,6 +2,9 @@
 
 #include "NRIFramework.h"
 
+#include "Common/GpuProfiler.h"
+#include "Common/MemoryAllocator.h"
+
 #include <array>
 
 constexpr auto BUILD_FLAGS = nri::AccelerationStructureBuildBits::PREFER_FAST_TRACE;
@@ -37,8 +40,8 @@ private:
     void CreateBottomLevelAccelerationStructure();
     void CreateTopLevelAccelerationStructure();
     void CreateShaderTable();
-    void CreateUploadBuffer(uint64_t size, nri::BufferUsageBits usage, nri::Buffer*& buffer, nri::Memory*& memory);
-    void CreateScratchBuffer(nri::AccelerationStructure& accelerationStructure, nri::Buffer*& buffer, nri::Memory*& memory);
+    void CreateUploadBuffer(uint64_t size, nri::BufferUsageBits usage, nri::Buffer*& buffer, MemoryAllocation& allocation);
+    void CreateScratchBuffer(nri::AccelerationStructure& accelerationStructure, nri::Buffer*& buffer, MemoryAllocation& allocation);
     void BuildBottomLevelAccelerationStructure(nri::AccelerationStructure& accelerationStructure, const nri::GeometryObject* objects, const uint32_t objectNum);
     void BuildTopLevelAccelerationStructure(nri::AccelerationStructure& accelerationStructure, uint32_t instanceNum, nri::Buffer& instanceBuffer);
 
@@ -48,13 +51,13 @@ private:
     nri::Queue* m_GraphicsQueue = nullptr;
     nri::Fence* m_FrameFence = nullptr;
 
+    GpuProfiler m_GpuProfiler;
     std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
 
     nri::Pipeline* m_Pipeline = nullptr;
     nri::PipelineLayout* m_PipelineLayout = nullptr;
 
     nri::Buffer* m_ShaderTable = nullptr;
-    nri::Memory* m_ShaderTableMemory = nullptr;
     uint64_t m_ShaderGroupIdentifierSize = 0;
     uint64_t m_MissShaderOffset = 0;
     uint64_t m_HitShaderGroupOffset = 0;
@@ -68,12 +71,10 @@ private:
     nri::AccelerationStructure* m_BLAS = nullptr;
     nri::AccelerationStructure* m_TLAS = nullptr;
     nri::Descriptor* m_TLASDescriptor = nullptr;
-    nri::Memory* m_BLASMemory = nullptr;
-    nri::Memory* m_TLASMemory = nullptr;
 
     const BackBuffer* m_BackBuffer = nullptr;
     std::vector<BackBuffer> m_SwapChainBuffers;
-    std::vector<nri::Memory*> m_MemoryAllocations;
+    MemoryAllocator m_MemoryAllocator;
 };
 
 Sample::~Sample() {
@@ -104,12 +105,11 @@ Sample::~Sample() {
 
     NRI.DestroySwapChain(*m_SwapChain);
 
-    for (size_t i = 0; i < m_MemoryAllocations.size(); i++)
-        NRI.FreeMemory(*m_MemoryAllocations[i]);
+    // The sample has no UI, the latest GPU timings are saved on exit
+    m_GpuProfiler.SaveJson("GpuProfile.json");
+    m_GpuProfiler.Destroy(NRI);
 
-    NRI.FreeMemory(*m_BLASMemory);
-    NRI.FreeMemory(*m_TLASMemory);
-    NRI.FreeMemory(*m_ShaderTableMemory);
+    m_MemoryAllocator.Destroy(NRI);
 
     DestroyUI(NRI);
 
@@ -138,6 +138,9 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     NRI_ABORT_ON_FAILURE(NRI.GetQueue(*m_Device, nri::QueueType::GRAPHICS, 0, m_GraphicsQueue));
     NRI_ABORT_ON_FAILURE(NRI.CreateFence(*m_Device, 0, m_FrameFence));
 
+    m_MemoryAllocator.Initialize(*m_Device);
+    NRI_ABORT_ON_FALSE(m_GpuProfiler.Initialize(NRI, *m_Device, BUFFERED_FRAME_MAX_NUM));
+
     CreateCommandBuffers();
 
     nri::Format swapChainFormat = nri::Format::UNKNOWN;
@@ -154,6 +157,7 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 }
 
 void Sample::PrepareFrame(uint32_t) {
+    m_GpuProfiler.Update(NRI, *m_FrameFence);
 }
 
 void Sample::RenderFrame(uint32_t frameIndex) {
@@ -171,48 +175,58 @@ void Sample::RenderFrame(uint32_t frameIndex) {
     nri::TextureBarrierDesc textureTransitions[2] = {};
     nri::BarrierGroupDesc barrierGroupDesc = {};
 
+    m_GpuProfiler.BeginFrame(frameIndex);
+
     // Record
     nri::CommandBuffer& commandBuffer = *frame.commandBuffer;
     NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
     {
-        // Rendering
-        textureTransitions[0].texture = m_BackBuffer->texture;
-        textureTransitions[0].after = {nri::AccessBits::COPY_DESTINATION, nri::Layout::COPY_DESTINATION};
-        textureTransitions[0].layerNum = 1;
-        textureTransitions[0].mipNum = 1;
-
-        textureTransitions[1].texture = m_RayTracingOutput;
-        textureTransitions[1].before = {frameIndex == 0 ? nri::AccessBits::UNKNOWN : nri::AccessBits::COPY_SOURCE, frameIndex == 0 ? nri::Layout::UNKNOWN : nri::Layout::COPY_SOURCE};
-        textureTransitions[1].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::Layout::SHADER_RESOURCE_STORAGE};
-        textureTransitions[1].layerNum = 1;
-        textureTransitions[1].mipNum = 1;
+        m_GpuProfiler.CmdResetQueries(NRI, commandBuffer);
 
-        barrierGroupDesc.textures = textureTransitions;
-        barrierGroupDesc.textureNum = 2;
+        { // Rendering
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Ray tracing");
 
-        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
-        NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
-        NRI.CmdSetPipeline(commandBuffer, *m_Pipeline);
-        NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DescriptorSet, nullptr);
-
-        nri::DispatchRaysDesc dispatchRaysDesc = {};
-        dispatchRaysDesc.raygenShader = {m_ShaderTable, 0, m_ShaderGroupIdentifierSize, m_ShaderGroupIdentifierSize};
-        dispatchRaysDesc.missShaders = {m_ShaderTable, m_MissShaderOffset, m_ShaderGroupIdentifierSize, m_ShaderGroupIdentifierSize};
-        dispatchRaysDesc.hitShaderGroups = {m_ShaderTable, m_HitShaderGroupOffset, m_ShaderGroupIdentifierSize, m_ShaderGroupIdentifierSize};
-        dispatchRaysDesc.x = (uint16_t)GetWindowResolution().x;
-        dispatchRaysDesc.y = (uint16_t)GetWindowResolution().y;
-        dispatchRaysDesc.z = 1;
-        NRI.CmdDispatchRays(commandBuffer, dispatchRaysDesc);
-
-        // Copy
-        textureTransitions[1].before = textureTransitions[1].after;
-        textureTransitions[1].after = {nri::AccessBits::COPY_SOURCE, nri::Layout::COPY_SOURCE};
-
-        barrierGroupDesc.textures = textureTransitions + 1;
-        barrierGroupDesc.textureNum = 1;
+            textureTransitions[0].texture = m_BackBuffer->texture;
+            textureTransitions[0].after = {nri::AccessBits::COPY_DESTINATION, nri::Layout::COPY_DESTINATION};
+            textureTransitions[0].layerNum = 1;
+            textureTransitions[0].mipNum = 1;
 
-        NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
-        NRI.CmdCopyTexture(commandBuffer, *m_BackBuffer->texture, nullptr, *m_RayTracingOutput, nullptr);
+            textureTransitions[1].texture = m_RayTracingOutput;
+            textureTransitions[1].before = {frameIndex == 0 ? nri::AccessBits::UNKNOWN : nri::AccessBits::COPY_SOURCE, frameIndex == 0 ? nri::Layout::UNKNOWN : nri::Layout::COPY_SOURCE};
+            textureTransitions[1].after = {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::Layout::SHADER_RESOURCE_STORAGE};
+            textureTransitions[1].layerNum = 1;
+            textureTransitions[1].mipNum = 1;
+
+            barrierGroupDesc.textures = textureTransitions;
+            barrierGroupDesc.textureNum = 2;
+
+            NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+            NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+            NRI.CmdSetPipeline(commandBuffer, *m_Pipeline);
+            NRI.CmdSetDescriptorSet(commandBuffer, 0, *m_DescriptorSet, nullptr);
+
+            nri::DispatchRaysDesc dispatchRaysDesc = {};
+            dispatchRaysDesc.raygenShader = {m_ShaderTable, 0, m_ShaderGroupIdentifierSize, m_ShaderGroupIdentifierSize};
+            dispatchRaysDesc.missShaders = {m_ShaderTable, m_MissShaderOffset, m_ShaderGroupIdentifierSize, m_ShaderGroupIdentifierSize};
+            dispatchRaysDesc.hitShaderGroups = {m_ShaderTable, m_HitShaderGroupOffset, m_ShaderGroupIdentifierSize, m_ShaderGroupIdentifierSize};
+            dispatchRaysDesc.x = (uint16_t)GetWindowResolution().x;
+            dispatchRaysDesc.y = (uint16_t)GetWindowResolution().y;
+            dispatchRaysDesc.z = 1;
+            NRI.CmdDispatchRays(commandBuffer, dispatchRaysDesc);
+        }
+
+        { // Copy
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Copy");
+
+            textureTransitions[1].before = textureTransitions[1].after;
+            textureTransitions[1].after = {nri::AccessBits::COPY_SOURCE, nri::Layout::COPY_SOURCE};
+
+            barrierGroupDesc.textures = textureTransitions + 1;
+            barrierGroupDesc.textureNum = 1;
+
+            NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+            NRI.CmdCopyTexture(commandBuffer, *m_BackBuffer->texture, nullptr, *m_RayTracingOutput, nullptr);
+        }
 
         // Present
         textureTransitions[0].before = textureTransitions[0].after;
@@ -222,6 +236,8 @@ void Sample::RenderFrame(uint32_t frameIndex) {
         barrierGroupDesc.textureNum = 1;
 
         NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+        m_GpuProfiler.CmdEndFrame(NRI, commandBuffer);
     }
     NRI.EndCommandBuffer(commandBuffer);
 
@@ -338,19 +354,8 @@ void Sample::CreateRayTracingOutput(nri::Format swapChainFormat) {
     rayTracingOutputDesc.usage = nri::TextureUsageBits::SHADER_RESOURCE_STORAGE;
     NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, rayTracingOutputDesc, m_RayTracingOutput));
 
-    nri::MemoryDesc memoryDesc = {};
-    NRI.GetTextureMemoryDesc(*m_RayTracingOutput, nri::MemoryLocation::DEVICE, memoryDesc);
-
-    nri::AllocateMemoryDesc allocateMemoryDesc = {};
-    allocateMemoryDesc.size = memoryDesc.size;
-    allocateMemoryDesc.type = memoryDesc.type;
-
-    nri::Memory* memory = nullptr;
-    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, allocateMemoryDesc, memory));
-    m_MemoryAllocations.push_back(memory);
-
-    const nri::TextureMemoryBindingDesc memoryBindingDesc = {memory, m_RayTracingOutput};
-    NRI_ABORT_ON_FAILURE(NRI.BindTextureMemory(*m_Device, &memoryBindingDesc, 1));
+    MemoryAllocation allocation = {};
+    NRI_ABORT_ON_FALSE(m_MemoryAllocator.AllocateAndBindTexture(NRI, *m_RayTracingOutput, nri::MemoryLocation::DEVICE, allocation));
 
     nri::Texture2DViewDesc textureViewDesc = {m_RayTracingOutput, nri::Texture2DViewType::SHADER_RESOURCE_STORAGE_2D, swapChainFormat};
     NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(textureViewDesc, m_RayTracingOutputView));
@@ -374,8 +379,8 @@ void Sample::CreateBottomLevelAccelerationStructure() {
     const uint64_t indexDataSize = 3 * sizeof(uint16_t);
 
     nri::Buffer* buffer = nullptr;
-    nri::Memory* memory = nullptr;
-    CreateUploadBuffer(vertexDataSize + indexDataSize, nri::BufferUsageBits::ACCELERATION_STRUCTURE_BUILD_INPUT, buffer, memory);
+    MemoryAllocation uploadAllocation = {};
+    CreateUploadBuffer(vertexDataSize + indexDataSize, nri::BufferUsageBits::ACCELERATION_STRUCTURE_BUILD_INPUT, buffer, uploadAllocation);
 
     const float positions[] = {-0.5f, -0.5f, 0.0f, 0.0f, 0.5f, 0.0f, 0.5f, -0.5f, 0.0f};
     const uint16_t indices[] = {0, 1, 2};
@@ -405,21 +410,13 @@ void Sample::CreateBottomLevelAccelerationStructure() {
 
     NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, accelerationStructureBLASDesc, m_BLAS));
 
-    nri::MemoryDesc memoryDesc = {};
-    NRI.GetAccelerationStructureMemoryDesc(*m_BLAS, nri::MemoryLocation::DEVICE, memoryDesc);
-
-    nri::AllocateMemoryDesc allocateMemoryDesc = {};
-    allocateMemoryDesc.size = memoryDesc.size;
-    allocateMemoryDesc.type = memoryDesc.type;
-    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, allocateMemoryDesc, m_BLASMemory));
-
-    const nri::AccelerationStructureMemoryBindingDesc memoryBindingDesc = {m_BLASMemory, m_BLAS};
-    NRI_ABORT_ON_FAILURE(NRI.BindAccelerationStructureMemory(*m_Device, &memoryBindingDesc, 1));
+    MemoryAllocation allocation = {};
+    NRI_ABORT_ON_FALSE(m_MemoryAllocator.AllocateAndBindAccelerationStructure(NRI, NRI, *m_BLAS, allocation));
 
     BuildBottomLevelAccelerationStructure(*m_BLAS, &object, 1);
 
     NRI.DestroyBuffer(*buffer);
-    NRI.FreeMemory(*memory);
+    m_MemoryAllocator.Free(NRI, uploadAllocation);
 }
 
 void Sample::CreateTopLevelAccelerationStructure() {
@@ -429,20 +426,12 @@ void Sample::CreateTopLevelAccelerationStructure() {
     accelerationStructureTLASDesc.instanceOrGeometryObjectNum = 1;
     NRI_ABORT_ON_FAILURE(NRI.CreateAccelerationStructure(*m_Device, accelerationStructureTLASDesc, m_TLAS));
 
-    nri::MemoryDesc memoryDesc = {};
-    NRI.GetAccelerationStructureMemoryDesc(*m_TLAS, nri::MemoryLocation::DEVICE, memoryDesc);
-
-    nri::AllocateMemoryDesc allocateMemoryDesc = {};
-    allocateMemoryDesc.size = memoryDesc.size;
-    allocateMemoryDesc.type = memoryDesc.type;
-    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, allocateMemoryDesc, m_TLASMemory));
-
-    const nri::AccelerationStructureMemoryBindingDesc memoryBindingDesc = {m_TLASMemory, m_TLAS};
-    NRI_ABORT_ON_FAILURE(NRI.BindAccelerationStructureMemory(*m_Device, &memoryBindingDesc, 1));
+    MemoryAllocation allocation = {};
+    NRI_ABORT_ON_FALSE(m_MemoryAllocator.AllocateAndBindAccelerationStructure(NRI, NRI, *m_TLAS, allocation));
 
     nri::Buffer* buffer = nullptr;
-    nri::Memory* memory = nullptr;
-    CreateUploadBuffer(sizeof(nri::GeometryObjectInstance), nri::BufferUsageBits::ACCELERATION_STRUCTURE_BUILD_INPUT, buffer, memory);
+    MemoryAllocation uploadAllocation = {};
+    CreateUploadBuffer(sizeof(nri::GeometryObjectInstance), nri::BufferUsageBits::ACCELERATION_STRUCTURE_BUILD_INPUT, buffer, uploadAllocation);
 
     nri::GeometryObjectInstance geometryObjectInstance = {};
     geometryObjectInstance.accelerationStructureHandle = NRI.GetAccelerationStructureHandle(*m_BLAS);
@@ -459,7 +448,7 @@ void Sample::CreateTopLevelAccelerationStructure() {
     BuildTopLevelAccelerationStructure(*m_TLAS, 1, *buffer);
 
     NRI.DestroyBuffer(*buffer);
-    NRI.FreeMemory(*memory);
+    m_MemoryAllocator.Free(NRI, uploadAllocation);
 
     NRI.CreateAccelerationStructureDescriptor(*m_TLAS, m_TLASDescriptor);
 
@@ -467,44 +456,24 @@ void Sample::CreateTopLevelAccelerationStructure() {
     NRI.UpdateDescriptorRanges(*m_DescriptorSet, 1, 1, &descriptorRangeUpdateDesc);
 }
 
-void Sample::CreateUploadBuffer(uint64_t size, nri::BufferUsageBits usage, nri::Buffer*& buffer, nri::Memory*& memory) {
-    nri::BufferDesc bufferDesc = {size, 0, usage};
+void Sample::CreateUploadBuffer(uint64_t size, nri::BufferUsageBits usage, nri::Buffer*& buffer, MemoryAllocation& allocation) {
+    const nri::BufferDesc bufferDesc = {size, 0, usage};
     NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
-
-    nri::MemoryDesc memoryDesc = {};
-    NRI.GetBufferMemoryDesc(*buffer, nri::MemoryLocation::HOST_UPLOAD, memoryDesc);
-
-    nri::AllocateMemoryDesc allocateMemoryDesc = {};
-    allocateMemoryDesc.size = memoryDesc.size;
-    allocateMemoryDesc.type = memoryDesc.type;
-    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, allocateMemoryDesc, memory));
-
-    nri::BufferMemoryBindingDesc bufferMemoryBindingDesc = {memory, buffer};
-    NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1));
+    NRI_ABORT_ON_FALSE(m_MemoryAllocator.AllocateAndBindBuffer(NRI, *buffer, nri::MemoryLocation::HOST_UPLOAD, allocation));
 }
 
-void Sample::CreateScratchBuffer(nri::AccelerationStructure& accelerationStructure, nri::Buffer*& buffer, nri::Memory*& memory) {
-    uint64_t scratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(accelerationStructure);
+void Sample::CreateScratchBuffer(nri::AccelerationStructure& accelerationStructure, nri::Buffer*& buffer, MemoryAllocation& allocation) {
+    const uint64_t scratchBufferSize = NRI.GetAccelerationStructureBuildScratchBufferSize(accelerationStructure);
 
-    nri::BufferDesc bufferDesc = {scratchBufferSize, 0, nri::BufferUsageBits::SCRATCH_BUFFER};
+    const nri::BufferDesc bufferDesc = {scratchBufferSize, 0, nri::BufferUsageBits::SCRATCH_BUFFER};
     NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
-
-    nri::MemoryDesc memoryDesc = {};
-    NRI.GetBufferMemoryDesc(*buffer, nri::MemoryLocation::DEVICE, memoryDesc);
-
-    nri::AllocateMemoryDesc allocateMemoryDesc = {};
-    allocateMemoryDesc.size = memoryDesc.size;
-    allocateMemoryDesc.type = memoryDesc.type;
-    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, allocateMemoryDesc, memory));
-
-    nri::BufferMemoryBindingDesc bufferMemoryBindingDesc = {memory, buffer};
-    NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1));
+    NRI_ABORT_ON_FALSE(m_MemoryAllocator.AllocateAndBindBuffer(NRI, *buffer, nri::MemoryLocation::DEVICE, allocation));
 }
 
 void Sample::BuildBottomLevelAccelerationStructure(nri::AccelerationStructure& accelerationStructure, const nri::GeometryObject* objects, const uint32_t objectNum) {
     nri::Buffer* scratchBuffer = nullptr;
-    nri::Memory* scratchBufferMemory = nullptr;
-    CreateScratchBuffer(accelerationStructure, scratchBuffer, scratchBufferMemory);
+    MemoryAllocation scratchAllocation = {};
+    CreateScratchBuffer(accelerationStructure, scratchBuffer, scratchAllocation);
 
     nri::CommandAllocator* commandAllocator = nullptr;
     nri::CommandBuffer* commandBuffer = nullptr;
@@ -525,13 +494,13 @@ void Sample::BuildBottomLevelAccelerationStructure(nri::AccelerationStructure& a
     NRI.DestroyCommandAllocator(*commandAllocator);
 
     NRI.DestroyBuffer(*scratchBuffer);
-    NRI.FreeMemory(*scratchBufferMemory);
+    m_MemoryAllocator.Free(NRI, scratchAllocation);
 }
 
 void Sample::BuildTopLevelAccelerationStructure(nri::AccelerationStructure& accelerationStructure, uint32_t instanceNum, nri::Buffer& instanceBuffer) {
     nri::Buffer* scratchBuffer = nullptr;
-    nri::Memory* scratchBufferMemory = nullptr;
-    CreateScratchBuffer(accelerationStructure, scratchBuffer, scratchBufferMemory);
+    MemoryAllocation scratchAllocation = {};
+    CreateScratchBuffer(accelerationStructure, scratchBuffer, scratchAllocation);
 
     nri::CommandAllocator* commandAllocator = nullptr;
     nri::CommandBuffer* commandBuffer = nullptr;
@@ -552,7 +521,7 @@ void Sample::BuildTopLevelAccelerationStructure(nri::AccelerationStructure& acce
     NRI.DestroyCommandAllocator(*commandAllocator);
 
     NRI.DestroyBuffer(*scratchBuffer);
-    NRI.FreeMemory(*scratchBufferMemory);
+    m_MemoryAllocator.Free(NRI, scratchAllocation);
 }
 
 void Sample::CreateShaderTable() {
@@ -568,20 +537,12 @@ void Sample::CreateShaderTable() {
     const nri::BufferDesc bufferDesc = {shaderTableSize, 0, nri::BufferUsageBits::SHADER_BINDING_TABLE};
     NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_ShaderTable));
 
-    nri::MemoryDesc memoryDesc = {};
-    NRI.GetBufferMemoryDesc(*m_ShaderTable, nri::MemoryLocation::DEVICE, memoryDesc);
-
-    nri::AllocateMemoryDesc allocateMemoryDesc = {};
-    allocateMemoryDesc.size = memoryDesc.size;
-    allocateMemoryDesc.type = memoryDesc.type;
-    NRI_ABORT_ON_FAILURE(NRI.AllocateMemory(*m_Device, allocateMemoryDesc, m_ShaderTableMemory));
-
-    const nri::BufferMemoryBindingDesc bufferMemoryBindingDesc = {m_ShaderTableMemory, m_ShaderTable};
-    NRI_ABORT_ON_FAILURE(NRI.BindBufferMemory(*m_Device, &bufferMemoryBindingDesc, 1));
+    MemoryAllocation allocation = {};
+    NRI_ABORT_ON_FALSE(m_MemoryAllocator.AllocateAndBindBuffer(NRI, *m_ShaderTable, nri::MemoryLocation::DEVICE, allocation));
 
     nri::Buffer* buffer = nullptr;
-    nri::Memory* memory = nullptr;
-    CreateUploadBuffer(shaderTableSize, nri::BufferUsageBits::NONE, buffer, memory);
+    MemoryAllocation uploadAllocation = {};
+    CreateUploadBuffer(shaderTableSize, nri::BufferUsageBits::NONE, buffer, uploadAllocation);
 
     uint8_t* data = (uint8_t*)NRI.MapBuffer(*buffer, 0, shaderTableSize);
     for (uint32_t i = 0; i < 3; i++)
@@ -607,7 +568,7 @@ void Sample::CreateShaderTable() {
     NRI.DestroyCommandAllocator(*commandAllocator);
 
     NRI.DestroyBuffer(*buffer);
-    NRI.FreeMemory(*memory);
+    m_MemoryAllocator.Free(NRI, uploadAllocation);
 }
 
 SAMPLE_MAIN(Sample, 0);
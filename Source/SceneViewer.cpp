@@ -3,17 +3,29 @@
 #include "NRICompatibility.hlsli"
 #include "NRIFramework.h"
 
+#include "Common/ConstantBufferRing.h"
+#include "Common/GpuProfiler.h"
+#include "Common/JobScheduler.h"
+#include "Common/QueryReadbackRing.h"
+#include "Common/SceneCache.h"
+
+#include <algorithm>
 #include <array>
+#include <string.h>
+#include <xmmintrin.h>
 
 constexpr uint32_t GLOBAL_DESCRIPTOR_SET = 0;
 constexpr uint32_t MATERIAL_DESCRIPTOR_SET = 1;
 constexpr float CLEAR_DEPTH = 0.0f;
 constexpr uint32_t TEXTURES_PER_MATERIAL = 4;
+constexpr uint32_t THREAD_MAX_NUM = 16;
+
+constexpr uint32_t INDEX_BUFFER = 0;
+constexpr uint32_t VERTEX_BUFFER = 1;
 
-constexpr uint32_t CONSTANT_BUFFER = 0;
-constexpr uint32_t READBACK_BUFFER = 1;
-constexpr uint32_t INDEX_BUFFER = 2;
-constexpr uint32_t VERTEX_BUFFER = 3;
+constexpr uint32_t OPAQUE_PIPELINE = 0;
+constexpr uint32_t ALPHA_OPAQUE_PIPELINE = 1;
+constexpr uint32_t TRANSPARENT_PIPELINE = 2;
 
 struct NRIInterface
     : public nri::CoreInterface,
@@ -29,9 +41,160 @@ struct GlobalConstantBufferLayout {
 struct Frame {
     nri::CommandAllocator* commandAllocator;
     nri::CommandBuffer* commandBuffer;
-    uint32_t globalConstantBufferViewOffsets;
+
+    // Slices recorded by workers, the last slice goes to "commandBuffer"
+    std::array<nri::CommandAllocator*, THREAD_MAX_NUM - 1> workerCommandAllocators;
+    std::array<nri::CommandBuffer*, THREAD_MAX_NUM - 1> workerCommandBuffers;
+};
+
+// Written by the thread recording the slice, summed after recording
+struct SliceStats {
+    uint32_t pipelineSwitchNum;
+    uint32_t descriptorSetSwitchNum;
+};
+
+// SoA, padded to a multiple of 4
+struct InstanceBounds {
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> extentX;
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
 };
 
+// Tests 4 boxes per iteration against the frustum planes, returns the number of visible instances
+static uint32_t CullInstances(const InstanceBounds& bounds, uint32_t instanceNum, const float4x4& sceneToClip, uint32_t* visibleInstances) {
+    // Planes from rows of the matrix, "dot(plane, p) >= 0" inside. Far plane is degenerate with infinite projection, but still passes
+    const float rows[4][4] = {
+        {sceneToClip.a00, sceneToClip.a01, sceneToClip.a02, sceneToClip.a03},
+        {sceneToClip.a10, sceneToClip.a11, sceneToClip.a12, sceneToClip.a13},
+        {sceneToClip.a20, sceneToClip.a21, sceneToClip.a22, sceneToClip.a23},
+        {sceneToClip.a30, sceneToClip.a31, sceneToClip.a32, sceneToClip.a33},
+    };
+
+    // Left, right, bottom, top, near and far (swapped with reversed Z)
+    constexpr uint32_t PLANE_NUM = 6;
+    float planes[PLANE_NUM][4];
+    for (uint32_t j = 0; j < 4; j++) {
+        planes[0][j] = rows[3][j] + rows[0][j];
+        planes[1][j] = rows[3][j] - rows[0][j];
+        planes[2][j] = rows[3][j] + rows[1][j];
+        planes[3][j] = rows[3][j] - rows[1][j];
+        planes[4][j] = rows[2][j];
+        planes[5][j] = rows[3][j] - rows[2][j];
+    }
+
+    __m128 planeX[PLANE_NUM], planeY[PLANE_NUM], planeZ[PLANE_NUM], planeW[PLANE_NUM];
+    __m128 absPlaneX[PLANE_NUM], absPlaneY[PLANE_NUM], absPlaneZ[PLANE_NUM];
+
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (uint32_t i = 0; i < PLANE_NUM; i++) {
+        planeX[i] = _mm_set1_ps(planes[i][0]);
+        planeY[i] = _mm_set1_ps(planes[i][1]);
+        planeZ[i] = _mm_set1_ps(planes[i][2]);
+        planeW[i] = _mm_set1_ps(planes[i][3]);
+
+        absPlaneX[i] = _mm_andnot_ps(signMask, planeX[i]);
+        absPlaneY[i] = _mm_andnot_ps(signMask, planeY[i]);
+        absPlaneZ[i] = _mm_andnot_ps(signMask, planeZ[i]);
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    uint32_t visibleNum = 0;
+
+    for (uint32_t i = 0; i < instanceNum; i += 4) {
+        const __m128 centerX = _mm_loadu_ps(&bounds.centerX[i]);
+        const __m128 centerY = _mm_loadu_ps(&bounds.centerY[i]);
+        const __m128 centerZ = _mm_loadu_ps(&bounds.centerZ[i]);
+        const __m128 extentX = _mm_loadu_ps(&bounds.extentX[i]);
+        const __m128 extentY = _mm_loadu_ps(&bounds.extentY[i]);
+        const __m128 extentZ = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        // A box is outside if its farthest point along the plane normal is behind the plane
+        __m128 outside = zero;
+        for (uint32_t j = 0; j < PLANE_NUM; j++) {
+            __m128 distance = _mm_add_ps(planeW[j], _mm_mul_ps(planeX[j], centerX));
+            distance = _mm_add_ps(distance, _mm_mul_ps(planeY[j], centerY));
+            distance = _mm_add_ps(distance, _mm_mul_ps(planeZ[j], centerZ));
+
+            __m128 radius = _mm_mul_ps(absPlaneX[j], extentX);
+            radius = _mm_add_ps(radius, _mm_mul_ps(absPlaneY[j], extentY));
+            radius = _mm_add_ps(radius, _mm_mul_ps(absPlaneZ[j], extentZ));
+
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        const uint32_t visibleMask = (uint32_t)(~_mm_movemask_ps(outside) & 0xF);
+        const uint32_t laneNum = std::min(instanceNum - i, 4u);
+        for (uint32_t lane = 0; lane < laneNum; lane++) {
+            if (visibleMask & (1 << lane))
+                visibleInstances[visibleNum++] = i + lane;
+        }
+    }
+
+    return visibleNum;
+}
+
+static uint32_t GetPipelineIndex(const utils::Material& material) {
+    if (material.IsAlphaOpaque())
+        return ALPHA_OPAQUE_PIPELINE;
+
+    return material.IsTransparent() ? TRANSPARENT_PIPELINE : OPAQUE_PIPELINE;
+}
+
+// Top 24 bits of a non-negative float, order preserving
+static uint64_t QuantizeDepth(float depth) {
+    depth = std::max(depth, 0.0f);
+
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+
+    return bits >> 8;
+}
+
+// Opaque: pass | pipeline | material | depth (front-to-back)
+// Transparent: pass | inverted depth (back-to-front) | material
+static uint64_t GetSortKey(uint32_t pipelineIndex, uint32_t materialIndex, float depth) {
+    const uint64_t quantizedDepth = QuantizeDepth(depth);
+
+    if (pipelineIndex == TRANSPARENT_PIPELINE)
+        return (1ull << 63) | ((0xFFFFFFull - quantizedDepth) << 39) | ((uint64_t)materialIndex << 8);
+
+    return ((uint64_t)pipelineIndex << 61) | ((uint64_t)materialIndex << 24) | quantizedDepth;
+}
+
+// LSD radix sort by 8-bit digits, digits equal for all keys are skipped. Results are in "keys" and "values"
+static void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, std::vector<uint64_t>& tempKeys, std::vector<uint32_t>& tempValues, uint32_t num) {
+    if (!num)
+        return;
+
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        uint32_t offsets[256] = {};
+        for (uint32_t i = 0; i < num; i++)
+            offsets[(keys[i] >> shift) & 0xFF]++;
+
+        if (offsets[(keys[0] >> shift) & 0xFF] == num)
+            continue;
+
+        uint32_t offset = 0;
+        for (uint32_t& digitOffset : offsets) {
+            const uint32_t digitNum = digitOffset;
+            digitOffset = offset;
+            offset += digitNum;
+        }
+
+        for (uint32_t i = 0; i < num; i++) {
+            const uint32_t j = offsets[(keys[i] >> shift) & 0xFF]++;
+            tempKeys[j] = keys[i];
+            tempValues[j] = values[i];
+        }
+
+        std::swap(keys, tempKeys);
+        std::swap(values, tempValues);
+    }
+}
+
 class Sample : public SampleBase {
 public:
     Sample() {
@@ -43,6 +206,10 @@ public:
     void PrepareFrame(uint32_t frameIndex) override;
     void RenderFrame(uint32_t frameIndex) override;
 
+private:
+    void RecordJob(uint32_t sliceIndex);
+    void RecordScene(nri::CommandBuffer& commandBuffer, uint32_t sliceIndex);
+
 private:
     NRIInterface NRI = {};
     nri::Device* m_Device = nullptr;
@@ -54,7 +221,8 @@ private:
     nri::PipelineLayout* m_PipelineLayout = nullptr;
     nri::Descriptor* m_DepthAttachment = nullptr;
     nri::Descriptor* m_ShadingRateAttachment = nullptr;
-    nri::QueryPool* m_QueryPool = nullptr;
+    nri::DescriptorSet* m_GlobalDescriptorSet = nullptr;
+    const BackBuffer* m_BackBuffer = nullptr;
 
     std::array<Frame, BUFFERED_FRAME_MAX_NUM> m_Frames = {};
     std::vector<nri::Pipeline*> m_Pipelines;
@@ -67,15 +235,51 @@ private:
 
     nri::Format m_DepthFormat = nri::Format::UNKNOWN;
 
+    ConstantBufferRing m_Constants;
+    QueryReadbackRing m_PipelineStatistics;
+    GpuProfiler m_GpuProfiler;
+    JobScheduler m_JobScheduler;
+    JobCounter m_RecordingCounter;
+    JobFunc m_RecordJob;
+    std::array<SliceStats, THREAD_MAX_NUM> m_SliceStats = {};
+    std::array<nri::CommandBuffer*, THREAD_MAX_NUM> m_SubmittedCommandBuffers = {};
+
     utils::Scene m_Scene;
+    SceneCache m_SceneCache;
+    InstanceBounds m_InstanceBounds;
+    std::vector<uint32_t> m_VisibleInstances;
+    std::vector<uint64_t> m_SortKeys;
+    std::vector<uint64_t> m_TempSortKeys;
+    std::vector<uint32_t> m_TempVisibleInstances;
+    uint32_t m_VisibleInstanceNum = 0;
+    uint32_t m_PipelineSwitchNum = 0;
+    uint32_t m_DescriptorSetSwitchNum = 0;
+    uint32_t m_FrameIndex = 0;
+    uint32_t m_GlobalConstantBufferOffset = 0;
+    uint32_t m_ThreadNum = 1;
+    uint32_t m_SliceNum = 1;
+    int32_t m_RecordingThreadNum = 1;
+    double m_CullingTime = 0.0;
+    double m_SortingTime = 0.0;
+    double m_RecordingTime = 0.0;
+    bool m_IsCullingEnabled = true;
+    bool m_IsSortingEnabled = true;
+    bool m_IsMultithreadingEnabled = true;
 };
 
 Sample::~Sample() {
     NRI.WaitForIdle(*m_GraphicsQueue);
 
+    m_JobScheduler.Shutdown();
+
     for (Frame& frame : m_Frames) {
         NRI.DestroyCommandBuffer(*frame.commandBuffer);
         NRI.DestroyCommandAllocator(*frame.commandAllocator);
+
+        for (uint32_t i = 0; i < m_ThreadNum - 1; i++) {
+            NRI.DestroyCommandBuffer(*frame.workerCommandBuffers[i]);
+            NRI.DestroyCommandAllocator(*frame.workerCommandAllocators[i]);
+        }
     }
 
     for (uint32_t i = 0; i < m_SwapChainBuffers.size(); i++)
@@ -96,7 +300,9 @@ Sample::~Sample() {
     for (size_t i = 0; i < m_Pipelines.size(); i++)
         NRI.DestroyPipeline(*m_Pipelines[i]);
 
-    NRI.DestroyQueryPool(*m_QueryPool);
+    m_PipelineStatistics.Destroy(NRI);
+    m_GpuProfiler.Destroy(NRI);
+    m_Constants.Destroy(NRI);
     NRI.DestroyPipelineLayout(*m_PipelineLayout);
     NRI.DestroyDescriptorPool(*m_DescriptorPool);
     NRI.DestroyFence(*m_FrameFence);
@@ -162,22 +368,34 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
     nri::Texture* const* swapChainTextures = NRI.GetSwapChainTextures(*m_SwapChain, swapChainTextureNum);
     nri::Format swapChainFormat = NRI.GetTextureDesc(*swapChainTextures[0]).format;
 
+    // Thread 0 is the main thread, it records the last slice and the UI
+    m_ThreadNum = std::clamp(std::thread::hardware_concurrency(), 1u, THREAD_MAX_NUM);
+    m_RecordingThreadNum = (int32_t)m_ThreadNum;
+    m_RecordJob = [this](uint32_t sliceIndex) { RecordJob(sliceIndex); };
+    m_JobScheduler.Initialize(m_ThreadNum - 1);
+
     // Buffered resources
     for (Frame& frame : m_Frames) {
         NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_GraphicsQueue, frame.commandAllocator));
         NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.commandAllocator, frame.commandBuffer));
+
+        for (uint32_t i = 0; i < m_ThreadNum - 1; i++) {
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandAllocator(*m_GraphicsQueue, frame.workerCommandAllocators[i]));
+            NRI_ABORT_ON_FAILURE(NRI.CreateCommandBuffer(*frame.workerCommandAllocators[i], frame.workerCommandBuffers[i]));
+        }
     }
 
     { // Pipeline layout
-        nri::DescriptorRangeDesc globalDescriptorRange[2];
-        globalDescriptorRange[0] = {0, 1, nri::DescriptorType::CONSTANT_BUFFER, nri::StageBits::ALL};
-        globalDescriptorRange[1] = {0, 1, nri::DescriptorType::SAMPLER, nri::StageBits::FRAGMENT_SHADER};
+        nri::DescriptorRangeDesc globalDescriptorRange[1];
+        globalDescriptorRange[0] = {0, 1, nri::DescriptorType::SAMPLER, nri::StageBits::FRAGMENT_SHADER};
+
+        nri::DynamicConstantBufferDesc dynamicConstantBufferDesc = {0, nri::StageBits::ALL};
 
         nri::DescriptorRangeDesc materialDescriptorRange[1];
         materialDescriptorRange[0] = {0, TEXTURES_PER_MATERIAL, nri::DescriptorType::TEXTURE, nri::StageBits::FRAGMENT_SHADER};
 
         nri::DescriptorSetDesc descriptorSetDescs[] = {
-            {0, globalDescriptorRange, helper::GetCountOf(globalDescriptorRange)},
+            {0, globalDescriptorRange, helper::GetCountOf(globalDescriptorRange), &dynamicConstantBufferDesc, 1},
             {1, materialDescriptorRange, helper::GetCountOf(materialDescriptorRange)},
         };
 
@@ -297,29 +515,45 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
     // Scene
     std::string sceneFile = utils::GetFullPath(m_SceneFile, utils::DataFolder::SCENES);
-    NRI_ABORT_ON_FALSE(utils::LoadScene(sceneFile, m_Scene, false));
+    NRI_ABORT_ON_FALSE(m_SceneCache.Load(sceneFile, m_Scene, m_JobScheduler));
 
     // Camera
     m_Camera.Initialize(m_Scene.aabb.GetCenter(), m_Scene.aabb.vMin, false);
 
+    { // Instance bounds for culling, meshes are drawn without instance transforms, so they are in scene space
+        const size_t instanceNum = m_Scene.instances.size();
+        const size_t paddedInstanceNum = helper::Align(instanceNum, 4);
+
+        m_InstanceBounds.centerX.resize(paddedInstanceNum, 0.0f);
+        m_InstanceBounds.centerY.resize(paddedInstanceNum, 0.0f);
+        m_InstanceBounds.centerZ.resize(paddedInstanceNum, 0.0f);
+        m_InstanceBounds.extentX.resize(paddedInstanceNum, 0.0f);
+        m_InstanceBounds.extentY.resize(paddedInstanceNum, 0.0f);
+        m_InstanceBounds.extentZ.resize(paddedInstanceNum, 0.0f);
+
+        for (size_t i = 0; i < instanceNum; i++) {
+            const utils::Instance& instance = m_Scene.instances[i];
+            const cBoxf& aabb = m_Scene.meshes[instance.meshInstanceIndex].aabb;
+
+            m_InstanceBounds.centerX[i] = (aabb.vMin.x + aabb.vMax.x) * 0.5f;
+            m_InstanceBounds.centerY[i] = (aabb.vMin.y + aabb.vMax.y) * 0.5f;
+            m_InstanceBounds.centerZ[i] = (aabb.vMin.z + aabb.vMax.z) * 0.5f;
+            m_InstanceBounds.extentX[i] = (aabb.vMax.x - aabb.vMin.x) * 0.5f;
+            m_InstanceBounds.extentY[i] = (aabb.vMax.y - aabb.vMin.y) * 0.5f;
+            m_InstanceBounds.extentZ[i] = (aabb.vMax.z - aabb.vMin.z) * 0.5f;
+        }
+
+        m_VisibleInstances.resize(instanceNum);
+        m_TempVisibleInstances.resize(instanceNum);
+        m_SortKeys.resize(instanceNum);
+        m_TempSortKeys.resize(instanceNum);
+    }
+
     const uint32_t textureNum = (uint32_t)m_Scene.textures.size();
     const uint32_t materialNum = (uint32_t)m_Scene.materials.size();
 
-    // Textures
-    for (const utils::Texture* textureData : m_Scene.textures) {
-        nri::TextureDesc textureDesc = {};
-        textureDesc.type = nri::TextureType::TEXTURE_2D;
-        textureDesc.usage = nri::TextureUsageBits::SHADER_RESOURCE;
-        textureDesc.format = textureData->GetFormat();
-        textureDesc.width =  textureData->GetWidth();
-        textureDesc.height = textureData->GetHeight();
-        textureDesc.mipNum = textureData->GetMipNum();
-        textureDesc.layerNum = textureData->GetArraySize();
-
-        nri::Texture* texture;
-        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, texture));
-        m_Textures.push_back(texture);
-    }
+    // Textures (decoding goes on in the background, finished textures get uploaded in batches)
+    NRI_ABORT_ON_FALSE(m_SceneCache.UploadTextures(NRI, NRI, *m_Device, *m_GraphicsQueue, m_Textures, m_MemoryAllocations));
 
     // Depth attachment
     nri::Texture* depthTexture = nullptr;
@@ -365,31 +599,17 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         }
     }
 
-    const uint32_t constantBufferSize = helper::Align((uint32_t)sizeof(GlobalConstantBufferLayout), deviceDesc.constantBufferOffsetAlignment);
-
     { // Buffers
-        // CONSTANT_BUFFER
-        nri::BufferDesc bufferDesc = {};
-        bufferDesc.size = constantBufferSize * BUFFERED_FRAME_MAX_NUM;
-        bufferDesc.usage = nri::BufferUsageBits::CONSTANT_BUFFER;
-        nri::Buffer* buffer;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
-        m_Buffers.push_back(buffer);
-
-        // READBACK_BUFFER
-        bufferDesc.size = sizeof(nri::PipelineStatisticsDesc) * BUFFERED_FRAME_MAX_NUM;
-        bufferDesc.usage = nri::BufferUsageBits::NONE;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
-        m_Buffers.push_back(buffer);
-
         // INDEX_BUFFER
-        bufferDesc.size = helper::GetByteSizeOf(m_Scene.indices);
+        nri::BufferDesc bufferDesc = {};
+        bufferDesc.size = m_SceneCache.GetIndexDataSize();
         bufferDesc.usage = nri::BufferUsageBits::INDEX_BUFFER;
+        nri::Buffer* buffer;
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
 
         // VERTEX_BUFFER
-        bufferDesc.size = helper::GetByteSizeOf(m_Scene.vertices);
+        bufferDesc.size = m_SceneCache.GetVertexDataSize();
         bufferDesc.usage = nri::BufferUsageBits::VERTEX_BUFFER;
         NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, buffer));
         m_Buffers.push_back(buffer);
@@ -397,37 +617,23 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
     { // Memory
         nri::ResourceGroupDesc resourceGroupDesc = {};
-        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
-        resourceGroupDesc.bufferNum = 1;
-        resourceGroupDesc.buffers = &m_Buffers[CONSTANT_BUFFER];
-
-        size_t baseAllocation = m_MemoryAllocations.size();
-        m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
-        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
-
-        resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_READBACK;
-        resourceGroupDesc.bufferNum = 1;
-        resourceGroupDesc.buffers = &m_Buffers[READBACK_BUFFER];
-
-        baseAllocation = m_MemoryAllocations.size();
-        m_MemoryAllocations.resize(baseAllocation + 1, nullptr);
-        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
-
         resourceGroupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
         resourceGroupDesc.bufferNum = 2;
         resourceGroupDesc.buffers = &m_Buffers[INDEX_BUFFER];
-        resourceGroupDesc.textureNum = (uint32_t)m_Textures.size();
-        resourceGroupDesc.textures = m_Textures.data();
+        resourceGroupDesc.textureNum = (uint32_t)m_Textures.size() - textureNum;
+        resourceGroupDesc.textures = m_Textures.data() + textureNum;
 
-        baseAllocation = m_MemoryAllocations.size();
+        size_t baseAllocation = m_MemoryAllocations.size();
         uint32_t allocationNum = NRI.CalculateAllocationNumber(*m_Device, resourceGroupDesc);
         m_MemoryAllocations.resize(baseAllocation + allocationNum, nullptr);
         NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, m_MemoryAllocations.data() + baseAllocation));
     }
 
+    // Constants (persistently mapped)
+    NRI_ABORT_ON_FALSE(m_Constants.Initialize(NRI, *m_Device, sizeof(GlobalConstantBufferLayout), BUFFERED_FRAME_MAX_NUM, sizeof(GlobalConstantBufferLayout)));
+
     // Create descriptors
     nri::Descriptor* anisotropicSampler;
-    nri::Descriptor* constantBufferViews[BUFFERED_FRAME_MAX_NUM];
     {
         // Material textures
         m_Descriptors.resize(textureNum);
@@ -447,19 +653,6 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
         NRI_ABORT_ON_FAILURE(NRI.CreateSampler(*m_Device, samplerDesc, anisotropicSampler));
         m_Descriptors.push_back(anisotropicSampler);
 
-        // Constant buffer
-        for (uint32_t i = 0; i < BUFFERED_FRAME_MAX_NUM; i++) {
-            m_Frames[i].globalConstantBufferViewOffsets = i * constantBufferSize;
-
-            nri::BufferViewDesc bufferViewDesc = {};
-            bufferViewDesc.buffer = m_Buffers[CONSTANT_BUFFER];
-            bufferViewDesc.viewType = nri::BufferViewType::CONSTANT;
-            bufferViewDesc.offset = i * constantBufferSize;
-            bufferViewDesc.size = constantBufferSize;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferViewDesc, constantBufferViews[i]));
-            m_Descriptors.push_back(constantBufferViews[i]);
-        }
-
         { // Depth buffer
             nri::Texture2DViewDesc texture2DViewDesc = {depthTexture, nri::Texture2DViewType::DEPTH_STENCIL_ATTACHMENT, m_DepthFormat};
 
@@ -488,32 +681,28 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
     { // Descriptor pool
         nri::DescriptorPoolDesc descriptorPoolDesc = {};
-        descriptorPoolDesc.descriptorSetMaxNum = materialNum + BUFFERED_FRAME_MAX_NUM;
+        descriptorPoolDesc.descriptorSetMaxNum = materialNum + 1;
         descriptorPoolDesc.textureMaxNum = materialNum * TEXTURES_PER_MATERIAL;
-        descriptorPoolDesc.samplerMaxNum = BUFFERED_FRAME_MAX_NUM;
-        descriptorPoolDesc.constantBufferMaxNum = BUFFERED_FRAME_MAX_NUM;
+        descriptorPoolDesc.samplerMaxNum = 1;
+        descriptorPoolDesc.dynamicConstantBufferMaxNum = 1;
 
         NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, descriptorPoolDesc, m_DescriptorPool));
     }
 
     { // Descriptor sets
-        m_DescriptorSets.resize(BUFFERED_FRAME_MAX_NUM + materialNum);
+        m_DescriptorSets.resize(materialNum);
 
-        // Global
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, GLOBAL_DESCRIPTOR_SET, &m_DescriptorSets[0], BUFFERED_FRAME_MAX_NUM, 0));
+        // Global (a dynamic offset selects the constants of the frame)
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, GLOBAL_DESCRIPTOR_SET, &m_GlobalDescriptorSet, 1, 0));
 
-        for (uint32_t i = 0; i < BUFFERED_FRAME_MAX_NUM; i++) {
-            nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDescs[2] = {};
-            descriptorRangeUpdateDescs[0].descriptorNum = 1;
-            descriptorRangeUpdateDescs[0].descriptors = &constantBufferViews[i];
-            descriptorRangeUpdateDescs[1].descriptorNum = 1;
-            descriptorRangeUpdateDescs[1].descriptors = &anisotropicSampler;
+        nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDesc = {&anisotropicSampler, 1};
+        NRI.UpdateDescriptorRanges(*m_GlobalDescriptorSet, 0, 1, &descriptorRangeUpdateDesc);
 
-            NRI.UpdateDescriptorRanges(*m_DescriptorSets[i], 0, helper::GetCountOf(descriptorRangeUpdateDescs), descriptorRangeUpdateDescs);
-        }
+        nri::Descriptor* constantBufferView = m_Constants.GetView();
+        NRI.UpdateDynamicConstantBuffers(*m_GlobalDescriptorSet, 0, 1, &constantBufferView);
 
         // Material
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, MATERIAL_DESCRIPTOR_SET, &m_DescriptorSets[BUFFERED_FRAME_MAX_NUM], materialNum, 0));
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_DescriptorPool, *m_PipelineLayout, MATERIAL_DESCRIPTOR_SET, m_DescriptorSets.data(), materialNum, 0));
 
         for (uint32_t i = 0; i < materialNum; i++) {
             const utils::Material& material = m_Scene.materials[i];
@@ -528,39 +717,13 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
             nri::DescriptorRangeUpdateDesc descriptorRangeUpdateDescs = {};
             descriptorRangeUpdateDescs.descriptorNum = helper::GetCountOf(materialTextures);
             descriptorRangeUpdateDescs.descriptors = materialTextures;
-            NRI.UpdateDescriptorRanges(*m_DescriptorSets[BUFFERED_FRAME_MAX_NUM + i], 0, 1, &descriptorRangeUpdateDescs);
+            NRI.UpdateDescriptorRanges(*m_DescriptorSets[i], 0, 1, &descriptorRangeUpdateDescs);
         }
     }
 
-    { // Upload data
-        std::vector<nri::TextureUploadDesc> textureData(textureNum + 2);
-
-        uint32_t subresourceNum = 0;
-        for (uint32_t i = 0; i < textureNum; i++) {
-            const utils::Texture& texture = *m_Scene.textures[i];
-            subresourceNum += texture.GetArraySize() * texture.GetMipNum();
-        }
-
-        std::vector<nri::TextureSubresourceUploadDesc> subresources(subresourceNum);
-        nri::TextureSubresourceUploadDesc* subresourceBegin = subresources.data();
-
-        // Material textures
+    { // Upload data (scene textures are already uploaded)
+        std::array<nri::TextureUploadDesc, 2> textureData = {};
         uint32_t i = 0;
-        for (; i < textureNum; i++) {
-            const utils::Texture& texture = *m_Scene.textures[i];
-
-            for (uint32_t slice = 0; slice < texture.GetArraySize(); slice++) {
-                for (uint32_t mip = 0; mip < texture.GetMipNum(); mip++)
-                    texture.GetSubresource(subresourceBegin[slice * texture.GetMipNum() + mip], mip, slice);
-            }
-
-            textureData[i] = {};
-            textureData[i].subresources = subresourceBegin;
-            textureData[i].texture = m_Textures[i];
-            textureData[i].after = {nri::AccessBits::SHADER_RESOURCE, nri::Layout::SHADER_RESOURCE};
-
-            subresourceBegin += texture.GetArraySize() * texture.GetMipNum();
-        }
 
         // Depth attachment
         textureData[i] = {};
@@ -584,21 +747,18 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 
         // Buffers
         nri::BufferUploadDesc bufferData[] = {
-            {m_Scene.vertices.data(), helper::GetByteSizeOf(m_Scene.vertices), m_Buffers[VERTEX_BUFFER], 0, {nri::AccessBits::VERTEX_BUFFER}},
-            {m_Scene.indices.data(), helper::GetByteSizeOf(m_Scene.indices), m_Buffers[INDEX_BUFFER], 0, {nri::AccessBits::INDEX_BUFFER}},
+            {m_SceneCache.GetVertexData(), m_SceneCache.GetVertexDataSize(), m_Buffers[VERTEX_BUFFER], 0, {nri::AccessBits::VERTEX_BUFFER}},
+            {m_SceneCache.GetIndexData(), m_SceneCache.GetIndexDataSize(), m_Buffers[INDEX_BUFFER], 0, {nri::AccessBits::INDEX_BUFFER}},
         };
 
         NRI_ABORT_ON_FAILURE(NRI.UploadData(*m_GraphicsQueue, textureData.data(), i, bufferData, helper::GetCountOf(bufferData)));
     }
 
-    { // Pipeline statistics
-        nri::QueryPoolDesc queryPoolDesc = {};
-        queryPoolDesc.queryType = nri::QueryType::PIPELINE_STATISTICS;
-        queryPoolDesc.capacity = 1;
-
-        NRI_ABORT_ON_FAILURE(NRI.CreateQueryPool(*m_Device, queryPoolDesc, m_QueryPool));
-    }
+    // Pipeline statistics, one query per slice
+    NRI_ABORT_ON_FALSE(m_PipelineStatistics.Initialize(NRI, *m_Device, nri::QueryType::PIPELINE_STATISTICS, THREAD_MAX_NUM, BUFFERED_FRAME_MAX_NUM));
+    NRI_ABORT_ON_FALSE(m_GpuProfiler.Initialize(NRI, *m_Device, BUFFERED_FRAME_MAX_NUM));
 
+    m_SceneCache.Release();
     m_Scene.UnloadGeometryData();
     m_Scene.UnloadTextureData();
 
@@ -611,23 +771,50 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI) {
 void Sample::PrepareFrame(uint32_t frameIndex) {
     BeginUI();
 
-    // TODO: delay is not implemented
-    nri::PipelineStatisticsDesc* pipelineStats = (nri::PipelineStatisticsDesc*)NRI.MapBuffer(*m_Buffers[READBACK_BUFFER], 0, sizeof(nri::PipelineStatisticsDesc));
+    // Results of the latest finished frame, no waiting
+    m_PipelineStatistics.Update(NRI, *m_FrameFence);
     {
+        // Each slice has its own query
+        const nri::PipelineStatisticsDesc* sliceStats = m_PipelineStatistics.GetResults<nri::PipelineStatisticsDesc>();
+
+        nri::PipelineStatisticsDesc pipelineStats = {};
+        for (uint32_t i = 0; i < m_PipelineStatistics.GetResultNum(); i++) {
+            pipelineStats.inputVertexNum += sliceStats[i].inputVertexNum;
+            pipelineStats.inputPrimitiveNum += sliceStats[i].inputPrimitiveNum;
+            pipelineStats.vertexShaderInvocationNum += sliceStats[i].vertexShaderInvocationNum;
+            pipelineStats.rasterizerInPrimitiveNum += sliceStats[i].rasterizerInPrimitiveNum;
+            pipelineStats.rasterizerOutPrimitiveNum += sliceStats[i].rasterizerOutPrimitiveNum;
+            pipelineStats.fragmentShaderInvocationNum += sliceStats[i].fragmentShaderInvocationNum;
+        }
+
         ImGui::SetNextWindowPos(ImVec2(30, 30), ImGuiCond_Once);
         ImGui::SetNextWindowSize(ImVec2(0, 0));
         ImGui::Begin("Stats");
         {
-            ImGui::Text("Input vertices               : %llu", pipelineStats->inputVertexNum);
-            ImGui::Text("Input primitives             : %llu", pipelineStats->inputPrimitiveNum);
-            ImGui::Text("Vertex shader invocations    : %llu", pipelineStats->vertexShaderInvocationNum);
-            ImGui::Text("Rasterizer input primitives  : %llu", pipelineStats->rasterizerInPrimitiveNum);
-            ImGui::Text("Rasterizer output primitives : %llu", pipelineStats->rasterizerOutPrimitiveNum);
-            ImGui::Text("Fragment shader invocations  : %llu", pipelineStats->fragmentShaderInvocationNum);
+            ImGui::Text("Input vertices               : %llu", pipelineStats.inputVertexNum);
+            ImGui::Text("Input primitives             : %llu", pipelineStats.inputPrimitiveNum);
+            ImGui::Text("Vertex shader invocations    : %llu", pipelineStats.vertexShaderInvocationNum);
+            ImGui::Text("Rasterizer input primitives  : %llu", pipelineStats.rasterizerInPrimitiveNum);
+            ImGui::Text("Rasterizer output primitives : %llu", pipelineStats.rasterizerOutPrimitiveNum);
+            ImGui::Text("Fragment shader invocations  : %llu", pipelineStats.fragmentShaderInvocationNum);
+            ImGui::Separator();
+            ImGui::Text("Visible instances            : %u / %u", m_VisibleInstanceNum, (uint32_t)m_Scene.instances.size());
+            ImGui::Text("Culling                      : %.3f ms", m_CullingTime);
+            ImGui::Text("Sorting                      : %.3f ms", m_SortingTime);
+            ImGui::Text("Pipeline switches            : %u", m_PipelineSwitchNum);
+            ImGui::Text("Descriptor set switches      : %u", m_DescriptorSetSwitchNum);
+            ImGui::Text("Recording                    : %.3f ms (%u slices)", m_RecordingTime, m_SliceNum);
+            ImGui::Checkbox("Frustum culling", &m_IsCullingEnabled);
+            ImGui::Checkbox("Sort draws", &m_IsSortingEnabled);
+            ImGui::Checkbox("Multithreaded recording", &m_IsMultithreadingEnabled);
+            if (m_IsMultithreadingEnabled)
+                ImGui::SliderInt("Threads", &m_RecordingThreadNum, 1, (int32_t)m_ThreadNum);
         }
         ImGui::End();
     }
-    NRI.UnmapBuffer(*m_Buffers[READBACK_BUFFER]);
+
+    m_GpuProfiler.Update(NRI, *m_FrameFence);
+    m_GpuProfiler.RenderUI();
 
     EndUI(NRI, *m_Streamer);
     NRI.CopyStreamerUpdateRequests(*m_Streamer);
@@ -642,39 +829,38 @@ void Sample::PrepareFrame(uint32_t frameIndex) {
     m_Camera.Update(desc, frameIndex);
 }
 
-void Sample::RenderFrame(uint32_t frameIndex) {
-    const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
-    const Frame& frame = m_Frames[bufferedFrameIndex];
-    const uint32_t windowWidth = GetWindowResolution().x;
-    const uint32_t windowHeight = GetWindowResolution().y;
-    const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
+void Sample::RecordJob(uint32_t sliceIndex) {
+    const Frame& frame = m_Frames[m_FrameIndex % BUFFERED_FRAME_MAX_NUM];
+    nri::CommandBuffer& commandBuffer = *frame.workerCommandBuffers[sliceIndex];
 
-    if (frameIndex >= BUFFERED_FRAME_MAX_NUM) {
-        NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
-        NRI.ResetCommandAllocator(*frame.commandAllocator);
+    NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
+    {
+        RecordScene(commandBuffer, sliceIndex);
     }
+    NRI.EndCommandBuffer(commandBuffer);
 
-    const uint32_t currentTextureIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
-    BackBuffer& currentBackBuffer = m_SwapChainBuffers[currentTextureIndex];
+    m_SubmittedCommandBuffers[sliceIndex] = &commandBuffer;
+}
 
-    // Update constants
-    const uint64_t rangeOffset = m_Frames[bufferedFrameIndex].globalConstantBufferViewOffsets;
-    auto constants = (GlobalConstantBufferLayout*)NRI.MapBuffer(*m_Buffers[CONSTANT_BUFFER], rangeOffset, sizeof(GlobalConstantBufferLayout));
-    if (constants) {
-        constants->gWorldToClip = m_Camera.state.mWorldToClip * m_Scene.mSceneToWorld;
-        constants->gCameraPos = m_Camera.state.position;
+void Sample::RecordScene(nri::CommandBuffer& commandBuffer, uint32_t sliceIndex) {
+    const uint32_t windowWidth = GetWindowResolution().x;
+    const uint32_t windowHeight = GetWindowResolution().y;
+    const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
 
-        NRI.UnmapBuffer(*m_Buffers[CONSTANT_BUFFER]);
-    }
+    // Contiguous ranges of sorted visible instances keep state changes low in each slice
+    const uint32_t sliceSize = (m_VisibleInstanceNum + m_SliceNum - 1) / m_SliceNum;
+    const uint32_t instanceBegin = std::min(sliceIndex * sliceSize, m_VisibleInstanceNum);
+    const uint32_t instanceEnd = std::min(instanceBegin + sliceSize, m_VisibleInstanceNum);
 
-    // Record
-    nri::CommandBuffer& commandBuffer = *frame.commandBuffer;
-    NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
-    {
-        helper::Annotation annotation(NRI, commandBuffer, "Scene");
+    // The first slice is executed first
+    if (sliceIndex == 0)
+        m_GpuProfiler.CmdResetQueries(NRI, commandBuffer);
+
+    GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "Scene");
 
+    if (sliceIndex == 0) {
         nri::TextureBarrierDesc textureBarrierDescs = {};
-        textureBarrierDescs.texture = currentBackBuffer.texture;
+        textureBarrierDescs.texture = m_BackBuffer->texture;
         textureBarrierDescs.after = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
         textureBarrierDescs.layerNum = 1;
         textureBarrierDescs.mipNum = 1;
@@ -684,42 +870,45 @@ void Sample::RenderFrame(uint32_t frameIndex) {
         barrierGroupDesc.textures = &textureBarrierDescs;
 
         NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+    }
 
-        // Test PSL // TODO: D3D11 gets DEVICE_REMOVED if VRS is used with PSL...
-        if (deviceDesc.sampleLocationsTier >= 2 && deviceDesc.graphicsAPI != nri::GraphicsAPI::D3D11) {
-            static const nri::SampleLocation samplePos[4] = {
-                {-6, -2},
-                {-2, 6},
-                {6, 2},
-                {2, -6},
-            };
+    // Test PSL // TODO: D3D11 gets DEVICE_REMOVED if VRS is used with PSL...
+    if (deviceDesc.sampleLocationsTier >= 2 && deviceDesc.graphicsAPI != nri::GraphicsAPI::D3D11) {
+        static const nri::SampleLocation samplePos[4] = {
+            {-6, -2},
+            {-2, 6},
+            {6, 2},
+            {2, -6},
+        };
 
-            NRI.CmdSetSampleLocations(commandBuffer, samplePos + (frameIndex % 4), 1, 1);
-        }
+        NRI.CmdSetSampleLocations(commandBuffer, samplePos + (m_FrameIndex % 4), 1, 1);
+    }
 
-        // Test VRS (per pipeline)
-        if (deviceDesc.shadingRateTier) {
-            nri::ShadingRateDesc shadingRateDesc = {};
-            shadingRateDesc.shadingRate = nri::ShadingRate::FRAGMENT_SIZE_1X1;
+    // Test VRS (per pipeline)
+    if (deviceDesc.shadingRateTier) {
+        nri::ShadingRateDesc shadingRateDesc = {};
+        shadingRateDesc.shadingRate = nri::ShadingRate::FRAGMENT_SIZE_1X1;
 
-            NRI.CmdSetShadingRate(commandBuffer, shadingRateDesc);
-        }
+        NRI.CmdSetShadingRate(commandBuffer, shadingRateDesc);
+    }
 
-        // Test pipeline stats query
-        NRI.CmdResetQueries(commandBuffer, *m_QueryPool, 0, 1);
-        NRI.CmdBeginQuery(commandBuffer, *m_QueryPool, 0);
+    // Test pipeline stats query
+    const uint32_t queryIndex = m_PipelineStatistics.GetQueryIndex(m_FrameIndex, sliceIndex);
+    m_PipelineStatistics.CmdResetQueries(NRI, commandBuffer, m_FrameIndex, sliceIndex, 1);
+    NRI.CmdBeginQuery(commandBuffer, m_PipelineStatistics.GetQueryPool(), queryIndex);
 
-        { // Rendering
-            nri::AttachmentsDesc attachmentsDesc = {};
-            attachmentsDesc.colorNum = 1;
-            attachmentsDesc.colors = &currentBackBuffer.colorAttachment;
-            attachmentsDesc.depthStencil = m_DepthAttachment;
+    { // Rendering
+        nri::AttachmentsDesc attachmentsDesc = {};
+        attachmentsDesc.colorNum = 1;
+        attachmentsDesc.colors = &m_BackBuffer->colorAttachment;
+        attachmentsDesc.depthStencil = m_DepthAttachment;
 
-            if (deviceDesc.shadingRateTier >= 2)
-                attachmentsDesc.shadingRate = m_ShadingRateAttachment;
+        if (deviceDesc.shadingRateTier >= 2)
+            attachmentsDesc.shadingRate = m_ShadingRateAttachment;
 
-            NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
-            {
+        NRI.CmdBeginRendering(commandBuffer, attachmentsDesc);
+        {
+            if (sliceIndex == 0) {
                 nri::ClearDesc clearDescs[2] = {};
                 clearDescs[0].planes = nri::PlaneBits::COLOR;
                 clearDescs[0].value.color.f = {0.0f, 0.63f, 1.0f};
@@ -727,52 +916,158 @@ void Sample::RenderFrame(uint32_t frameIndex) {
                 clearDescs[1].value.depthStencil.depth = CLEAR_DEPTH;
 
                 NRI.CmdClearAttachments(commandBuffer, clearDescs, helper::GetCountOf(clearDescs), nullptr, 0);
+            }
+
+            const nri::Viewport viewport = {0.0f, 0.0f, (float)windowWidth, (float)windowHeight, 0.0f, 1.0f};
+            NRI.CmdSetViewports(commandBuffer, &viewport, 1);
 
-                const nri::Viewport viewport = {0.0f, 0.0f, (float)windowWidth, (float)windowHeight, 0.0f, 1.0f};
-                NRI.CmdSetViewports(commandBuffer, &viewport, 1);
+            const nri::Rect scissor = {0, 0, (nri::Dim_t)windowWidth, (nri::Dim_t)windowHeight};
+            NRI.CmdSetScissors(commandBuffer, &scissor, 1);
 
-                const nri::Rect scissor = {0, 0, (nri::Dim_t)windowWidth, (nri::Dim_t)windowHeight};
-                NRI.CmdSetScissors(commandBuffer, &scissor, 1);
+            NRI.CmdSetIndexBuffer(commandBuffer, *m_Buffers[INDEX_BUFFER], 0, sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32);
 
-                NRI.CmdSetIndexBuffer(commandBuffer, *m_Buffers[INDEX_BUFFER], 0, sizeof(utils::Index) == 2 ? nri::IndexType::UINT16 : nri::IndexType::UINT32);
+            NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
+            NRI.CmdSetDescriptorSet(commandBuffer, GLOBAL_DESCRIPTOR_SET, *m_GlobalDescriptorSet, &m_GlobalConstantBufferOffset);
 
-                NRI.CmdSetPipelineLayout(commandBuffer, *m_PipelineLayout);
-                NRI.CmdSetDescriptorSet(commandBuffer, GLOBAL_DESCRIPTOR_SET, *m_DescriptorSets[bufferedFrameIndex], nullptr);
+            constexpr uint64_t offset = 0;
+            NRI.CmdSetVertexBuffers(commandBuffer, 0, 1, &m_Buffers[VERTEX_BUFFER], &offset);
 
-                // TODO: no sorting per pipeline / material, transparency is not last
-                for (const utils::Instance& instance : m_Scene.instances) {
-                    const utils::Material& material = m_Scene.materials[instance.materialIndex];
-                    uint32_t pipelineIndex = material.IsAlphaOpaque() ? 1 : (material.IsTransparent() ? 2 : 0);
+            // Only state changes are issued, sorting by pipeline and material minimizes them
+            uint32_t currentPipelineIndex = uint32_t(-1);
+            uint32_t currentMaterialIndex = uint32_t(-1);
+            SliceStats& sliceStats = m_SliceStats[sliceIndex];
+            sliceStats = {};
+
+            for (uint32_t i = instanceBegin; i < instanceEnd; i++) {
+                const utils::Instance& instance = m_Scene.instances[m_VisibleInstances[i]];
+                const utils::Material& material = m_Scene.materials[instance.materialIndex];
+
+                const uint32_t pipelineIndex = GetPipelineIndex(material);
+                if (pipelineIndex != currentPipelineIndex) {
                     NRI.CmdSetPipeline(commandBuffer, *m_Pipelines[pipelineIndex]);
 
-                    constexpr uint64_t offset = 0;
-                    NRI.CmdSetVertexBuffers(commandBuffer, 0, 1, &m_Buffers[VERTEX_BUFFER], &offset);
+                    currentPipelineIndex = pipelineIndex;
+                    sliceStats.pipelineSwitchNum++;
+                }
 
-                    nri::DescriptorSet* descriptorSet = m_DescriptorSets[BUFFERED_FRAME_MAX_NUM + instance.materialIndex];
+                if (instance.materialIndex != currentMaterialIndex) {
+                    nri::DescriptorSet* descriptorSet = m_DescriptorSets[instance.materialIndex];
                     NRI.CmdSetDescriptorSet(commandBuffer, MATERIAL_DESCRIPTOR_SET, *descriptorSet, nullptr);
 
-                    const utils::Mesh& mesh = m_Scene.meshes[instance.meshInstanceIndex];
-                    NRI.CmdDrawIndexed(commandBuffer, {mesh.indexNum, 1, mesh.indexOffset, (int32_t)mesh.vertexOffset, 0});
+                    currentMaterialIndex = instance.materialIndex;
+                    sliceStats.descriptorSetSwitchNum++;
                 }
+
+                const utils::Mesh& mesh = m_Scene.meshes[instance.meshInstanceIndex];
+                NRI.CmdDrawIndexed(commandBuffer, {mesh.indexNum, 1, mesh.indexOffset, (int32_t)mesh.vertexOffset, 0});
             }
-            NRI.CmdEndRendering(commandBuffer);
         }
+        NRI.CmdEndRendering(commandBuffer);
+    }
+
+    // End query
+    NRI.CmdEndQuery(commandBuffer, m_PipelineStatistics.GetQueryPool(), queryIndex);
+    m_PipelineStatistics.CmdCopyQueries(NRI, commandBuffer, m_FrameIndex, sliceIndex, 1);
+
+    // Reset VRS (per pipeline)
+    if (deviceDesc.shadingRateTier) {
+        nri::ShadingRateDesc shadingRateDesc = {};
+        shadingRateDesc.shadingRate = nri::ShadingRate::FRAGMENT_SIZE_1X1;
+        shadingRateDesc.primitiveCombiner = nri::ShadingRateCombiner::KEEP;
+        shadingRateDesc.attachmentCombiner = nri::ShadingRateCombiner::KEEP;
+
+        NRI.CmdSetShadingRate(commandBuffer, shadingRateDesc);
+    }
+}
+
+void Sample::RenderFrame(uint32_t frameIndex) {
+    const uint32_t bufferedFrameIndex = frameIndex % BUFFERED_FRAME_MAX_NUM;
+    const Frame& frame = m_Frames[bufferedFrameIndex];
+
+    if (frameIndex >= BUFFERED_FRAME_MAX_NUM) {
+        NRI.Wait(*m_FrameFence, 1 + frameIndex - BUFFERED_FRAME_MAX_NUM);
+        NRI.ResetCommandAllocator(*frame.commandAllocator);
+
+        for (uint32_t i = 0; i < m_ThreadNum - 1; i++)
+            NRI.ResetCommandAllocator(*frame.workerCommandAllocators[i]);
+    }
+
+    const uint32_t currentTextureIndex = NRI.AcquireNextSwapChainTexture(*m_SwapChain);
+    BackBuffer& currentBackBuffer = m_SwapChainBuffers[currentTextureIndex];
+
+    const float4x4 sceneToClip = m_Camera.state.mWorldToClip * m_Scene.mSceneToWorld;
+
+    { // Culling
+        double cullingTime = m_Timer.GetTimeStamp();
+
+        const uint32_t instanceNum = (uint32_t)m_Scene.instances.size();
+        if (m_IsCullingEnabled)
+            m_VisibleInstanceNum = CullInstances(m_InstanceBounds, instanceNum, sceneToClip, m_VisibleInstances.data());
+        else {
+            for (uint32_t i = 0; i < instanceNum; i++)
+                m_VisibleInstances[i] = i;
+
+            m_VisibleInstanceNum = instanceNum;
+        }
+
+        m_CullingTime = m_Timer.GetTimeStamp() - cullingTime;
+    }
+
+    { // Sorting, view depth is "w" in clip space
+        double sortingTime = m_Timer.GetTimeStamp();
 
-        // End query
-        NRI.CmdEndQuery(commandBuffer, *m_QueryPool, 0);
-        NRI.CmdCopyQueries(commandBuffer, *m_QueryPool, 0, 1, *m_Buffers[READBACK_BUFFER], 0);
+        if (m_IsSortingEnabled) {
+            for (uint32_t i = 0; i < m_VisibleInstanceNum; i++) {
+                const uint32_t instanceIndex = m_VisibleInstances[i];
+                const utils::Instance& instance = m_Scene.instances[instanceIndex];
+                const utils::Material& material = m_Scene.materials[instance.materialIndex];
 
-        // Reset VRS (per pipeline)
-        if (deviceDesc.shadingRateTier) {
-            nri::ShadingRateDesc shadingRateDesc = {};
-            shadingRateDesc.shadingRate = nri::ShadingRate::FRAGMENT_SIZE_1X1;
-            shadingRateDesc.primitiveCombiner = nri::ShadingRateCombiner::KEEP;
-            shadingRateDesc.attachmentCombiner = nri::ShadingRateCombiner::KEEP;
+                float depth = sceneToClip.a33;
+                depth += sceneToClip.a30 * m_InstanceBounds.centerX[instanceIndex];
+                depth += sceneToClip.a31 * m_InstanceBounds.centerY[instanceIndex];
+                depth += sceneToClip.a32 * m_InstanceBounds.centerZ[instanceIndex];
 
-            NRI.CmdSetShadingRate(commandBuffer, shadingRateDesc);
+                m_SortKeys[i] = GetSortKey(GetPipelineIndex(material), instance.materialIndex, depth);
+            }
+
+            RadixSort(m_SortKeys, m_VisibleInstances, m_TempSortKeys, m_TempVisibleInstances, m_VisibleInstanceNum);
         }
 
+        m_SortingTime = m_Timer.GetTimeStamp() - sortingTime;
+    }
+
+    // Update constants
+    m_Constants.BeginFrame(NRI, frameIndex);
+    {
+        GlobalConstantBufferLayout* constants = m_Constants.Allocate<GlobalConstantBufferLayout>(m_GlobalConstantBufferOffset);
+        if (constants) {
+            constants->gWorldToClip = sceneToClip;
+            constants->gCameraPos = m_Camera.state.position;
+        }
+    }
+    m_Constants.EndFrame(NRI);
+
+    // Record
+    double recordingTime = m_Timer.GetTimeStamp();
+
+    m_BackBuffer = &currentBackBuffer;
+    m_FrameIndex = frameIndex;
+    m_SliceNum = m_IsMultithreadingEnabled ? (uint32_t)m_RecordingThreadNum : 1;
+    m_PipelineStatistics.SetFrameQueryNum(frameIndex, m_SliceNum);
+    m_GpuProfiler.BeginFrame(frameIndex);
+
+    // Workers record the first slices, the main thread records the last one
+    const uint32_t lastSliceIndex = m_SliceNum - 1;
+    m_JobScheduler.Submit(m_RecordJob, 0, lastSliceIndex, m_RecordingCounter);
+
+    nri::CommandBuffer& commandBuffer = *frame.commandBuffer;
+    NRI.BeginCommandBuffer(commandBuffer, m_DescriptorPool);
+    {
+        RecordScene(commandBuffer, lastSliceIndex);
+
         { // UI
+            GpuProfiler::Scope scope(m_GpuProfiler, NRI, commandBuffer, "UI");
+
             nri::AttachmentsDesc attachmentsDesc = {};
             attachmentsDesc.colorNum = 1;
             attachmentsDesc.colors = &currentBackBuffer.colorAttachment;
@@ -784,17 +1079,40 @@ void Sample::RenderFrame(uint32_t frameIndex) {
             NRI.CmdEndRendering(commandBuffer);
         }
 
-        textureBarrierDescs.before = textureBarrierDescs.after;
+        nri::TextureBarrierDesc textureBarrierDescs = {};
+        textureBarrierDescs.texture = currentBackBuffer.texture;
+        textureBarrierDescs.before = {nri::AccessBits::COLOR_ATTACHMENT, nri::Layout::COLOR_ATTACHMENT};
         textureBarrierDescs.after = {nri::AccessBits::UNKNOWN, nri::Layout::PRESENT};
+        textureBarrierDescs.layerNum = 1;
+        textureBarrierDescs.mipNum = 1;
+
+        nri::BarrierGroupDesc barrierGroupDesc = {};
+        barrierGroupDesc.textureNum = 1;
+        barrierGroupDesc.textures = &textureBarrierDescs;
 
         NRI.CmdBarrier(commandBuffer, barrierGroupDesc);
+
+        // Scopes are counted once all slices are recorded
+        m_JobScheduler.Wait(m_RecordingCounter);
+        m_GpuProfiler.CmdEndFrame(NRI, commandBuffer);
     }
     NRI.EndCommandBuffer(commandBuffer);
 
-    { // Submit
+    m_SubmittedCommandBuffers[lastSliceIndex] = frame.commandBuffer;
+
+    m_PipelineSwitchNum = 0;
+    m_DescriptorSetSwitchNum = 0;
+    for (uint32_t i = 0; i < m_SliceNum; i++) {
+        m_PipelineSwitchNum += m_SliceStats[i].pipelineSwitchNum;
+        m_DescriptorSetSwitchNum += m_SliceStats[i].descriptorSetSwitchNum;
+    }
+
+    m_RecordingTime = m_Timer.GetTimeStamp() - recordingTime;
+
+    { // Submit, slices go in order
         nri::QueueSubmitDesc queueSubmitDesc = {};
-        queueSubmitDesc.commandBuffers = &frame.commandBuffer;
-        queueSubmitDesc.commandBufferNum = 1;
+        queueSubmitDesc.commandBuffers = m_SubmittedCommandBuffers.data();
+        queueSubmitDesc.commandBufferNum = m_SliceNum;
 
         NRI.QueueSubmit(*m_GraphicsQueue, queueSubmitDesc);
     }